@@ -0,0 +1,133 @@
+//
+// alloc.c --
+//
+// Nanoseconds per allocation and per free of chunks of 4kB to 32kB (32 to
+// 256 chunks per 1MB page) with free lists and with bitmaps, over
+// BENCH_PAGES (default 256) pages: every chunk is allocated, freed in
+// random order, then allocated again.
+//
+#include "bench.h"
+#include "../free_list.h"
+
+#define PAGES_MAX 4096
+
+struct allocator_
+{
+  const char* name;
+  int  (*init)(void* page, long index, uint8_t* payload, uint32_t count, uint32_t stride);
+  int  (*alloc)(void* page, void** chunk);
+  int  (*free)(void* page, void* chunk);
+};
+
+typedef struct allocator_ allocator_t;
+
+static uint16_t heads[PAGES_MAX];
+static uint64_t bitmaps[PAGES_MAX][PAGE_BITMAP_WORDS(PAGE_BITMAP_SLOTS_MAX)];
+
+
+static
+int list_init(void* page, long index, uint8_t* payload, uint32_t count, uint32_t stride)
+{
+  free_list_t* list = (free_list_t*)page;
+
+  list->offset_bytes  = 2;
+  list->slots_count   = count;
+  list->slots_stride  = stride;
+  list->head_slot_ptr = (uint8_t*)&heads[index];
+  list->payload_ptr   = payload;
+  return free_list_init(list);
+}
+
+static int list_alloc(void* page, void** chunk) { return free_list_alloc((free_list_t*)page, chunk); }
+static int list_free(void* page, void* chunk)   { return free_list_free((free_list_t*)page, chunk); }
+
+
+static
+int bitmap_init(void* page, long index, uint8_t* payload, uint32_t count, uint32_t stride)
+{
+  page_bitmap_t* bitmap = (page_bitmap_t*)page;
+
+  bitmap->slots_count  = count;
+  bitmap->slots_stride = stride;
+  bitmap->bitmap_ptr   = bitmaps[index];
+  bitmap->payload_ptr  = payload;
+  return page_bitmap_init(bitmap);
+}
+
+static int bitmap_alloc(void* page, void** chunk) { return page_bitmap_alloc((page_bitmap_t*)page, chunk); }
+static int bitmap_free(void* page, void* chunk)   { return page_bitmap_free((page_bitmap_t*)page, chunk); }
+
+
+int main(void)
+{
+  static const allocator_t allocators[] = {
+    { "list",   list_init,   list_alloc,   list_free   },
+    { "bitmap", bitmap_init, bitmap_alloc, bitmap_free },
+  };
+  long      pages  = bench_option("BENCH_PAGES", 256);
+  uint8_t*  memory = NULL;
+  union { free_list_t list; page_bitmap_t bitmap; }* states = NULL;
+  void**    chunks = NULL;
+  uint32_t* owners = NULL;
+  uint64_t  state  = 0x9E3779B97F4A7C15ULL;
+  uint64_t  time[3];
+  uint64_t  start  = 0;
+  long      total  = 0;
+
+  if (pages > PAGES_MAX) pages = PAGES_MAX;
+  memory = mmap(NULL, pages * DATA_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  states = malloc(sizeof(*states) * pages);
+  chunks = malloc(sizeof(void*) * pages * PAGE_BITMAP_SLOTS_MAX);
+  owners = malloc(sizeof(uint32_t) * pages * PAGE_BITMAP_SLOTS_MAX);
+  if (memory == MAP_FAILED || !states || !chunks || !owners) { perror("alloc"); return 1; }
+
+  printf("%-6s %-7s %10s %10s %10s\n", "chunk", "alloc", "alloc ns", "free ns", "realloc ns");
+  for (int type = 8; type <= 11; ++type) {
+    uint32_t stride = 16U << type;
+    uint32_t count  = DATA_PAGE_SIZE / stride;
+
+    total = pages * count;
+    for (size_t a = 0; a < sizeof(allocators) / sizeof(allocators[0]); ++a) {
+      const allocator_t* allocator = &allocators[a];
+
+      for (long p = 0; p < pages; ++p) {
+        BENCH_CHECK(allocator->init(&states[p], p, memory + p * DATA_PAGE_SIZE, count, stride));
+      }
+
+      start = bench_ns();
+      for (long p = 0, n = 0; p < pages; ++p) {
+        for (uint32_t k = 0; k < count; ++k, ++n) {
+          BENCH_CHECK(allocator->alloc(&states[p], &chunks[n]));
+          owners[n] = p;
+        }
+      }
+      time[0] = bench_ns() - start;
+
+      // shuffle, keeping each chunk with its page
+      for (long n = total - 1; n > 0; --n) {
+        long     m     = bench_rand(&state) % (n + 1);
+        void*    chunk = chunks[n];
+        uint32_t owner = owners[n];
+
+        chunks[n] = chunks[m]; owners[n] = owners[m];
+        chunks[m] = chunk;     owners[m] = owner;
+      }
+
+      start = bench_ns();
+      for (long n = 0; n < total; ++n) BENCH_CHECK(allocator->free(&states[owners[n]], chunks[n]));
+      time[1] = bench_ns() - start;
+
+      start = bench_ns();
+      for (long n = 0; n < total; ++n) BENCH_CHECK(allocator->alloc(&states[owners[n]], &chunks[n]));
+      time[2] = bench_ns() - start;
+
+      printf("%-6u %-7s %10.1f %10.1f %10.1f\n", stride, allocator->name,
+        (double)time[0] / total, (double)time[1] / total, (double)time[2] / total);
+    }
+  }
+  munmap(memory, pages * DATA_PAGE_SIZE);
+  free(states);
+  free(chunks);
+  free(owners);
+  return 0;
+}
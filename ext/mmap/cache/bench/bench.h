@@ -0,0 +1,256 @@
+//
+// bench.h --
+//
+// Helpers shared by the benchmark programs in this directory: timing,
+// random numbers, key distributions, worker processes and a read-only view
+// of the cache header.
+//
+// Each program is built against the extension's sources (see the <bench>
+// task in the Rakefile) and prints its results as plain text tables. They
+// create their caches under /dev/shm (or $BENCH_DIR) and remove them when
+// done.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "../mmap-cache.h"
+#include "../common.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+  #include <x86intrin.h>
+#endif
+
+// exit with a message if <_CALL> returns non-zero (and set errno)
+#define BENCH_CHECK(_CALL) \
+    do { if (_CALL) { perror(#_CALL) ; exit(1) ; } } while(0)
+
+
+// nanoseconds from an arbitrary origin
+static inline
+uint64_t bench_ns(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+
+// CPU cycles (nanoseconds where there is no cycle counter)
+static inline
+uint64_t bench_cycles(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+  return __rdtsc();
+#else
+  return bench_ns();
+#endif
+}
+
+
+// xorshift64*: next random number of the sequence in <state> (non-zero)
+static inline
+uint64_t bench_rand(uint64_t* state)
+{
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545F4914F6CDD1DULL;
+}
+
+
+// random number in [0, 1)
+static inline
+double bench_uniform(uint64_t* state)
+{
+  return (bench_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+// Zipf distribution over <n> ranks, as a cumulative table for binary
+// search (ranks are shuffled over keys by the caller if needed).
+struct bench_zipf_
+{
+  uint32_t n;
+  double*  cdf;
+};
+
+typedef struct bench_zipf_ bench_zipf_t;
+
+static inline
+void bench_zipf_init(bench_zipf_t* zipf, uint32_t n, double s)
+{
+  double sum = 0;
+
+  zipf->n   = n;
+  zipf->cdf = malloc(sizeof(double) * n);
+  if (zipf->cdf == NULL) { perror("malloc"); exit(1); }
+  for (uint32_t k = 0; k < n; ++k) zipf->cdf[k] = (sum += 1.0 / pow(k + 1, s));
+  for (uint32_t k = 0; k < n; ++k) zipf->cdf[k] /= sum;
+}
+
+
+static inline
+uint32_t bench_zipf_next(bench_zipf_t* zipf, uint64_t* state)
+{
+  double   u    = bench_uniform(state);
+  uint32_t low  = 0;
+  uint32_t high = zipf->n - 1;
+
+  while (low < high) {
+    uint32_t mid = (low + high) / 2;
+    if (zipf->cdf[mid] < u) low  = mid + 1;
+    else                    high = mid;
+  }
+  return low;
+}
+
+
+// log-normal value size around <median> bytes, within [1, <max>]
+static inline
+int bench_lognormal(uint64_t* state, double median, double sigma, int max)
+{
+  double u1    = bench_uniform(state) + 1e-12;
+  double u2    = bench_uniform(state);
+  double z     = sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+  double bytes = median * exp(sigma * z);
+
+  if (bytes < 1)   return 1;
+  if (bytes > max) return max;
+  return (int)bytes;
+}
+
+
+// Base path of the cache <name>, in $BENCH_DIR or /dev/shm.
+static inline
+const char* bench_path(const char* name)
+{
+  static char path[PATH_MAX];
+  const char* dir = getenv("BENCH_DIR");
+
+  snprintf(path, sizeof(path), "%s/mmap-cache-bench-%s", dir ? dir : "/dev/shm", name);
+  return path;
+}
+
+
+// remove the files of the cache at <path>
+static inline
+void bench_unlink(const char* path)
+{
+  char file[PATH_MAX + 8];
+
+  snprintf(file, sizeof(file), "%s.meta", path);
+  unlink(file);
+  snprintf(file, sizeof(file), "%s.data", path);
+  unlink(file);
+}
+
+
+// Create a fresh cache at <path>, exiting on failure.
+static inline
+mmap_cache_t* bench_create(const char* path, int pages, int flags)
+{
+  mmap_cache_t* cache = NULL;
+
+  bench_unlink(path);
+  if (mmap_cache_open(&cache, (char*)path, pages, flags)) {
+    perror(path);
+    exit(1);
+  }
+  return cache;
+}
+
+
+// Map the header of the cache at <path> read-only, for its counters.
+static inline
+const cache_info_t* bench_info(const char* path)
+{
+  char  file[PATH_MAX + 8];
+  int   fd  = -1;
+  void* map = NULL;
+
+  snprintf(file, sizeof(file), "%s.meta", path);
+  fd = open(file, O_RDONLY);
+  if (fd < 0) { perror(file); exit(1); }
+  map = mmap(NULL, sizeof(cache_info_t), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) { perror(file); exit(1); }
+  return (const cache_info_t*)map;
+}
+
+
+// Run <work>(<k>, <context>) in <count> forked processes and wait for all
+// of them; exits if one fails.
+static inline
+void bench_fork(int count, void (*work)(int k, void* context), void* context)
+{
+  pid_t pids[256];
+  int   status = 0;
+
+  for (int k = 0; k < count && k < 256; ++k) {
+    pids[k] = fork();
+    if (pids[k] < 0) { perror("fork"); exit(1); }
+    if (pids[k] == 0) {
+      work(k, context);
+      _exit(0);
+    }
+  }
+  for (int k = 0; k < count && k < 256; ++k) {
+    if (waitpid(pids[k], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+      fprintf(stderr, "worker %d failed\n", k);
+      exit(1);
+    }
+  }
+}
+
+
+// Shared memory for <bytes> of results of forked workers.
+static inline
+void* bench_shared(size_t bytes)
+{
+  void* map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (map == MAP_FAILED) { perror("mmap"); exit(1); }
+  memset(map, 0, bytes);
+  return map;
+}
+
+
+static inline
+int _bench_compare_u64(const void* a, const void* b)
+{
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+
+  return (x > y) - (x < y);
+}
+
+
+// <percent>th percentile of the <count> <samples> (sorted in place)
+static inline
+uint64_t bench_percentile(uint64_t* samples, size_t count, double percent)
+{
+  size_t rank = 0;
+
+  if (count == 0) return 0;
+  qsort(samples, count, sizeof(uint64_t), _bench_compare_u64);
+  rank = (size_t)(percent / 100 * (count - 1) + 0.5);
+  return samples[rank];
+}
+
+
+// Integer option <name> from the environment, or <fallback>.
+static inline
+long bench_option(const char* name, long fallback)
+{
+  const char* value = getenv(name);
+
+  return value ? strtol(value, NULL, 10) : fallback;
+}
@@ -0,0 +1,120 @@
+//
+// collisions.c --
+//
+// Latency of misses on keys whose 32-bit hash collides with that of a key in
+// the cache, against plain misses, in the packed and tagged layouts. Pairs
+// of colliding "user:%010u" keys are found by a birthday search over
+// BENCH_SEARCH (default 2^24) keys, keeping up to BENCH_PAIRS (default
+// 262144); one key of each pair is stored with a
+// 2000-byte value, and the other looked up. With fingerprints, neither kind
+// of miss reads .data; colliding misses still cost more in the packed
+// layout, as their bucket always holds an entry and often an extent.
+//
+#include "bench.h"
+#include "../hash.h"
+
+#define VALUE_BYTES 2000
+
+static
+int compare_hashes(const void* a, const void* b)
+{
+  uint32_t x = *(const uint64_t*)a >> 32;
+  uint32_t y = *(const uint64_t*)b >> 32;
+
+  return (x > y) - (x < y);
+}
+
+
+static
+uint64_t time_misses(mmap_cache_t* cache, const uint32_t* keys, long count, const char* format)
+{
+  uint64_t      total = 0;
+  uint64_t      start = 0;
+  char          key[32];
+  cache_entry_t entry;
+
+  for (long n = 0; n < count; ++n) {
+    entry.key     = key;
+    entry.keysize = snprintf(key, sizeof(key), format, keys[n]);
+    start = bench_cycles();
+    if (mmap_cache_get(cache, &entry) == 0) {
+      fprintf(stderr, "unexpected hit on %s\n", key);
+      exit(1);
+    }
+    total += bench_cycles() - start;
+  }
+  return count ? total / count : 0;
+}
+
+
+int main(void)
+{
+  static const struct { const char* name; int flags; } layouts[] = {
+    { "packed", MMAP_CACHE_PACKED },
+    { "tagged", 0 },
+  };
+  const char*   path    = bench_path("collisions");
+  long          search  = bench_option("BENCH_SEARCH", 1L << 24);
+  long          most    = bench_option("BENCH_PAIRS", 262144);
+  uint64_t*     hashes  = malloc(sizeof(uint64_t) * search);
+  uint32_t*     stored  = malloc(sizeof(uint32_t) * search / 2);
+  uint32_t*     missing = malloc(sizeof(uint32_t) * search / 2);
+  mmap_hash_t   hasher  = mmap_hash_select(mmap_hash_default());
+  mmap_cache_t* cache   = NULL;
+  long          pairs   = 0;
+  long          kept    = 0;
+  char          key[32];
+  char          value[VALUE_BYTES];
+  cache_entry_t entry;
+
+  if (!hashes || !stored || !missing) { perror("malloc"); return 1; }
+  memset(value, 'v', sizeof(value));
+
+  // hash in the high half, key number in the low half
+  for (long n = 0; n < search; ++n) {
+    int length = snprintf(key, sizeof(key), "user:%010u", (uint32_t)n);
+    hashes[n] = (uint64_t)mmap_hash(hasher, key, length) << 32 | (uint32_t)n;
+  }
+  qsort(hashes, search, sizeof(uint64_t), compare_hashes);
+  for (long n = 1; n < search && pairs < most; ++n) {
+    if (hashes[n] >> 32 != hashes[n - 1] >> 32) continue;
+    stored[pairs]  = (uint32_t)hashes[n - 1];
+    missing[pairs] = (uint32_t)hashes[n];
+    ++pairs;
+    ++n;
+  }
+  free(hashes);
+
+  printf("%ld colliding pairs\n", pairs);
+  printf("%-8s %8s %16s %14s\n", "layout", "stored", "colliding miss", "plain miss");
+  for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); ++l) {
+    cache = bench_create(path, (pairs * 2048) / DATA_PAGE_SIZE + 64, layouts[l].flags);
+    for (long n = 0; n < pairs; ++n) {
+      entry.key     = key;
+      entry.keysize = snprintf(key, sizeof(key), "user:%010u", stored[n]);
+      entry.value   = value;
+      entry.bytes   = sizeof(value);
+      entry.ttl     = 0;
+      BENCH_CHECK(mmap_cache_put(cache, &entry));
+    }
+
+    // count the partners still stored, some may have been pushed out
+    kept = 0;
+    for (long n = 0; n < pairs; ++n) {
+      entry.key     = key;
+      entry.keysize = snprintf(key, sizeof(key), "user:%010u", stored[n]);
+      if (mmap_cache_get(cache, &entry) == 0) {
+        free(entry.value);
+        ++kept;
+      }
+    }
+    printf("%-8s %8ld %9lu cycles %7lu cycles\n", layouts[l].name, kept,
+      (unsigned long)time_misses(cache, missing, pairs, "user:%010u"),
+      (unsigned long)time_misses(cache, missing, pairs, "miss:%010u"));
+    BENCH_CHECK(mmap_cache_close(cache));
+  }
+  bench_unlink(path);
+  free(stored);
+  free(missing);
+  return 0;
+}
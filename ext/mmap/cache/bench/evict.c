@@ -0,0 +1,58 @@
+//
+// evict.c --
+//
+// Microseconds per put once every put has to evict, for caches of 128 to
+// BENCH_PAGES (default 1024) pages. Finding a chunk to evict into should
+// not get slower as the cache grows.
+//
+// With BENCH_LARGE=1, the caches are of 1GB and 64GB (1024 and 65536
+// pages) instead. The 64GB one takes that much memory once filled: point
+// BENCH_DIR at a hugetlbfs mount or a large enough tmpfs, or at a disk,
+// where the files start sparse and filling them writes 64GB.
+//
+#include "bench.h"
+
+#define VALUE_BYTES 1000
+#define LARGE_PAGES 65536
+
+int main(void)
+{
+  const char*   path  = bench_path("evict");
+  long          most  = bench_option("BENCH_PAGES", 1024);
+  long          large = bench_option("BENCH_LARGE", 0);
+  long          puts  = bench_option("BENCH_PUTS", 200000);
+  mmap_cache_t* cache = NULL;
+  uint64_t      start = 0;
+  long          n     = 0;
+  long          fill  = 0;
+  char          key[32];
+  char          value[VALUE_BYTES];
+  cache_entry_t entry;
+
+  memset(value, 'v', sizeof(value));
+  printf("%-6s %10s\n", "pages", "us/put");
+  if (large) most = LARGE_PAGES;
+  for (long pages = large ? 1024 : 128; pages <= most; pages *= large ? 64 : 2) {
+    cache = bench_create(path, pages, 0);
+    entry.key   = key;
+    entry.value = value;
+    entry.bytes = sizeof(value);
+    entry.ttl   = 0;
+
+    // twice as many keys as fit, so that the timed puts all evict
+    fill = pages * (DATA_PAGE_SIZE / 1024) * 2;
+    for (n = 0; n < fill; ++n) {
+      entry.keysize = snprintf(key, sizeof(key), "user:%010ld", n);
+      BENCH_CHECK(mmap_cache_put(cache, &entry));
+    }
+    start = bench_ns();
+    for (long k = 0; k < puts; ++k, ++n) {
+      entry.keysize = snprintf(key, sizeof(key), "user:%010ld", n);
+      BENCH_CHECK(mmap_cache_put(cache, &entry));
+    }
+    printf("%-6ld %10.2f\n", pages, (bench_ns() - start) / 1e3 / puts);
+    BENCH_CHECK(mmap_cache_close(cache));
+  }
+  bench_unlink(path);
+  return 0;
+}
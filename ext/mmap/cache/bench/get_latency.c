@@ -0,0 +1,105 @@
+//
+// get_latency.c --
+//
+// Latency of gets (p50, p99, p99.9 in ns) from one process while 0 to
+// BENCH_WRITERS (default 2) other processes keep overwriting the same keys.
+// Gets read optimistically under the stripe sequence numbers, so the
+// readers' tail should stay close to the one without writers.
+//
+#include "bench.h"
+
+#define KEYS        20000
+#define VALUE_BYTES 200
+
+struct context_
+{
+  const char*   path;
+  volatile int* stop;
+};
+
+typedef struct context_ context_t;
+
+
+static
+void fill_entry(cache_entry_t* entry, char* key, long n, char* value)
+{
+  entry->key     = key;
+  entry->keysize = snprintf(key, 32, "user:%010ld", n);
+  entry->value   = value;
+  entry->bytes   = VALUE_BYTES;
+  entry->ttl     = 0;
+}
+
+
+static
+void write_worker(int k, void* argument)
+{
+  context_t*    context = (context_t*)argument;
+  mmap_cache_t* cache   = NULL;
+  uint64_t      state   = 0x9E3779B97F4A7C15ULL * (k + 1);
+  char          key[32];
+  char          value[VALUE_BYTES];
+  cache_entry_t entry;
+
+  memset(value, 'a' + k, sizeof(value));
+  BENCH_CHECK(mmap_cache_open(&cache, (char*)context->path, 0, 0));
+  while (!*context->stop) {
+    fill_entry(&entry, key, bench_rand(&state) % KEYS, value);
+    BENCH_CHECK(mmap_cache_put(cache, &entry));
+  }
+  BENCH_CHECK(mmap_cache_close(cache));
+}
+
+
+int main(void)
+{
+  const char*   path     = bench_path("get_latency");
+  long          writers  = bench_option("BENCH_WRITERS", 2);
+  long          gets     = bench_option("BENCH_GETS", 500000);
+  uint64_t*     samples  = malloc(sizeof(uint64_t) * gets);
+  volatile int* stop     = bench_shared(sizeof(int));
+  context_t     context  = { path, stop };
+  mmap_cache_t* cache    = NULL;
+  uint64_t      state    = 88172645463325252ULL;
+  uint64_t      start    = 0;
+  char          key[32];
+  char          value[VALUE_BYTES];
+  cache_entry_t entry;
+
+  if (samples == NULL) { perror("malloc"); return 1; }
+  memset(value, 'v', sizeof(value));
+  printf("%-8s %10s %10s %10s\n", "writers", "p50 ns", "p99 ns", "p99.9 ns");
+  for (int count = 0; count <= writers; ++count) {
+    cache = bench_create(path, 64, 0);
+    for (long n = 0; n < KEYS; ++n) {
+      fill_entry(&entry, key, n, value);
+      BENCH_CHECK(mmap_cache_put(cache, &entry));
+    }
+
+    // the writers run in a child while the parent reads
+    *stop = 0;
+    if (count > 0 && fork() == 0) {
+      bench_fork(count, write_worker, &context);
+      _exit(0);
+    }
+    for (long n = 0; n < gets; ++n) {
+      entry.key     = key;
+      entry.keysize = snprintf(key, sizeof(key), "user:%010ld", (long)(bench_rand(&state) % KEYS));
+      start = bench_ns();
+      BENCH_CHECK(mmap_cache_get(cache, &entry));
+      samples[n] = bench_ns() - start;
+      free(entry.value);
+    }
+    *stop = 1;
+    if (count > 0 && wait(NULL) < 0) { perror("wait"); return 1; }
+
+    printf("%-8d %10lu %10lu %10lu\n", count,
+      (unsigned long)bench_percentile(samples, gets, 50),
+      (unsigned long)bench_percentile(samples, gets, 99),
+      (unsigned long)bench_percentile(samples, gets, 99.9));
+    BENCH_CHECK(mmap_cache_close(cache));
+  }
+  bench_unlink(path);
+  free(samples);
+  return 0;
+}
@@ -0,0 +1,53 @@
+//
+// hash_speed.c --
+//
+// Cycles per key of each hash function (see hash.h) for keys of 8, 16, 40,
+// 100 and 200 bytes, best of several rounds over a set of random keys.
+//
+#include "bench.h"
+#include "../hash.h"
+
+#define KEYS   1024
+#define ROUNDS 200
+
+int main(void)
+{
+  static const struct { const char* name; uint8_t function; } hashes[] = {
+    { "lookup3", MMAP_HASH_LOOKUP3 },
+    { "crc32c",  MMAP_HASH_CRC32C  },
+    { "wyhash",  MMAP_HASH_WYHASH  },
+  };
+  static const size_t lengths[] = { 8, 16, 40, 100, 200 };
+  uint8_t*          keys    = malloc(KEYS * 200);
+  uint64_t          state   = 0x9E3779B97F4A7C15ULL;
+  volatile uint64_t sink    = 0;
+  mmap_hash_t       hasher;
+  uint64_t          best    = 0;
+  uint64_t          start   = 0;
+  uint64_t          elapsed = 0;
+
+  if (keys == NULL) { perror("malloc"); return 1; }
+  for (size_t k = 0; k < KEYS * 200; ++k) keys[k] = (uint8_t)bench_rand(&state);
+
+  printf("%-8s", "bytes");
+  for (size_t b = 0; b < sizeof(lengths) / sizeof(lengths[0]); ++b) printf(" %6zu", lengths[b]);
+  printf("\n");
+  for (size_t h = 0; h < sizeof(hashes) / sizeof(hashes[0]); ++h) {
+    hasher = mmap_hash_select(hashes[h].function);
+    printf("%-8s", hashes[h].name);
+    for (size_t b = 0; b < sizeof(lengths) / sizeof(lengths[0]); ++b) {
+      best = UINT64_MAX;
+      for (int round = 0; round < ROUNDS; ++round) {
+        start = bench_cycles();
+        for (size_t k = 0; k < KEYS; ++k) sink += hasher(keys + k * 200, lengths[b]);
+        elapsed = bench_cycles() - start;
+        if (elapsed < best) best = elapsed;
+      }
+      printf(" %6lu", (unsigned long)(best / KEYS));
+    }
+    printf("\n");
+  }
+  (void)sink;
+  free(keys);
+  return 0;
+}
@@ -0,0 +1,62 @@
+//
+// huge_pages.c --
+//
+// Get latency (mean, p50, p99 in ns) on BENCH_KEYS (default 1M) random keys
+// of a 512-page cache, with and without MMAP_CACHE_HUGE_PAGES. Set
+// BENCH_DIR to a tmpfs mounted with huge=advise, or to a hugetlbfs mount,
+// for the flag to make a difference (see <mmap_cache_open>).
+//
+#include "bench.h"
+
+#define VALUE_BYTES 100
+
+int main(void)
+{
+  static const struct { const char* name; int flags; } modes[] = {
+    { "normal", 0 },
+    { "huge",   MMAP_CACHE_HUGE_PAGES },
+  };
+  const char*   path    = bench_path("huge_pages");
+  long          keys    = bench_option("BENCH_KEYS", 1000000);
+  long          gets    = bench_option("BENCH_GETS", 1000000);
+  uint64_t*     samples = malloc(sizeof(uint64_t) * gets);
+  mmap_cache_t* cache   = NULL;
+  uint64_t      state   = 0x9E3779B97F4A7C15ULL;
+  uint64_t      sum     = 0;
+  uint64_t      start   = 0;
+  char          key[32];
+  char          value[VALUE_BYTES];
+  cache_entry_t entry;
+
+  if (samples == NULL) { perror("malloc"); return 1; }
+  memset(value, 'v', sizeof(value));
+  printf("%-7s %8s %8s %8s\n", "pages", "mean ns", "p50 ns", "p99 ns");
+  for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+    cache = bench_create(path, 512, modes[m].flags);
+    for (long n = 0; n < keys; ++n) {
+      entry.key     = key;
+      entry.keysize = snprintf(key, sizeof(key), "user:%010ld", n);
+      entry.value   = value;
+      entry.bytes   = sizeof(value);
+      entry.ttl     = 0;
+      BENCH_CHECK(mmap_cache_put(cache, &entry));
+    }
+
+    sum = 0;
+    for (long n = 0; n < gets; ++n) {
+      entry.key     = key;
+      entry.keysize = snprintf(key, sizeof(key), "user:%010ld", (long)(bench_rand(&state) % keys));
+      start = bench_ns();
+      if (mmap_cache_get(cache, &entry) == 0) free(entry.value);
+      samples[n] = bench_ns() - start;
+      sum += samples[n];
+    }
+    printf("%-7s %8lu %8lu %8lu\n", modes[m].name, (unsigned long)(sum / gets),
+      (unsigned long)bench_percentile(samples, gets, 50),
+      (unsigned long)bench_percentile(samples, gets, 99));
+    BENCH_CHECK(mmap_cache_close(cache));
+  }
+  bench_unlink(path);
+  free(samples);
+  return 0;
+}
@@ -0,0 +1,65 @@
+//
+// inline.c --
+//
+// Cycles per hit, and bytes of the data file used per entry, for
+// BENCH_KEYS (default 500k) keys with 8-byte values in a 256-page aligned
+// cache, with and without MMAP_CACHE_INLINE.
+//
+#include "bench.h"
+
+#define VALUE_BYTES 8
+
+int main(void)
+{
+  static const struct { const char* name; int flags; } modes[] = {
+    { "aligned", MMAP_CACHE_ALIGNED },
+    { "inline",  MMAP_CACHE_ALIGNED | MMAP_CACHE_INLINE },
+  };
+  const char*         path  = bench_path("inline");
+  long                keys  = bench_option("BENCH_KEYS", 500000);
+  long                gets  = bench_option("BENCH_GETS", 1000000);
+  mmap_cache_t*       cache = NULL;
+  const cache_info_t* info  = NULL;
+  uint64_t            state = 0x9E3779B97F4A7C15ULL;
+  uint64_t            total = 0;
+  uint64_t            start = 0;
+  long                hits  = 0;
+  char                key[32];
+  char                value[VALUE_BYTES];
+  cache_entry_t       entry;
+
+  memset(value, 'v', sizeof(value));
+  printf("%-8s %9s %7s %12s %12s\n", "layout", "entries", "hits", "hit cycles", "data bytes");
+  for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+    cache = bench_create(path, 256, modes[m].flags);
+    info  = bench_info(path);
+    entry.key = key;
+    for (long n = 0; n < keys; ++n) {
+      entry.keysize = snprintf(key, sizeof(key), "user:%010ld", n);
+      entry.value   = value;
+      entry.bytes   = sizeof(value);
+      entry.ttl     = 0;
+      BENCH_CHECK(mmap_cache_put(cache, &entry));
+    }
+
+    total = 0;
+    hits  = 0;
+    for (long n = 0; n < gets; ++n) {
+      entry.keysize = snprintf(key, sizeof(key), "user:%010ld", (long)(bench_rand(&state) % keys));
+      start = bench_cycles();
+      if (mmap_cache_get(cache, &entry) == 0) {
+        total += bench_cycles() - start;
+        free(entry.value);
+        ++hits;
+      }
+    }
+    printf("%-8s %9lu %6.1f%% %12lu %12.1f\n", modes[m].name,
+      (unsigned long)info->entries_used, 100.0 * hits / gets,
+      (unsigned long)(hits ? total / hits : 0),
+      info->entries_used ? (double)info->bytes_used / info->entries_used : 0.0);
+    munmap((void*)info, sizeof(cache_info_t));
+    BENCH_CHECK(mmap_cache_close(cache));
+  }
+  bench_unlink(path);
+  return 0;
+}
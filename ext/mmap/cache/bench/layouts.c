@@ -0,0 +1,68 @@
+//
+// layouts.c --
+//
+// Cycles per hit and per put (overwriting) of BENCH_KEYS (default 200k)
+// keys with 100-byte values in a 256-page cache, in the packed, tagged and
+// aligned hash table layouts.
+//
+#include "bench.h"
+
+#define VALUE_BYTES 100
+
+int main(void)
+{
+  static const struct { const char* name; int flags; } layouts[] = {
+    { "packed",  MMAP_CACHE_PACKED  },
+    { "tagged",  0                  },
+    { "aligned", MMAP_CACHE_ALIGNED },
+  };
+  const char*   path  = bench_path("layouts");
+  long          keys  = bench_option("BENCH_KEYS", 200000);
+  long          ops   = bench_option("BENCH_OPS", 1000000);
+  mmap_cache_t* cache = NULL;
+  uint64_t      state = 0x9E3779B97F4A7C15ULL;
+  uint64_t      time[2];
+  uint64_t      start = 0;
+  long          hits  = 0;
+  char          key[32];
+  char          value[VALUE_BYTES];
+  cache_entry_t entry;
+
+  memset(value, 'v', sizeof(value));
+  printf("%-8s %7s %12s %12s\n", "layout", "hits", "get cycles", "put cycles");
+  for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); ++l) {
+    cache = bench_create(path, 256, layouts[l].flags);
+    entry.key = key;
+    for (long n = 0; n < keys; ++n) {
+      entry.keysize = snprintf(key, sizeof(key), "user:%010ld", n);
+      entry.value   = value;
+      entry.bytes   = sizeof(value);
+      entry.ttl     = 0;
+      BENCH_CHECK(mmap_cache_put(cache, &entry));
+    }
+
+    memset(time, 0, sizeof(time));
+    hits = 0;
+    for (long n = 0; n < ops; ++n) {
+      entry.keysize = snprintf(key, sizeof(key), "user:%010ld", (long)(bench_rand(&state) % keys));
+      start = bench_cycles();
+      if (mmap_cache_get(cache, &entry) == 0) {
+        time[0] += bench_cycles() - start;
+        free(entry.value);
+        ++hits;
+      }
+
+      entry.keysize = snprintf(key, sizeof(key), "user:%010ld", (long)(bench_rand(&state) % keys));
+      entry.value   = value;
+      entry.bytes   = sizeof(value);
+      start = bench_cycles();
+      BENCH_CHECK(mmap_cache_put(cache, &entry));
+      time[1] += bench_cycles() - start;
+    }
+    printf("%-8s %6.1f%% %12lu %12lu\n", layouts[l].name, 100.0 * hits / ops,
+      (unsigned long)(hits ? time[0] / hits : 0), (unsigned long)(time[1] / ops));
+    BENCH_CHECK(mmap_cache_close(cache));
+  }
+  bench_unlink(path);
+  return 0;
+}
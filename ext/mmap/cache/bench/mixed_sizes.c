@@ -0,0 +1,75 @@
+//
+// mixed_sizes.c --
+//
+// Cache-aside replay on a 64-page cache: BENCH_GETS (default 2M) gets of
+// Zipf (0.9) distributed keys, each miss followed by a put. Values are small
+// (16-512 bytes) for 70% of the keys, 1-4kB for 25% and 16-64kB for 5%.
+// Prints the hit ratio, the puts that failed and the entries left, for 50k
+// and 200k keys.
+//
+#include "bench.h"
+
+#define VALUE_MAX (64 * 1024)
+
+// size of the value of key <n>, the same on every run
+static
+int value_bytes(long n)
+{
+  uint64_t state = 0x9E3779B97F4A7C15ULL ^ (uint64_t)(n + 1) * 0xBF58476D1CE4E5B9ULL;
+  int      kind  = bench_rand(&state) % 100;
+  uint64_t size  = bench_rand(&state);
+
+  if (kind < 70) return 16 + size % (512 - 16);
+  if (kind < 95) return 1024 + size % (3 * 1024);
+  return 16 * 1024 + size % (48 * 1024);
+}
+
+
+int main(void)
+{
+  static const long sizes[] = { 50000, 200000 };
+  const char*         path   = bench_path("mixed_sizes");
+  long                gets   = bench_option("BENCH_GETS", 2000000);
+  char*               value  = malloc(VALUE_MAX);
+  mmap_cache_t*       cache  = NULL;
+  const cache_info_t* info   = NULL;
+  uint64_t            state  = 0x853C49E6748FEA9BULL;
+  bench_zipf_t        zipf;
+  long                hits   = 0;
+  long                failed = 0;
+  long                n      = 0;
+  char                key[32];
+  cache_entry_t       entry;
+
+  if (value == NULL) { perror("malloc"); return 1; }
+  memset(value, 'v', VALUE_MAX);
+  printf("%-7s %8s %8s %9s\n", "keys", "hits", "failed", "entries");
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    bench_zipf_init(&zipf, sizes[s], 0.9);
+    cache = bench_create(path, 64, 0);
+    info  = bench_info(path);
+    hits  = failed = 0;
+    for (long g = 0; g < gets; ++g) {
+      n = bench_zipf_next(&zipf, &state);
+      entry.key     = key;
+      entry.keysize = snprintf(key, sizeof(key), "user:%010ld", n);
+      if (mmap_cache_get(cache, &entry) == 0) {
+        free(entry.value);
+        ++hits;
+        continue;
+      }
+      entry.value = value;
+      entry.bytes = value_bytes(n);
+      entry.ttl   = 0;
+      if (mmap_cache_put(cache, &entry)) ++failed;
+    }
+    printf("%-7ld %7.1f%% %8ld %9lu\n", sizes[s], 100.0 * hits / gets, failed,
+      (unsigned long)info->entries_used);
+    munmap((void*)info, sizeof(cache_info_t));
+    BENCH_CHECK(mmap_cache_close(cache));
+    free(zipf.cdf);
+  }
+  bench_unlink(path);
+  free(value);
+  return 0;
+}
@@ -0,0 +1,93 @@
+//
+// multi.c --
+//
+// Nanoseconds per key of single gets and puts against <mmap_cache_get_multi>
+// and <mmap_cache_put_multi>, for batches of 1 to 512 random keys.
+//
+#include "bench.h"
+
+#define KEYS        200000
+#define VALUE_BYTES 100
+#define BATCH_MAX   512
+
+static char          keys[BATCH_MAX][32];
+static char          value[VALUE_BYTES];
+static cache_entry_t entries[BATCH_MAX];
+
+
+// set up <count> entries with random keys (each timing gets its own, so
+// that none reads lines warmed up by the previous one)
+static
+void pick_keys(uint64_t* state, int count)
+{
+  for (int k = 0; k < count; ++k) {
+    entries[k].key     = keys[k];
+    entries[k].keysize = snprintf(keys[k], sizeof(keys[k]), "user:%010ld", (long)(bench_rand(state) % KEYS));
+    entries[k].value   = value;
+    entries[k].bytes   = sizeof(value);
+    entries[k].ttl     = 0;
+  }
+}
+
+
+int main(void)
+{
+  static const int batches[] = { 1, 4, 16, 64, 256, 512 };
+  const char*   path    = bench_path("multi");
+  long          rounds  = bench_option("BENCH_KEYS", 200000);
+  mmap_cache_t* cache   = NULL;
+  uint64_t      state   = 0x853C49E6748FEA9BULL;
+  uint64_t      time[4];
+  uint64_t      start   = 0;
+  int           count   = 0;
+  long          total   = 0;
+
+  memset(value, 'v', sizeof(value));
+  cache = bench_create(path, 128, 0);
+  for (long n = 0; n < KEYS; ++n) {
+    entries[0].key     = keys[0];
+    entries[0].keysize = snprintf(keys[0], sizeof(keys[0]), "user:%010ld", n);
+    entries[0].value   = value;
+    entries[0].bytes   = sizeof(value);
+    entries[0].ttl     = 0;
+    BENCH_CHECK(mmap_cache_put(cache, &entries[0]));
+  }
+
+  printf("%-6s %10s %10s %10s %10s\n", "batch", "get ns", "multi ns", "put ns", "multi ns");
+  for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); ++b) {
+    count = batches[b];
+    total = rounds / count * count;
+    memset(time, 0, sizeof(time));
+    for (long round = 0; round < rounds / count; ++round) {
+      pick_keys(&state, count);
+      start = bench_ns();
+      for (int k = 0; k < count; ++k) {
+        BENCH_CHECK(mmap_cache_get(cache, &entries[k]));
+        free(entries[k].value);
+      }
+      time[0] += bench_ns() - start;
+
+      pick_keys(&state, count);
+      start = bench_ns();
+      BENCH_CHECK(mmap_cache_get_multi(cache, entries, count));
+      time[1] += bench_ns() - start;
+      for (int k = 0; k < count; ++k) free(entries[k].value);
+
+      pick_keys(&state, count);
+      start = bench_ns();
+      for (int k = 0; k < count; ++k) BENCH_CHECK(mmap_cache_put(cache, &entries[k]));
+      time[2] += bench_ns() - start;
+
+      pick_keys(&state, count);
+      start = bench_ns();
+      BENCH_CHECK(mmap_cache_put_multi(cache, entries, count));
+      time[3] += bench_ns() - start;
+    }
+    printf("%-6d %10lu %10lu %10lu %10lu\n", count,
+      (unsigned long)(time[0] / total), (unsigned long)(time[1] / total),
+      (unsigned long)(time[2] / total), (unsigned long)(time[3] / total));
+  }
+  BENCH_CHECK(mmap_cache_close(cache));
+  bench_unlink(path);
+  return 0;
+}
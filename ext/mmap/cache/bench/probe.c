@@ -0,0 +1,90 @@
+//
+// probe.c --
+//
+// Cycles per hit and per miss in the packed (bucket + extent) and tagged
+// (16-entry group) hash table layouts, at load factors of 0.5, 0.8 and 0.95.
+// Misses in the tagged layout should usually stop at the group's tag line.
+//
+// The load is the one the table grows by, entries per bucket (or per group
+// of 16 slots). As growing keeps it around 0.5 until the table reaches its
+// largest size, it is set there: the keys are that many times the buckets
+// (or groups) of the table at its largest. Small values keep that many keys
+// in the 32 pages of the cache.
+//
+#include "bench.h"
+
+#define PAGES       32
+#define VALUE_BYTES 8
+
+static
+uint64_t time_gets(mmap_cache_t* cache, long keys, long gets, const char* format, long* hits)
+{
+  uint64_t      state = 0x2545F4914F6CDD1DULL;
+  uint64_t      total = 0;
+  uint64_t      start = 0;
+  int           res   = 0;
+  char          key[32];
+  cache_entry_t entry;
+
+  for (long n = 0; n < gets; ++n) {
+    entry.key     = key;
+    entry.keysize = snprintf(key, sizeof(key), format, (long)(bench_rand(&state) % keys));
+    start = bench_cycles();
+    res   = mmap_cache_get(cache, &entry);
+    total += bench_cycles() - start;
+    if (res == 0) {
+      free(entry.value);
+      ++*hits;
+    }
+  }
+  return total / gets;
+}
+
+
+int main(void)
+{
+  static const struct { const char* name; int flags; } layouts[] = {
+    { "packed", MMAP_CACHE_PACKED },
+    { "tagged", 0 },
+  };
+  static const double loads[] = { 0.5, 0.8, 0.95 };
+  const char*         path  = bench_path("probe");
+  long                gets  = bench_option("BENCH_GETS", 500000);
+  mmap_cache_t*       cache = NULL;
+  const cache_info_t* info  = NULL;
+  char                key[32];
+  char                value[VALUE_BYTES];
+  cache_entry_t       entry;
+  long                keys  = 0;
+  long                hits  = 0;
+  uint64_t            hit   = 0;
+  uint64_t            miss  = 0;
+
+  memset(value, 'v', sizeof(value));
+  // keys pushed out for lack of extents turn some of the hits into misses
+  printf("%-8s %5s %8s %7s %12s %12s\n", "layout", "load", "keys", "hits", "hit cycles", "miss cycles");
+  for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); ++l) {
+    for (size_t s = 0; s < sizeof(loads) / sizeof(loads[0]); ++s) {
+      cache = bench_create(path, PAGES, layouts[l].flags);
+      info  = bench_info(path);
+      keys  = (long)(loads[s] * (1L << info->hash_table_max_size));
+      for (long n = 0; n < keys; ++n) {
+        entry.key     = key;
+        entry.keysize = snprintf(key, sizeof(key), "user:%010ld", n);
+        entry.value   = value;
+        entry.bytes   = sizeof(value);
+        entry.ttl     = 0;
+        BENCH_CHECK(mmap_cache_put(cache, &entry));
+      }
+      hits = 0;
+      hit  = time_gets(cache, keys, gets, "user:%010ld", &hits);
+      miss = time_gets(cache, keys, gets, "miss:%010ld", &(long){ 0 });
+      printf("%-8s %5.2f %8ld %6.1f%% %12lu %12lu\n", layouts[l].name, loads[s], keys,
+        100.0 * hits / gets, (unsigned long)hit, (unsigned long)miss);
+      BENCH_CHECK(mmap_cache_close(cache));
+      munmap((void*)info, sizeof(cache_info_t));
+    }
+  }
+  bench_unlink(path);
+  return 0;
+}
@@ -0,0 +1,67 @@
+//
+// put_scaling.c --
+//
+// Put throughput of 1 to BENCH_WORKERS (default 8) processes writing to the
+// same cache at once, each to its own keys, so that they only contend on
+// the lock stripes and the meta lock. Puts/s should grow with the
+// processes up to the number of CPUs.
+//
+#include "bench.h"
+
+#define VALUE_BYTES 100
+
+struct context_
+{
+  const char* path;
+  long        puts;
+  long        keys;
+};
+
+typedef struct context_ context_t;
+
+
+static
+void put_worker(int k, void* argument)
+{
+  context_t*    context = (context_t*)argument;
+  mmap_cache_t* cache   = NULL;
+  char          key[32];
+  char          value[VALUE_BYTES];
+  cache_entry_t entry;
+
+  memset(value, 'x', sizeof(value));
+  BENCH_CHECK(mmap_cache_open(&cache, (char*)context->path, 0, 0));
+  for (long n = 0; n < context->puts; ++n) {
+    entry.key     = key;
+    entry.keysize = snprintf(key, sizeof(key), "w%02d:%010ld", k, n % context->keys);
+    entry.value   = value;
+    entry.bytes   = sizeof(value);
+    entry.ttl     = 0;
+    BENCH_CHECK(mmap_cache_put(cache, &entry));
+  }
+  BENCH_CHECK(mmap_cache_close(cache));
+}
+
+
+int main(void)
+{
+  const char*   path    = bench_path("put_scaling");
+  long          workers = bench_option("BENCH_WORKERS", 8);
+  context_t     context = { path, bench_option("BENCH_PUTS", 200000), 50000 };
+  mmap_cache_t* cache   = NULL;
+  uint64_t      start   = 0;
+  double        seconds = 0;
+
+  printf("%-10s %12s %14s\n", "processes", "puts/s", "puts/s/process");
+  for (int count = 1; count <= workers; count *= 2) {
+    cache = bench_create(path, 256, 0);
+    start = bench_ns();
+    bench_fork(count, put_worker, &context);
+    seconds = (bench_ns() - start) / 1e9;
+    printf("%-10d %12.0f %14.0f\n", count,
+      count * context.puts / seconds, context.puts / seconds);
+    BENCH_CHECK(mmap_cache_close(cache));
+  }
+  bench_unlink(path);
+  return 0;
+}
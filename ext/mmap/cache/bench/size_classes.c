@@ -0,0 +1,85 @@
+//
+// size_classes.c --
+//
+// Chunk sizes in powers of two against classes growing by 1.25
+// (MMAP_CACHE_GROWTH(125)): BENCH_GETS (default 2M) Zipf (0.9) gets over
+// 500k keys, each miss followed by a put, with log-normal value sizes of
+// median 1.5kB on 256 pages, and of median 100 bytes on 64 pages. Prints the
+// hit ratio, the share of the data file holding keys and values, the share
+// of the chunks in use wasted, and the entries left.
+//
+#include "bench.h"
+
+#define KEYS      500000
+#define VALUE_MAX (256 * 1024)
+
+// size of the value of key <n>, the same on every run
+static
+int value_bytes(long n, double median)
+{
+  uint64_t state = 0x9E3779B97F4A7C15ULL ^ (uint64_t)(n + 1) * 0xBF58476D1CE4E5B9ULL;
+
+  return bench_lognormal(&state, median, 1.0, VALUE_MAX);
+}
+
+
+int main(void)
+{
+  static const struct { const char* name; int flags; } modes[] = {
+    { "pow2", 0 },
+    { "1.25", MMAP_CACHE_GROWTH(125) },
+  };
+  static const struct { double median; int pages; } workloads[] = {
+    { 1536, 256 },
+    { 100,  64  },
+  };
+  const char*         path   = bench_path("size_classes");
+  long                gets   = bench_option("BENCH_GETS", 2000000);
+  char*               value  = malloc(VALUE_MAX);
+  mmap_cache_t*       cache  = NULL;
+  const cache_info_t* info   = NULL;
+  uint64_t            state  = 0;
+  bench_zipf_t        zipf;
+  long                hits   = 0;
+  long                n      = 0;
+  char                key[32];
+  cache_entry_t       entry;
+
+  if (value == NULL) { perror("malloc"); return 1; }
+  memset(value, 'v', VALUE_MAX);
+  bench_zipf_init(&zipf, KEYS, 0.9);
+  printf("%-7s %-6s %6s %6s %6s %9s\n", "median", "sizes", "hits", "held", "waste", "entries");
+  for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); ++w) {
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+      cache = bench_create(path, workloads[w].pages, modes[m].flags);
+      info  = bench_info(path);
+      state = 0x853C49E6748FEA9BULL;
+      hits  = 0;
+      for (long g = 0; g < gets; ++g) {
+        n = bench_zipf_next(&zipf, &state);
+        entry.key     = key;
+        entry.keysize = snprintf(key, sizeof(key), "user:%010ld", n);
+        if (mmap_cache_get(cache, &entry) == 0) {
+          free(entry.value);
+          ++hits;
+          continue;
+        }
+        entry.value = value;
+        entry.bytes = value_bytes(n, workloads[w].median);
+        entry.ttl   = 0;
+        mmap_cache_put(cache, &entry);
+      }
+      printf("%-7.0f %-6s %5.1f%% %5.1f%% %5.1f%% %9lu\n", workloads[w].median, modes[m].name,
+        100.0 * hits / gets,
+        100.0 * (info->bytes_used - info->bytes_wasted) / ((double)workloads[w].pages * DATA_PAGE_SIZE),
+        info->bytes_used ? 100.0 * info->bytes_wasted / info->bytes_used : 0.0,
+        (unsigned long)info->entries_used);
+      munmap((void*)info, sizeof(cache_info_t));
+      BENCH_CHECK(mmap_cache_close(cache));
+    }
+  }
+  bench_unlink(path);
+  free(zipf.cdf);
+  free(value);
+  return 0;
+}
@@ -1,13 +1,21 @@
+#include <ruby.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "mmap-cache.h"
 
 static VALUE eClosedError = Qnil;
-static VALUE eMmapCacheModule = Qnil;
+static VALUE eFullError = Qnil;
+static VALUE eMmapModule = Qnil;
 
 /******************************************************************************/
 
 static int raise_if_closed(VALUE self)
 {
   if (rb_ivar_get(self, rb_intern("@closed")) != Qtrue) return 0;
-  rb_raise(eClosedError, "Map was freed");
+  rb_raise(eClosedError, "Cache was closed");
   return 1;
 }
 
@@ -18,179 +26,325 @@ static void mark_as_closed(VALUE self)
 
 /******************************************************************************/
 
-static void mmap_cache_free(void* haystack)
+// (runs during GC, where raising or allocating Ruby objects is not allowed:
+// close errors go to stderr)
+static void raw_cache_free(void* cache)
 {
-  int res = -1;
+  if (cache == NULL) return;
+  if (mmap_cache_close((mmap_cache_t*) cache)) {
+    fprintf(stderr, "mmap-cache: cannot close cache: %s\n", strerror(errno));
+  }
+}
+
+/******************************************************************************/
 
-  if (haystack == NULL) return;
-  // res = mmap_cache_storage_close((trigram_map*) &haystack);
-  assert(res >= 0);
+// RawCache.new(path, pages, flags = 0), see mmap_cache_open for <flags>
+// (a growth factor of 1.25 is 125 << GROWTH_SHIFT).
+static VALUE raw_cache_new(int argc, VALUE* argv, VALUE class) {
+  VALUE         wrapper  = Qnil;
+  VALUE         rb_path  = Qnil;
+  VALUE         rb_pages = Qnil;
+  VALUE         rb_flags = Qnil;
+  mmap_cache_t* cache    = NULL;
+  char*         path     = NULL;
+  int           res      = -1;
+
+  rb_scan_args(argc, argv, "21", &rb_path, &rb_pages, &rb_flags);
+  path = StringValueCStr(rb_path);
+
+  res = mmap_cache_open(&cache, path, NUM2INT(rb_pages), NIL_P(rb_flags) ? 0 : NUM2INT(rb_flags));
+  if (res) { rb_sys_fail(path); return Qnil; }
+
+  wrapper = Data_Wrap_Struct(class, NULL, raw_cache_free, (void*)cache);
+  rb_obj_call_init(wrapper, 0, NULL);
+  return wrapper;
 }
 
 /******************************************************************************/
 
-static void mmap_cache_mark(void* haystack)
-{
-  if (haystack == NULL) return;
-  // mmap_cache_storage_mark((trigram_map) haystack);
+static VALUE raw_cache_initialize(VALUE self) {
+  (void)self;
+  return Qtrue;
 }
 
 /******************************************************************************/
 
-static VALUE mmap_cache_new(VALUE class) {
-  VALUE       wrapper  = Qnil;
-  trigram_map haystack = (trigram_map)NULL;
-  int         res      = -1;
+// Keys are binary strings: their length is passed along, and they may
+// contain NUL bytes.
+static VALUE raw_cache_get(VALUE self, VALUE rb_key) {
+  mmap_cache_t* cache = NULL;
+  cache_entry_t entry;
+  VALUE         result = Qnil;
+  int           res    = -1;
 
-  // res = mmap_cache_storage_new(&haystack);
-  if (res < 0) { rb_sys_fail(NULL); return Qnil; }
+  if (raise_if_closed(self)) return Qnil;
+  Data_Get_Struct(self, mmap_cache_t, cache);
+  StringValue(rb_key);
 
-  wrapper = Data_Wrap_Struct(class, mmap_cache_mark, mmap_cache_free, (void*)haystack);
-  rb_obj_call_init(wrapper, 0, NULL);
-  return wrapper;
+  entry.key     = RSTRING_PTR(rb_key);
+  entry.keysize = (int)RSTRING_LEN(rb_key);
+  entry.value   = NULL;
+  entry.bytes   = 0;
+  entry.ttl     = 0;
+
+  res = mmap_cache_get(cache, &entry);
+  if (res && errno == ENOENT) return Qnil;
+  if (res) rb_sys_fail(NULL);
+
+  result = rb_str_new((const char*)entry.value, entry.bytes);
+  free(entry.value);
+  return result;
 }
 
 /******************************************************************************/
 
-static VALUE mmap_cache_load(VALUE class, VALUE rb_path) {
-  char*       path     = StringValuePtr(rb_path);
-  VALUE       wrapper  = Qnil;
-  trigram_map haystack = (trigram_map)NULL;
-  int         res      = -1;
+// get_pinned(key), see mmap_cache_get_pinned: the value as a frozen string
+// over the shared mapping rather than a copy, nil if missing. Its bytes (and
+// those of strings duplicated from it) stay valid until passed to <unpin>,
+// and must not be read after that.
+static VALUE raw_cache_get_pinned(VALUE self, VALUE rb_key) {
+  mmap_cache_t* cache = NULL;
+  cache_entry_t entry;
+  VALUE         result = Qnil;
+  int           res    = -1;
 
-  // res = mmap_cache_storage_load(&haystack, path);
-  if (res < 0) { rb_sys_fail(NULL); return Qnil; }
+  if (raise_if_closed(self)) return Qnil;
+  Data_Get_Struct(self, mmap_cache_t, cache);
+  StringValue(rb_key);
 
-  wrapper = Data_Wrap_Struct(class, mmap_cache_mark, mmap_cache_free, (void*)haystack);
-  rb_obj_call_init(wrapper, 0, NULL);
-  return wrapper;
+  entry.key     = RSTRING_PTR(rb_key);
+  entry.keysize = (int)RSTRING_LEN(rb_key);
+  entry.value   = NULL;
+  entry.bytes   = 0;
+  entry.ttl     = 0;
+
+  res = mmap_cache_get_pinned(cache, &entry);
+  if (res && errno == ENOENT) return Qnil;
+  if (res) rb_sys_fail(NULL);
+
+  result = rb_str_new_static((const char*)entry.value, entry.bytes);
+  rb_obj_freeze(result);
+  return result;
 }
 
 /******************************************************************************/
 
-static VALUE mmap_cache_initialize(VALUE UNUSED(self)) {
-  return Qtrue;
+// unpin(key, value), with <value> as returned by <get_pinned>.
+static VALUE raw_cache_unpin(VALUE self, VALUE rb_key, VALUE rb_value) {
+  mmap_cache_t* cache = NULL;
+  cache_entry_t entry;
+  int           res   = -1;
+
+  if (raise_if_closed(self)) return Qnil;
+  Data_Get_Struct(self, mmap_cache_t, cache);
+  StringValue(rb_key);
+  StringValue(rb_value);
+
+  entry.key     = RSTRING_PTR(rb_key);
+  entry.keysize = (int)RSTRING_LEN(rb_key);
+  entry.value   = RSTRING_PTR(rb_value);
+  entry.bytes   = (int)RSTRING_LEN(rb_value);
+  entry.ttl     = 0;
+
+  res = mmap_cache_unpin(cache, &entry);
+  if (res) rb_sys_fail(NULL);
+
+  return Qnil;
 }
 
 /******************************************************************************/
 
-static VALUE mmap_cache_put(VALUE self, VALUE rb_needle, VALUE rb_reference, VALUE rb_weight) {
-  trigram_map  haystack  = (trigram_map)NULL;
-  int          res       = -1;
-  char*        needle    = StringValuePtr(rb_needle);
-  uint32_t     reference = NUM2UINT(rb_reference);
-  uint32_t     weight    = NUM2UINT(rb_weight);
-
+// put(key, value, ttl = 0), with <ttl> in seconds (0 for no expiry).
+// Raises FullError when no room could be made (ENOMEM, see mmap_cache_put).
+static VALUE raw_cache_put(int argc, VALUE* argv, VALUE self) {
+  mmap_cache_t* cache    = NULL;
+  cache_entry_t entry;
+  VALUE         rb_key   = Qnil;
+  VALUE         rb_value = Qnil;
+  VALUE         rb_ttl   = Qnil;
+  int           res      = -1;
+
+  rb_scan_args(argc, argv, "21", &rb_key, &rb_value, &rb_ttl);
   if (raise_if_closed(self)) return Qnil;
-  Data_Get_Struct(self, struct trigram_map_t, haystack);
+  Data_Get_Struct(self, mmap_cache_t, cache);
+  StringValue(rb_key);
+  StringValue(rb_value);
+
+  entry.key     = RSTRING_PTR(rb_key);
+  entry.keysize = (int)RSTRING_LEN(rb_key);
+  entry.value   = RSTRING_PTR(rb_value);
+  entry.bytes   = (int)RSTRING_LEN(rb_value);
+  entry.ttl     = NIL_P(rb_ttl) ? 0 : NUM2INT(rb_ttl);
 
-  // res = mmap_cache_storage_put(haystack, needle, reference, weight);
-  assert(res >= 0);
+  res = mmap_cache_put(cache, &entry);
+  if (res && errno == ENOMEM) rb_raise(eFullError, "No room could be made for the entry");
+  if (res) rb_sys_fail(NULL);
 
-  return INT2NUM(res);
+  return rb_value;
 }
 
 /******************************************************************************/
 
-static VALUE mmap_cache_delete(VALUE self, VALUE rb_reference) {
-  trigram_map  haystack  = (trigram_map)NULL;
-  uint32_t     reference = NUM2UINT(rb_reference);
-  int          res       = -1;
+struct put_multi_batch_
+{
+  cache_entry_t* entries;
+  int            count;
+  int            ttl;
+};
+
+static int put_multi_entry(VALUE rb_key, VALUE rb_value, VALUE arg) {
+  struct put_multi_batch_* batch = (struct put_multi_batch_*)arg;
+  cache_entry_t*           entry = &batch->entries[batch->count++];
+
+  StringValue(rb_key);
+  StringValue(rb_value);
+
+  entry->key     = RSTRING_PTR(rb_key);
+  entry->keysize = (int)RSTRING_LEN(rb_key);
+  entry->value   = RSTRING_PTR(rb_value);
+  entry->bytes   = (int)RSTRING_LEN(rb_value);
+  entry->ttl     = batch->ttl;
+  return ST_CONTINUE;
+}
 
+// put_multi(hash, ttl = 0), see mmap_cache_put_multi: puts each key of
+// <hash> with its value. Raises FullError as <put>, some entries may have
+// been written then (check with <get>, or put them again).
+static VALUE raw_cache_put_multi(int argc, VALUE* argv, VALUE self) {
+  mmap_cache_t*           cache   = NULL;
+  struct put_multi_batch_ batch;
+  VALUE                   rb_hash = Qnil;
+  VALUE                   rb_ttl  = Qnil;
+  VALUE                   buffer  = 0;
+  int                     res     = -1;
+
+  rb_scan_args(argc, argv, "11", &rb_hash, &rb_ttl);
   if (raise_if_closed(self)) return Qnil;
-  Data_Get_Struct(self, struct trigram_map_t, haystack);
+  Data_Get_Struct(self, mmap_cache_t, cache);
+  Check_Type(rb_hash, T_HASH);
 
-  // res = mmap_cache_storage_delete(haystack, reference);
-  assert(res >= 0);
+  batch.entries = ALLOCV_N(cache_entry_t, buffer, RHASH_SIZE(rb_hash));
+  batch.count   = 0;
+  batch.ttl     = NIL_P(rb_ttl) ? 0 : NUM2INT(rb_ttl);
+  rb_hash_foreach(rb_hash, put_multi_entry, (VALUE)&batch);
 
-  return INT2NUM(res);
+  res = mmap_cache_put_multi(cache, batch.entries, batch.count);
+  ALLOCV_END(buffer);
+  if (res && errno == ENOMEM) rb_raise(eFullError, "No room could be made for an entry");
+  if (res) rb_sys_fail(NULL);
+
+  return rb_hash;
 }
 
 /******************************************************************************/
 
-static VALUE mmap_cache_save(VALUE self, VALUE rb_path) {
-  trigram_map  haystack  = (trigram_map)NULL;
-  int          res       = -1;
-  const char*  path      = StringValuePtr(rb_path);
+// reap(usecs), see mmap_cache_reap.
+static VALUE raw_cache_reap(VALUE self, VALUE rb_usecs)
+{
+  mmap_cache_t* cache = NULL;
+  int           res   = -1;
 
   if (raise_if_closed(self)) return Qnil;
-  Data_Get_Struct(self, struct trigram_map_t, haystack);
+  Data_Get_Struct(self, mmap_cache_t, cache);
 
-  // res = mmap_cache_storage_save(haystack, path);
-  if (res < 0) rb_sys_fail(NULL);
+  res = mmap_cache_reap(cache, NUM2INT(rb_usecs));
+  if (res) rb_sys_fail(NULL);
 
   return Qnil;
 }
 
 /******************************************************************************/
 
-static VALUE mmap_cache_find(VALUE self, VALUE rb_needle, VALUE rb_limit) {
-  trigram_map   haystack   = (trigram_map)NULL;
-  int           res        = -1;
-  const char*   needle     = StringValuePtr(rb_needle);
-  int           limit      = NUM2UINT(rb_limit);
-  trigram_match matches    = NULL;
-  VALUE         rb_matches = Qnil;
+// resize(pages), see mmap_cache_resize.
+static VALUE raw_cache_resize(VALUE self, VALUE rb_pages)
+{
+  mmap_cache_t* cache = NULL;
+  int           res   = -1;
 
   if (raise_if_closed(self)) return Qnil;
-  Data_Get_Struct(self, struct trigram_map_t, haystack);
+  Data_Get_Struct(self, mmap_cache_t, cache);
 
-  if (limit <= 0) {
-    // rb_limit = rb_const_get(eMmapCacheModule, rb_intern('LIMIT_DEFAULT'));
-    rb_limit = rb_const_get(eMmapCacheModule, rb_intern("LIMIT_DEFAULT"));
-    limit = NUM2UINT(rb_limit);
-  }
-  matches = (trigram_match) malloc(limit * sizeof(trigram_match_t));
-
-  // res = mmap_cache_storage_find(haystack, needle, limit, matches);
-  assert(res >= 0);
-
-  /* wrap the matches into a Ruby array */
-  rb_matches = rb_ary_new();
-  for (int k = 0; k < res; ++k) {
-    VALUE rb_match = rb_ary_new();
-    rb_ary_push(rb_match, rb_uint_new(matches[k].reference));
-    rb_ary_push(rb_match, rb_uint_new(matches[k].matches));
-    rb_ary_push(rb_match, rb_uint_new(matches[k].weight));
-    rb_ary_push(rb_matches, rb_match);
-  }
-  return rb_matches;
+  res = mmap_cache_resize(cache, NUM2INT(rb_pages));
+  if (res) rb_sys_fail(NULL);
+
+  return Qnil;
 }
 
+/******************************************************************************/
+
+// compact(usecs), see mmap_cache_compact.
+static VALUE raw_cache_compact(VALUE self, VALUE rb_usecs)
+{
+  mmap_cache_t* cache = NULL;
+  int           res   = -1;
+
+  if (raise_if_closed(self)) return Qnil;
+  Data_Get_Struct(self, mmap_cache_t, cache);
+
+  res = mmap_cache_compact(cache, NUM2INT(rb_usecs));
+  if (res) rb_sys_fail(NULL);
+
+  return Qnil;
+}
 
 /******************************************************************************/
 
-static VALUE mmap_cache_stats(VALUE self)
+// drain, see mmap_cache_drain.
+static VALUE raw_cache_drain(VALUE self)
 {
-  trigram_map     haystack = (trigram_map)NULL;
-  trigram_stat_t  stats;
-  VALUE           result   = rb_hash_new();
-  int             res      = -1;
+  mmap_cache_t* cache = NULL;
+  int           res   = -1;
 
   if (raise_if_closed(self)) return Qnil;
-  Data_Get_Struct(self, struct trigram_map_t, haystack);
+  Data_Get_Struct(self, mmap_cache_t, cache);
 
-  // res = mmap_cache_storage_stats(haystack, &stats);
-  assert(res >= 0);
+  res = mmap_cache_drain(cache);
+  if (res) rb_sys_fail(NULL);
 
-  (void) rb_hash_aset(result, ID2SYM(rb_intern("references")), UINT2NUM(stats.references));
-  (void) rb_hash_aset(result, ID2SYM(rb_intern("trigrams")),   UINT2NUM(stats.trigrams));
+  return Qnil;
+}
 
+/******************************************************************************/
+
+// stats, see mmap_cache_stats: a Hash of the counters, by Symbol.
+static VALUE raw_cache_stats(VALUE self)
+{
+  mmap_cache_t* cache  = NULL;
+  cache_stats_t stats;
+  VALUE         result = Qnil;
+  int           res    = -1;
+
+  if (raise_if_closed(self)) return Qnil;
+  Data_Get_Struct(self, mmap_cache_t, cache);
+
+  res = mmap_cache_stats(cache, &stats);
+  if (res) rb_sys_fail(NULL);
+
+  result = rb_hash_new();
+  rb_hash_aset(result, ID2SYM(rb_intern("pages")),              UINT2NUM(stats.pages));
+  rb_hash_aset(result, ID2SYM(rb_intern("entries")),            ULL2NUM(stats.entries));
+  rb_hash_aset(result, ID2SYM(rb_intern("bytes_used")),         ULL2NUM(stats.bytes_used));
+  rb_hash_aset(result, ID2SYM(rb_intern("bytes_wasted")),       ULL2NUM(stats.bytes_wasted));
+  rb_hash_aset(result, ID2SYM(rb_intern("hash_buckets")),       UINT2NUM(stats.hash_buckets));
+  rb_hash_aset(result, ID2SYM(rb_intern("hash_extents_used")),  UINT2NUM(stats.hash_extents_used));
+  rb_hash_aset(result, ID2SYM(rb_intern("hash_extents_peak")),  UINT2NUM(stats.hash_extents_peak));
+  rb_hash_aset(result, ID2SYM(rb_intern("hash_extents_count")), UINT2NUM(stats.hash_extents_count));
+  rb_hash_aset(result, ID2SYM(rb_intern("hash_extents_max")),   UINT2NUM(stats.hash_extents_max));
   return result;
 }
 
 /******************************************************************************/
 
-static VALUE mmap_cache_close(VALUE self)
+static VALUE raw_cache_close(VALUE self)
 {
-  trigram_map     haystack = (trigram_map)NULL;
-  int             res      = -1;
+  mmap_cache_t* cache = NULL;
+  int           res   = -1;
 
   if (raise_if_closed(self)) return Qnil;
-  Data_Get_Struct(self, struct trigram_map_t, haystack);
+  Data_Get_Struct(self, mmap_cache_t, cache);
 
-  // res = mmap_cache_storage_close(&haystack);
-  if (res < 0) rb_sys_fail(NULL);
+  res = mmap_cache_close(cache);
+  if (res) rb_sys_fail(NULL);
 
   DATA_PTR(self) = NULL;
   mark_as_closed(self);
@@ -199,28 +353,44 @@ static VALUE mmap_cache_close(VALUE self)
 
 /******************************************************************************/
 
-void Init_map_ext(void) {
+void Init_binding(void) {
   VALUE klass  = Qnil;
 
-  /* assume we haven't yet defined mmap_cache */
-  eMmapCacheModule = rb_define_module("MmapCache");
-  assert(eMmapCacheModule != Qnil);
+  eMmapModule = rb_define_module("Mmap");
+  assert(eMmapModule != Qnil);
 
-  klass = rb_define_class_under(eMmapCacheModule, "RawMap", rb_cObject);
+  klass = rb_define_class_under(eMmapModule, "RawCache", rb_cObject);
   assert(klass != Qnil);
 
   eClosedError = rb_define_class_under(klass, "ClosedError", rb_eRuntimeError);
-  assert(klass != Qnil);
-
-  rb_define_singleton_method(klass, "new",  mmap_cache_new,  0);
-  rb_define_singleton_method(klass, "load", mmap_cache_load, 1);
-
-  rb_define_method(klass, "initialize", mmap_cache_initialize, 0);
-  rb_define_method(klass, "put",        mmap_cache_put,        3);
-  rb_define_method(klass, "delete",     mmap_cache_delete,     1);
-  rb_define_method(klass, "save",       mmap_cache_save,       1);
-  rb_define_method(klass, "find",       mmap_cache_find,       2);
-  rb_define_method(klass, "stats",      mmap_cache_stats,      0);
-  rb_define_method(klass, "close",      mmap_cache_close,      0);
+  assert(eClosedError != Qnil);
+
+  eFullError = rb_define_class_under(klass, "FullError", rb_eRuntimeError);
+  assert(eFullError != Qnil);
+
+  rb_define_const(klass, "HUGE_PAGES",    INT2FIX(MMAP_CACHE_HUGE_PAGES));
+  rb_define_const(klass, "PACKED",        INT2FIX(MMAP_CACHE_PACKED));
+  rb_define_const(klass, "WIDE_BITMAPS",  INT2FIX(MMAP_CACHE_WIDE_BITMAPS));
+  rb_define_const(klass, "EVICT_CLOCK",   INT2FIX(MMAP_CACHE_EVICT_CLOCK));
+  rb_define_const(klass, "EVICT_S3FIFO",  INT2FIX(MMAP_CACHE_EVICT_S3FIFO));
+  rb_define_const(klass, "EVICT_TINYLFU", INT2FIX(MMAP_CACHE_EVICT_TINYLFU));
+  rb_define_const(klass, "ALIGNED",       INT2FIX(MMAP_CACHE_ALIGNED));
+  rb_define_const(klass, "INLINE",        INT2FIX(MMAP_CACHE_INLINE));
+  rb_define_const(klass, "GROWTH_SHIFT",  INT2FIX(MMAP_CACHE_GROWTH_SHIFT));
+
+  rb_define_singleton_method(klass, "new", raw_cache_new, -1);
+
+  rb_define_method(klass, "initialize", raw_cache_initialize, 0);
+  rb_define_method(klass, "get",        raw_cache_get,        1);
+  rb_define_method(klass, "get_pinned", raw_cache_get_pinned, 1);
+  rb_define_method(klass, "unpin",      raw_cache_unpin,      2);
+  rb_define_method(klass, "put",        raw_cache_put,       -1);
+  rb_define_method(klass, "put_multi",  raw_cache_put_multi, -1);
+  rb_define_method(klass, "reap",       raw_cache_reap,       1);
+  rb_define_method(klass, "resize",     raw_cache_resize,     1);
+  rb_define_method(klass, "compact",    raw_cache_compact,    1);
+  rb_define_method(klass, "drain",      raw_cache_drain,      0);
+  rb_define_method(klass, "stats",      raw_cache_stats,      0);
+  rb_define_method(klass, "close",      raw_cache_close,      0);
   return;
 }
@@ -6,6 +6,10 @@
 #include <stdint.h>
 #include <assert.h>
 #include "helpers.h"
+#include "lock.h"
+#include "hash_tags.h"
+#include "lease.h"
+#include "page_bitmaped.h"
 
 /*
 
@@ -13,19 +17,59 @@ Data Layout
 
 2 files per mapped cache:
 - "<name>.meta" is the metadata (variable size, contains hash table and page usage info),
-  size is typically ~32 bytes per entry plus about 150kB overhead.
+  about 400kB to 800kB for 64 pages (more with more pages), plus per entry,
+  with the table about half full: ~105 bytes in the packed layout, ~130 in
+  the aligned one, ~260 in the inline one and ~330 in the tagged one (less as
+  its groups fill up). See _meta_layout() in mmap-cache.c for the details.
 - "<name>.data" is the payload (fixed size, contains data pages)
 
 The metadata file:
 
 - cache_info_t    (256 bytes)
-- page_info_t[]   (8 bytes * <page_count>, preallocated and fixed)
-- hash_bucket_t[] (32 bytes * 2 ** <hash_table_size>, preallocated + locking expansion mechanism)
-- hash_extent_t[] (128 bytes * 1024 initially, freelist-managed)
+- lock_t[]        (64 bytes * 2 ** <lock_table_size>, preallocated and fixed)
+- lease_t[]       (24 bytes * 2 ** <lease_table_size>, preallocated and fixed)
+- page_list_t[]   (8 bytes * PAGE_LISTS, see "Page lists")
+- lru_list_t[]    (16 bytes * LRU_LISTS, see "Hash table")
+- uint32_t[]      (4 bytes * 2 * PAGE_LISTS chunk sizes, only with
+                   CACHE_OPTION_SIZE_CLASSES, see "Size classes"; page and LRU
+                   lists are then twice as many)
+- page_info_t[]   (16 bytes * <page_count_max>, preallocated and fixed: only
+                   the first <page_count> are used, see "Resizing")
+- wide_bitmap_t[] (32 bytes * <page_count_max>, only with CACHE_OPTION_WIDE_BITMAPS)
+- wheel_slot_t[]  (128 bytes * WHEEL_LEVELS * WHEEL_SLOTS, see "Expiry")
+- uint32_t[]      (4 bytes * 2 ** <policy_table_size> ghost hashes, only with
+                   CACHE_EVICTION_S3FIFO), or
+  uint64_t[]      (8 bytes * 2 ** <policy_table_size> sketch words, only with
+                   CACHE_EVICTION_TINYLFU), see "Eviction"
+- promote_ring_t[] (2176 bytes * PROMOTE_RINGS, only with CACHE_EVICTION_LRU,
+                   see "Deferred promotion")
+- hash_bucket_t[] (32 bytes * 2 ** <hash_table_max_size>, preallocated but sparse:
+                   only the first <hash_buckets> are used, see "Hash table growth")
+- hash_extent_t[] (128 bytes * <hash_extents_count>, freelist-managed, see
+                   "Extent growth")
+
+In the tagged layout (versions 0x02 and 0x04), buckets and extents are replaced by
+groups of 16 entries:
+
+- hash_group_t[]  (512 bytes * 2 ** <hash_table_max_size>, sparse as above)
+- hash_group_t[]  (512 bytes * <hash_extents_count> overflow groups, freelist-managed)
+
+In the aligned layout (version 0x05, see "Aligned layout"), they are
+replaced by buckets of 2 entries, starting on a cache line:
+
+- hash_bucket_aligned_t[] (64 bytes * 2 ** <hash_table_max_size>, sparse as above)
+- hash_extent_aligned_t[] (128 bytes * <hash_extents_count>, freelist-managed)
+
+With CACHE_OPTION_INLINE (see "Inline values"), each bucket is followed by
+the inline data of its entries, and each extent preceded by theirs:
+
+- hash_bucket_inline_t[] (128 bytes * 2 ** <hash_table_max_size>, sparse as above)
+- hash_extent_inline_t[] (256 bytes * <hash_extents_count>, freelist-managed)
 
 The payload file:
 
-A flat array of 1MB pages.
+A flat array of 1MB pages, <page_count> of them in use (processes map room
+for <page_count_max>, see "Resizing").
 Each page is split into chunks, allocated either through a bitmap (large chunks)
 or a freelist (small chunks). Note that each (used) chunk contains the cache key
 and the cache value (without delimitation).
@@ -39,28 +83,68 @@ Pages types:
   type  5  ->  2048 x 512     chunks  EXT FL
   type  6  ->  1024 x 1K      chunks  EXT FL
   type  7  ->   512 x 2K      chunks  EXT FL
-  type  8  ->   256 x 4K      chunks  EXT FL
-  type  9  ->   128 x 8K      chunks  EXT FL
-  type  10 ->    64 x 16K     chunks  EXT FL
-  type  11 ->    32 x 32K     chunks  EXT FL
+  type  8  ->   256 x 4K      chunks  EXT FL (BM)
+  type  9  ->   128 x 8K      chunks  EXT FL (BM)
+  type  10 ->    64 x 16K     chunks  EXT FL (BM)
+  type  11 ->    32 x 32K     chunks  EXT FL (BM)
   type  12 ->    16 x 64K     chunks  EXT
   type  13 ->     8 x 128K    chunks  EXT
   type  14 ->     4 x 256K    chunks  EXT
   type  15 ->     2 x 512K    chunks  EXT
   type  16 ->     1 x 1MB     chunks  EXT
 
+In caches with CACHE_OPTION_SIZE_CLASSES, types have the sizes recorded in
+the metadata instead (see "Size classes"), and the marks below follow from
+the size as they do in the table above.
+
 
 Notes:
 
-- Page of a type marked FL have their last 2 bytes (16 bits) reserved for free
-  list management.
-- Pages marked with EXT have the last 5 bytes (40 bits), possibly the bytes
-  just before the free list footer, reserved for future extension (linked list
-  of payload segments for memory efficiency / higher payload sizes)
+- Page of a type marked FL (more than PAGE_NARROW_CHUNKS_MAX chunks per page)
+  have their last 2 bytes (16 bits) reserved for free list management. Pages
+  of other types allocate through the <bitmap> of their page_info_t.
+- Pages of a type marked (BM) (more than PAGE_NARROW_CHUNKS_MAX, and at most
+  PAGE_BITMAP_SLOTS_MAX chunks per page) use a bitmap in wide_bitmap_t[]
+  instead of a free list in caches with CACHE_OPTION_WIDE_BITMAPS:
+  allocating then reads the (hot) metadata rather than the footer of a
+  (cold) chunk. Their chunks keep the free list footer, so that capacities
+  do not depend on options.
+- Chunks in pages marked with EXT (of SEGMENT_CHUNK_MIN bytes or more) have
+  their last 5 bytes (40 bits), just before the free list footer if any,
+  reserved for linking value segments (see "Chained values").
 - The last entry in a type 0 page is reserved (lost to free list limitation, 
   offset 65535 is used for the sentinel value in free lists)
 - Keep load factor below 0.8
 - Keep load factor plus stddev below 0.9
+- Unused pages get a type when a chunk of that type is first needed, and
+  keep it until drained (see "Rebalancing") or reused while empty. When no
+  chunk of the right type is free, puts evict entries whose first segment
+  is in a chunk of that type, or if there are none, entries of the type
+  holding the most memory (which ones depends on the policy, see
+  "Eviction").
+- The lock table holds one lock per stripe of buckets; bucket <i> belongs to
+  stripe <i> & (2 ** <lock_table_size> - 1). Writers to unrelated keys take
+  different stripes, and only briefly serialize on the LRU/allocator lock in
+  cache_info_t.
+- Locks survive the death of their owner: whoever acquires a lock next first
+  repairs the stripe's buckets (dropping entries that fail validation) or the
+  LRU lists (rebuilt from their forward links). Writers should hence make each
+  change to a list take effect through a single forward link update
+  (<oldest> or <newer_entry>).
+- Bucket <i> and the bucket <i> + 2 ** <hash_table_size> it splits into
+  always belong to the same stripe, as long as <lock_table_size> is at most
+  <hash_table_size>.
+- Readers do not lock stripes, but validate their copy of an entry and its
+  payload against the stripe's sequence number. Hence an entry may only be
+  modified, and its chunk freed or reused, while holding the write lock of
+  the entry's stripe (including on eviction).
+- The LRU links of an entry share bytes with its other fields (bitfields):
+  any write to an entry also holds the meta lock. The reference bits of
+  entries are outside of them, and set by readers with atomic operations.
+- Zero-copy readers pin the chunk they point into with a lease (see lease.h).
+  Chunks no entry refers to anymore are retired rather than freed: a pinned
+  chunk is only freed when its last pin goes away. Leases of dead processes
+  are swept when the lease table fills up, or the meta lock is recovered.
 
 
 Storage, performance:
@@ -68,20 +152,46 @@ Storage, performance:
 It is recommended to use a power-of-two number of pages greater than or
 equal to 8, to make sure the hash table is properly aligned in memory.
 
+Lookups touch random buckets and chunks, hence a TLB miss each with 4kB
+pages on large caches: keep the files on hugetlbfs, or on a tmpfs mounted
+with huge=advise and open with MMAP_CACHE_HUGE_PAGES. File sizes get
+rounded up to the huge page size on hugetlbfs, where the whole files are
+reserved when mapped.
+
+The lock table adds 64 * (2 ** <lock_table_size>) bytes, ie. 16kB for the
+default 256 stripes. The lease table adds 24 * (2 ** <lease_table_size>)
+bytes, ie. 24kB for the default 1024 leases.
+
 For 128MB data pages and 64k non-pathological entries (2kB average), assuming a load of 1,
 the metadata file would be typically
-64 + 128*8 + 32*(2**16) + 128*(2**10) = 2.1 MB (1.7% overhead).
+64 + 128*16 + 32*(2**16) + 128*(2**10) = 2.1 MB (1.7% overhead).
 
 For 128MB data pages and 1M non-pathological entries (128B average), assuming a load of 1,
 the metadata file would be typically
-64 + 128*8 + 32*(2**20) + 128*(2**10) = 32 MB (25% overhead).
+64 + 128*16 + 32*(2**20) + 128*(2**10) = 32 MB (25% overhead).
 
 For 128MB data pages and the pathological maximum of 8M 14-byte entries, still assuming a load of 1,
 the metadata file would be typically
-64 + 128*8 + 32*(2**23) + 128*(2**10) = 256 MB (200% overhead).
+64 + 128*16 + 32*(2**23) + 128*(2**10) = 256 MB (200% overhead).
 
 Compare with Memcached's 60+ bytes per entry (http://stackoverflow.com/questions/8129068/memcached-item-overhead)
 
+The tagged layout has 16 times fewer buckets for the same memory, but a
+lookup only reads the first cache line of a group (its tags) to tell which
+entries may match: a miss typically costs one cache line instead of two or
+three with buckets and extents, and groups stay efficient at load factors
+(per entry slot) of 0.9 and more. Hash table orders are 4 lower than in
+the packed layout for the same capacity.
+
+The aligned layout takes 32 bytes per entry slot like the packed one, but
+reads and writes entries with plain loads and stores, and writers to
+different buckets never share a cache line. Hash table orders are 1 lower
+than in the packed layout for the same capacity.
+
+With CACHE_OPTION_INLINE, entry slots take 64 bytes of metadata, but entries
+whose key and value fit in them take no chunk at all (a 15-byte key with an
+8-byte value otherwise takes a 32-byte chunk).
+
 */
 
 
@@ -95,15 +205,17 @@ struct PACKED_STRUCT cache_info_
     // 0x00 -> little endian
     // 0xff -> big endian
     uint8_t       big_endian;
-    // should be 0x01
+    // layout of the hash table, CACHE_VERSION_*
     uint8_t       version;
-    // 2 byte padding (all bits set)
-    unsigned int  __r0: 16;
+    // hash function of cache keys, MMAP_HASH_* (see hash.h)
+    uint8_t       hash_function;
+    // 1 byte padding (all bits set)
+    uint8_t       __r0;
     
     // total number of 1MB pages, 1 -> (2^24 -1) ie. max 17TB memory
     unsigned int  page_count: 24;
     // 5 byte padding (all bits set)
-    unsigned int  __r1: 40;
+    uint64_t      __r1: 40;
 
     // used storage i.e. sum of used chunk size (for reporting)
     uint64_t      bytes_used;
@@ -113,87 +225,782 @@ struct PACKED_STRUCT cache_info_
     // origin of expiration times (in seconds since epoch, UTC)
     uint32_t      time_origin;
 
-    // order of hash table, minimum 10 -> 1024 buckets
+    // order of hash table, minimum 10 -> 1024 buckets; grows with
+    // <hash_buckets>
     uint8_t       hash_table_size;
-    // 3 byte padding (all bits set)
-    unsigned int  __r2: 24;
-    // number of hash table extents, initially 1024
+    // order of lock table, at most <hash_table_size> (default 8 -> 256 stripes)
+    uint8_t       lock_table_size;
+    // order of the space reserved for the hash table, at most HASH_ORDER_MAX
+    uint8_t       hash_table_max_size;
+    // 1 byte padding (all bits set)
+    uint8_t       __r2;
+    // number of hash table extents, initially 1024; grows up to
+    // <hash_extents_max>, updated atomically (see "Extent growth")
     uint32_t      hash_extents_count;
     // first free extent
     uint32_t      hash_extents_head;
-    // index of oldest entry in hash table (head of double linked list)
-    unsigned int  hash_oldest: 40;
-    // 3 byte padding (all bits set)
-    unsigned int  __r3: 24;
-    // index of newest entry in hash table (tail of double linked list)
-    unsigned int  hash_oldest: 40;
-    // 3 byte padding (all bits set)
-    unsigned int  __r4: 24;
+    // extents the mappings of the metadata have room for; all bits set in
+    // caches from before extent growth, which have room for
+    // <hash_extents_count>
+    uint32_t      hash_extents_max;
+    // extents in use, and the most ever in use (for reporting); all bits set
+    // until counted by the first process to open the cache
+    uint32_t      hash_extents_used;
+    uint32_t      hash_extents_peak;
+    // 4 byte padding (all bits set)
+    uint8_t       __r3[4];
 
     // used hash table entries (to determine load)
     uint64_t      entries_used;
     // sum squares used entries per bucket (to determine load variance)
     uint64_t      entries_squared;
 
+    // number of buckets in use, from 2 ** <hash_table_size> up to
+    // 2 ** (<hash_table_size> + 1); the only source of truth for addressing
+    // buckets, updated atomically
+    uint32_t      hash_buckets;
+    // order of the lease table (default 10 -> 1024 leases)
+    uint8_t       lease_table_size;
+    // number of pages being drained (see "Rebalancing")
+    uint32_t      pages_draining;
+    // next page considered for draining
+    uint32_t      rebalance_page;
+    // next bucket searched for entries in draining pages
+    uint32_t      rebalance_bucket;
+    // CACHE_OPTION_*
+    uint8_t       options;
+    // start of the next tick of the expiry wheel to reap (seconds from
+    // <time_origin>, a multiple of WHEEL_TICK)
+    uint32_t      wheel_time;
+    // next bucket the reaper scans
+    uint32_t      wheel_bucket;
+    // level of the wheel slot the reaper scans (see "Expiry")
+    uint8_t       wheel_level;
+    // CACHE_EVICTION_* (see "Eviction")
+    uint8_t       eviction;
+    // order of the ghost table or sketch, 0 if the policy has none
+    uint8_t       policy_table_size;
+    // sketch increments since its counters were last halved
+    uint32_t      policy_count;
+    // bit <k> set if promotion ring <k> may hold hits to apply
+    uint64_t      promote_pending;
+
+    // number of chunk types (see "Size classes")
+    uint8_t       page_types;
+
     // padding, reserved for future extra metadata (all bits set)
-    uint8_t       __r5[176];
+    uint8_t       __r5[6];
+
+    // lock guarding the LRU list and allocator state (cache line aligned)
+    lock_t        meta_lock;
+
+    // pages the metadata and the mappings of the payload have room for (see
+    // "Resizing"); all bits set in caches from before resizing, which have
+    // room for <page_count>
+    uint32_t      page_count_max;
+    // while shrinking, the new <page_count>: later pages get no chunks (see
+    // "Resizing"); PAGE_NONE otherwise
+    uint32_t      page_limit;
+
+    // padding, reserved for future extra metadata (all bits set)
+    uint8_t       __r6[56];
 };
 
 typedef struct cache_info_ cache_info_t;
 
+// cache_info_t.options
+// allocate chunks of types with more than PAGE_NARROW_CHUNKS_MAX and at most
+// PAGE_BITMAP_SLOTS_MAX chunks per page through wide_bitmap_t[] rather than
+// free lists
+#define CACHE_OPTION_WIDE_BITMAPS 0x01
+// keep small keys and values in the hash table (aligned layout only, see
+// "Inline values")
+#define CACHE_OPTION_INLINE       0x02
+// chunk types of the sizes recorded in the metadata rather than powers of
+// two (see "Size classes")
+#define CACHE_OPTION_SIZE_CLASSES 0x04
+
+// cache_info_t.eviction
+#define CACHE_EVICTION_LRU      0x00
+#define CACHE_EVICTION_CLOCK    0x01
+#define CACHE_EVICTION_S3FIFO   0x02
+#define CACHE_EVICTION_TINYLFU  0x03
+
+
+// size of data pages
+#define DATA_PAGE_SIZE  (1U << 20)
 
-// 8 byte per-page metadata (1/8 cache line)
+// 16 byte per-page metadata (1/4 cache line)
 struct PACKED_STRUCT page_info_
 {
-  // 0-16:   the page is used to store 1 << (N + 4) byte chunks
-  // 17-254: invalid
+  // 0 to <page_types> - 1: the page is used to store chunks of type N
+  //         (1 << (N + 4) bytes without CACHE_OPTION_SIZE_CLASSES)
+  // others: invalid
   // 255:    the page is unused
   uint8_t       type;
   // number of unused chunks in page
   uint16_t      free_chunks;
-  // padding (all bits set)
-  uint8_t       __r1;
+  // PAGE_FLAG_* (cleared when the page gets a type)
+  uint8_t       flags;
 
   union {
-    // offset of first free item (head of free list, up to 32kB pages)
+    // offset of first free item (head of free list, up to 32kB chunks, see
+    // CACHE_OPTION_WIDE_BITMAPS)
     uint16_t    head_slot;
-    // bitmap of free items (from 64kB pages up), unused bits 0
+    // bitmap of free items (from 64kB chunks up, ie. at most
+    // PAGE_NARROW_CHUNKS_MAX chunks per page), unused bits 0
     // least significant bit refers to first chunk in page
     uint16_t    bitmap;
   };
+
+  // neighbours in the page's list, PAGE_NONE at either end (see "Page lists")
+  uint32_t      prev_page;
+  uint32_t      next_page;
+
+  // 2 byte padding (all bits set)
+  uint8_t       __r1[2];
 };
 
 typedef struct page_info_ page_info_t;
 
+// first and last page of a list, PAGE_NONE if empty
+struct PACKED_STRUCT page_list_
+{
+  uint32_t      first_page;
+  uint32_t      last_page;
+};
+
+typedef struct page_list_ page_list_t;
+
+// 32 byte bitmap of free chunks, for pages of types marked (BM) with
+// CACHE_OPTION_WIDE_BITMAPS (see page_bitmaped.h)
+struct wide_bitmap_
+{
+  uint64_t      words[PAGE_BITMAP_WORDS(PAGE_BITMAP_SLOTS_MAX)];
+};
+
+typedef struct wide_bitmap_ wide_bitmap_t;
+
+// seconds per slot in the first level of the wheel (16s)
+#define WHEEL_TICK_ORDER      4
+#define WHEEL_TICK            (1U << WHEEL_TICK_ORDER)
+// slots per level
+#define WHEEL_SLOTS_ORDER     6
+#define WHEEL_SLOTS           (1U << WHEEL_SLOTS_ORDER)
+// levels: slots of 16s, 17min, 18h and 48 days (covering all of <expiry>)
+#define WHEEL_LEVELS          4
+// bucket regions a slot tells apart
+#define WHEEL_REGIONS_ORDER   10
+#define WHEEL_REGIONS         (1U << WHEEL_REGIONS_ORDER)
+// buckets scanned by the reaper on each put, or each round of
+// mmap_cache_reap
+#define REAP_BUCKETS          16
+
+// 128 byte bitmap of the bucket regions holding entries that expire in a
+// slot of the wheel (2 cache lines, see "Expiry")
+struct wheel_slot_
+{
+  uint64_t      regions[WHEEL_REGIONS / 64];
+};
+
+typedef struct wheel_slot_ wheel_slot_t;
+
+// 16 byte LRU list (see "Hash table")
+struct PACKED_STRUCT lru_list_
+{
+  // index of oldest entry (head of double linked list), 2**40-1 if empty
+  uint64_t      oldest: 40;
+  // index of newest entry (tail of double linked list), 2**40-1 if empty
+  uint64_t      newest: 40;
+  // number of entries in the list
+  uint64_t      entries: 48;
+};
+
+typedef struct lru_list_ lru_list_t;
+
+// one list of main entries per page type, then one of inline entries (with
+// CACHE_OPTION_INLINE), then reserved; then from index PAGE_LISTS as many
+// lists of entries on probation (S3-FIFO's small queue, W-TinyLFU's
+// window); twice as many with CACHE_OPTION_SIZE_CLASSES, probation lists
+// from index 2 * PAGE_LISTS
+#define LRU_LISTS             (2 * PAGE_LISTS)
+
+// one list per page type, then unused pages, then reserved (all bits set);
+// twice as many with CACHE_OPTION_SIZE_CLASSES
+#define PAGE_LISTS            32
+// end of a page list
+#define PAGE_NONE             0xFFFFFFFFU
+// new caches have room to grow to PAGE_RESERVE_RATIO times their pages
+#define PAGE_RESERVE_RATIO    4
+// most pages in a cache (cache_info_t.page_count is 24 bits)
+#define PAGE_COUNT_MAX        ((1U << 24) - 1)
+
+// page_info_t.type
+// last type without CACHE_OPTION_SIZE_CLASSES (1MB chunks)
+#define PAGE_TYPE_MAX         16
+#define PAGE_TYPE_UNUSED      255
+
+// most chunks per page allocated through page_info_t.bitmap (larger counts
+// take a free list, or a wide bitmap)
+#define PAGE_NARROW_CHUNKS_MAX  16
+// most chunk types with CACHE_OPTION_SIZE_CLASSES (the lists of a type, and
+// the one after the last type, fit in twice as many lists)
+#define PAGE_CLASSES_MAX      (2 * PAGE_LISTS - 1)
+// smallest chunk, and chunk sizes are a multiple of PAGE_CLASS_ALIGN
+#define PAGE_CLASS_MIN        16
+#define PAGE_CLASS_ALIGN      8
+
+// page_info_t.flags
+// no chunk gets allocated in the page, which becomes unused once empty
+#define PAGE_FLAG_DRAINING    0x01
+
+// most pages drained at once
+#define REBALANCE_DRAINING_MAX  4
+// pages looked at when picking one to drain
+#define REBALANCE_SCAN_MAX      64
+// pages with at most 1 / REBALANCE_USED_RATIO chunks in use may be drained
+#define REBALANCE_USED_RATIO    8
+// buckets searched by each put while pages drain
+#define REBALANCE_BUCKETS       16
+// same, after a put failed for lack of chunks
+#define REBALANCE_BUCKETS_STARVING 1024
+// pages with at most 1 / COMPACT_USED_RATIO chunks in use may be compacted
+#define COMPACT_USED_RATIO      4
+
+// evictions attempted by a put before giving up with ENOMEM
+#define EVICT_ATTEMPTS_MAX    16
+
 /*
 
   Hash table,
   Maps hashes to entries.
 
   The table is stored as an array of <hash_bucket_t> of size 2 **
-  <hash_table_size> (the main entries), followed by and array of
-  <hash_extent_t> of size <hash_extents_count> (the extents).
+  <hash_table_max_size> (the main entries, of which <hash_buckets> are in
+  use), followed by and array of <hash_extent_t> of size
+  <hash_extents_count> (the extents).
 
   The extents array is managed by the free list allocator.
 
-  The hash table doubles as a double-linked-list to maintain the LRU order of
+  The hash table doubles as double-linked-lists to maintain the LRU order of
   entries; this is necessary for LRU eviction. This is achieved through the
-  <older_entry> and <newer_entry> indices. If an <index> is lower than 2 **
-  <hash_table_size> it points to a entry in a bucket. If higher, it points to
-  an entry in an extent.
+  <older_entry> and <newer_entry> indices. There is one list per page type,
+  in lru_list_t[]: an entry is in the list of the type of its first segment's
+  page (which keeps its type as long as the chunk is used), so that evicting
+  from the list of a type frees a chunk of that type. Some policies have a
+  second, probation, list per type (see "Eviction").
+
+  If an <index> is lower than 2 ** <hash_table_max_size> it points to a
+  entry in a bucket. If higher, it points to an entry in an extent.
 
-  Given <index_e> = <index> - 2 ** <hash_table_size>, the lower 2 bits of
+  Given <index_e> = <index> - 2 ** <hash_table_max_size>, the lower 2 bits of
   <index_e> are the position in the extent and the higher bits to the extent
   itself.
 
   Of course <index_e> >> 2 must be lower than <hash_extents_count>.
 
+  In the tagged layout, buckets are <hash_group_t> (the 16 slots of group
+  <g> have indices 16 * <g> to 16 * <g> + 15) and extents are overflow
+  groups (<index_e> >> 4 is the overflow group, the lower 4 bits the slot).
+  Each slot's tag is HASH_TAG_FREE if the entry is unused, hash_tag(<hash>)
+  otherwise.
+
+
+  Key fingerprints,
+  Tell most keys with the same hash apart without reading the data page.
+
+  Lookups compare the <hash> and <keysize> of entries, and only then the key
+  at the start of their first segment: a cold cache line of the data file,
+  for every 32-bit hash collision. In versions 0x03 and 0x04, entries also
+  have an 8-bit fingerprint of their key, from a second hash computed along
+  with <hash> (see hash.h). Lookups skip the entries whose fingerprint
+  differs, hence only read the key of 1 in 256 colliding entries, short of
+  the entry they look for.
+
+  In version 0x03, the fingerprint is next to the entry's reference bits.
+  In version 0x04, it is the entry's tag, hash_tag(<fingerprint> << 24)
+  rather than hash_tag(<hash>): the high bits of the hash were compared
+  with the hash anyway, so tags rule out as many entries as before, and the
+  fingerprint costs neither room nor a cache line.
+
+  Fingerprints are written along with the entry, and copied when it moves.
+  Repairing a stripe computes them again from the keys of the entries left.
+
+
+  Aligned layout,
+  Entries without bitfields, in buckets of a cache line.
+
+  Entries of the packed and tagged layouts are 26 bytes of bitfields:
+  reading a field takes unaligned loads, shifts and masks, and writing one
+  a read-modify-write of its neighbours. Buckets are half a cache line, so
+  writers of two buckets false-share it.
+
+  In version 0x05, entries are hash_entry_aligned_t: the same fields, each
+  in its own naturally aligned integer, with 32-bit LRU links (hence the
+  table is limited to 2 ** 32 - 1 entries, and HASH_ENTRY_NONE is stored as
+  HASH_LINK_NONE). Buckets hold 2 entries in 64 bytes, aligned on a cache
+  line, and extents 4 in 128 bytes: bucket <b> has the entries of indices
+  2 * <b> and 2 * <b> + 1, and extents are addressed as in the packed
+  layout. Entries have fingerprints (see "Key fingerprints").
+
+  Code handles entries of any layout through hash_entry_t, and reads or
+  writes their fields as per the version of the cache.
+
+
+  Inline values,
+  Keep tiny entries out of the data file.
+
+  Entries of a few bytes still take a 16 or 32-byte chunk, and reading them
+  takes a cache miss in the data file on top of the bucket's.
+
+  In caches with CACHE_OPTION_INLINE (aligned layout only), each entry slot
+  has HASH_INLINE_BYTES of inline data: in the second cache line of its
+  bucket, or the first of its extent (the last word of extents belongs to
+  the free list allocator). Entries whose key and value add up to
+  HASH_INLINE_BYTES or less are stored there, key first: their <page> is
+  HASH_PAGE_INLINE, their <chunk> all bits set and their <bytes> the size of
+  the value. They take no chunk, do not count in <bytes_used>, and are
+  read without touching page_info_t[] or the data file.
+
+  Inline entries are in the LRU lists after those of the last page type
+  (and its probation list): evicting them frees no chunk, so puts never
+  pick them to make room; they leave the cache when overwritten, expired, or
+  evicted from a full bucket. Inline values cannot be pinned (they are
+  overwritten in place).
+
+  The inline data doubles the size of buckets and extents, for every entry
+  whether inline or not: about 264 bytes of metadata per entry rather than
+  132 at the usual load. Inline entries save their chunk (16 to 64 bytes)
+  and a cache miss, so the layout trades memory for read latency rather
+  than saving memory.
+
+
+  Hash table growth,
+  Keeps the load factor in check without stalling puts (linear hashing).
+
+  With <n> = <hash_buckets> and <L> = <hash_table_size>
+  (2 ** L <= n < 2 ** (L+1)), a key lives in bucket <hash> & (2 ** (L+1) - 1),
+  or <hash> & (2 ** L - 1) if the former is <n> or more.
+
+  When the load factor (<entries_used> / <n>) exceeds HASH_LOAD_MAX, or the
+  load plus its standard deviation (from <entries_squared>) exceeds
+  HASH_LOAD_STDDEV_MAX, each put splits the next few buckets: bucket
+  <n> - 2 ** L is split into itself and bucket <n>, then <n> is incremented.
+  The table has doubled once <n> reaches 2 ** (L+1); <L> is then incremented.
+
+  Writers must hence work out a key's bucket once they hold its stripe's
+  lock, and readers within their optimistic read.
+
+  A split holds the write lock of the stripe of both buckets and the meta
+  lock. <hash_buckets> is incremented before entries are moved, so that a
+  process dying mid-split leaves entries that fail validation (and get
+  dropped) rather than unreachable ones.
+
+*/
+
+/*
+
+  Chained values,
+  Hold values larger than a chunk, and avoid wasting most of a large chunk.
+
+  The key and value of an entry are stored in a chain of segments: the key,
+  then the value, are spread over the chunks of the chain in order, filling
+  each chunk (but the last) up to its EXT footer. The footer of each chunk
+  holds the next segment's page (24 bits) and chunk (16 bits), little
+  endian, or SEGMENT_NONE in the last segment. Chunks of types without an
+  EXT footer can only be last.
+
+  The entry points to the first segment; its <bytes> is the number of value
+  bytes in the last segment.
+
+  Writers use as many 1MB chunks as needed, then split off full chunks of
+  decreasing types as long as the tail would waste more than
+  1 / SEGMENT_WASTE_RATIO of its chunk (a 70kB value takes a 64kB, 4kB, 2kB
+  and 128 byte chunk instead of a 128kB one).
+
 */
 
+// link in the EXT footer of the last segment
+#define SEGMENT_NONE          0xFFFFFFFFFFULL
+// smallest chunk with an EXT footer
+#define SEGMENT_CHUNK_MIN     128
+// most segments in a value of MMAP_CACHE_BYTES_MAX (65 1MB chunks, then at
+// most one of each smaller type)
+#define SEGMENTS_MAX          (65 + PAGE_CLASSES_MAX)
+
+/*
+
+  Size classes,
+  Chunk sizes closer to each other than powers of two.
 
+  A value takes the smallest chunk it fits in: with powers of two, a value
+  of a little over a power of two wastes almost half of its chunk (unless
+  large enough to be chained, see above).
 
-// 26 bytes per entry
-struct PACKED_STRUCT hash_entry_
+  Caches created with a growth factor (see MMAP_CACHE_GROWTH) have
+  CACHE_OPTION_SIZE_CLASSES and <page_types> chunk types, of the sizes
+  recorded in the metadata after the LRU lists (all bits set past
+  <page_types>). Sizes are worked out once, on creation: from PAGE_CLASS_MIN
+  bytes, each size is the previous one times the factor, rounded up to a
+  multiple of PAGE_CLASS_ALIGN, then stretched to the largest such multiple
+  with as many chunks per page (so that pages waste less than
+  PAGE_CLASS_ALIGN bytes per chunk); the last type has 1MB chunks. With a
+  factor of 1.25, that is 43 types: 16, 24, 32, 40, 56, 72, 96, 120, 152,
+  192 bytes...
+
+  Processes derive everything else from the size of a type, the same way
+  for powers of two: its pages have 1MB / <size> chunks (at most 65535),
+  its chunks have an EXT footer from SEGMENT_CHUNK_MIN bytes, and a free
+  list footer unless the page has at most PAGE_NARROW_CHUNKS_MAX chunks (see
+  "Data Layout").
+
+  There are at most PAGE_CLASSES_MAX types, and twice as many page lists and
+  LRU lists as without the option.
+
+*/
+// a chunk may waste up to 1 / SEGMENT_WASTE_RATIO of itself
+#define SEGMENT_WASTE_RATIO   8
+
+/*
+
+  Page lists,
+  Let puts find a page with a free chunk in constant time.
+
+  Pages of each type with free chunks, and not draining, are linked through
+  <prev_page> and <next_page> in the page_list_t of the type. Chunks are
+  allocated from the first page, which leaves the list when full; a page
+  freeing its first chunk comes back first, and a page freeing its last one
+  goes last. Hence partly used pages get filled before empty ones, and the
+  last page of a list, if empty, can be taken by another type.
+
+  Unused pages are linked in the list after that of the last type. Lists
+  are rebuilt from the page infos when the meta lock is recovered.
+
+*/
+
+/*
+
+  Resizing,
+  Changes <page_count> while the cache is in use.
+
+  New caches reserve room for PAGE_RESERVE_RATIO times their pages: the page
+  infos (and wide bitmaps) of <page_count_max> pages, and as much address
+  space in every process, which maps the payload file that far whatever its
+  size. Hence mappings never move (pinned values stay put) and no process
+  has to notice a resize. On hugetlbfs, the payload is mapped without
+  reserving huge pages, and those of the pages in use are allocated in the
+  file instead.
+
+  Growing clears the page infos of the new pages, extends the payload file
+  if needed, and links the pages as unused.
+
+  Shrinking sets <page_limit> to the new count, and drains the pages past
+  it (see "Rebalancing"); those pages are no longer linked in any list, so
+  nothing gets allocated in them. Sweeps of the hash table then move their
+  entries to the other pages, or evict them if no chunk is free. Once all of
+  them are unused, <page_count> drops to <page_limit>, and their memory is
+  given back by punching a hole in the payload file (which keeps its size,
+  so that stale readers get zeroes rather than SIGBUS). Chunks pinned by
+  readers hold the shrink back; <page_limit> stays set meanwhile, and the
+  next resize finishes it.
+
+*/
+
+/*
+
+  Extent growth,
+  Adds extents (or overflow groups) when all of them are in use.
+
+  New caches reserve room for an extent per HASH_EXTENTS_RESERVE_RATIO
+  buckets of the table at its largest (at least HASH_EXTENTS_INITIAL):
+  <hash_extents_max>. As with the payload (see "Resizing"), every process
+  maps the metadata file that far whatever its size, so that it never has
+  to remap it; the file only holds <hash_extents_count> extents.
+
+  Once the free list is empty, the process allocating an extent doubles the
+  pool (up to <hash_extents_max>) under the meta lock: it extends the file
+  (allocating its huge pages on hugetlbfs), publishes the new
+  <hash_extents_count>, then threads the new extents and splices them onto
+  the head of the free list. Nothing stops meanwhile: readers only reach
+  extents through buckets, and other writers wait for the meta lock as for
+  any allocation. Each process picks up the new count of the free list as
+  it next takes the meta lock. A process dying half way leaves the new
+  extents off the free list, where they are merely lost.
+
+  <hash_extents_used> and <hash_extents_peak> count the extents in use and
+  their high-water mark, to tell how skewed the table is.
+
+*/
+
+/*
+
+  Rebalancing,
+  Moves pages to the chunk types that need them as the mix of sizes shifts.
+
+  When a put has to evict to get a chunk of some type, the next few pages
+  from <rebalance_page> are looked at; the least used one of another type,
+  if at most 1 / REBALANCE_USED_RATIO of its chunks are in use and another
+  page of its type has free chunks, is flagged as draining. Nothing gets
+  allocated in draining pages. If the put found nothing to evict (the type
+  is starving), the least used page is drained however full, and the put
+  fails with ENOMEM.
+
+  While pages drain, each put searches the next REBALANCE_BUCKETS buckets
+  from <rebalance_bucket> for entries with a segment in a draining page, and
+  moves those segments to other chunks of the same type (the entries keep
+  their place in the LRU), or evicts the entries if no chunk is free. A
+  draining page becomes unused (type 255) when its last chunk is freed, and
+  can be taken by any type.
+
+*/
+
+/*
+
+  Compaction,
+  Gives back the pages pinned down by a few live chunks after churn.
+
+  mmap_cache_compact looks at the next pages from <rebalance_page> for the
+  least used one with at most 1 / COMPACT_USED_RATIO of its chunks in use,
+  if the partly used pages of its type (in the first REBALANCE_SCAN_MAX of
+  its list) have enough free chunks for them, and drains it as above: its
+  chunks move to the denser pages of the type, first in the list, and the
+  page becomes unused. Up to REBALANCE_DRAINING_MAX pages drain at once;
+  puts carry on moving their chunks once mmap_cache_compact returns.
+
+  Chunks move under the write lock of their stripe, so that optimistic
+  readers retry, and a chunk pinned by a reader is only freed (and its page
+  given back) once unpinned.
+
+*/
+
+/*
+
+  Expiry,
+  Frees the entries past their <expiry> without scanning the table.
+
+  The table is split into WHEEL_REGIONS regions of consecutive buckets. A
+  hierarchical timer wheel of WHEEL_LEVELS levels of WHEEL_SLOTS slots
+  records, for each slot, which regions hold entries expiring within it.
+  Level <l> slots are WHEEL_TICK * (WHEEL_SLOTS ** <l>) seconds long; an
+  entry is recorded at the lowest level whose current round (a full turn of
+  its slots) includes its expiry, in the slot its expiry falls in. Entries
+  already due are recorded in the tick from <wheel_time>, or the next one
+  if the reaper is done with their region.
+
+  The reaper processes the tick from <wheel_time> once it is over: first the
+  slots of the upper levels starting at <wheel_time>, if any, then the
+  first level slot. It clears the slot's bit for each region in turn, then
+  scans the region's buckets: expired entries are removed, others recorded
+  again (which moves them down a level from upper level slots). Then
+  <wheel_time> moves on by WHEEL_TICK.
+
+  Bits may be stale (entries get overwritten, evicted or split into other
+  buckets, which records them again), which only costs a scan. The reaper
+  state is shared: any process carries on where the last one stopped.
+  Puts run the reaper for REAP_BUCKETS buckets.
+
+*/
+
+/*
+
+  Eviction,
+  Picks the entries puts evict, as per <eviction> (set on creation).
+
+  With CACHE_EVICTION_LRU, entries read are moved to the newest end of their
+  list (see "Deferred promotion"), and puts evict the oldest ones.
+
+  The other policies leave the lists alone on reads: a hit only bumps the
+  entry's access count (REFS_FREQ in its reference bits), with an atomic
+  operation and only if the count is not saturated yet, hence hot entries
+  are read without any write. Evictions give entries with a non-zero count
+  another chance, for at most EVICT_ROTATIONS_MAX entries each:
+
+  - CACHE_EVICTION_CLOCK: the list is the clock, and its oldest entry the
+    hand. Counts saturate at 1: entries read since the hand last passed are
+    cleared and moved to the newest end, the first other one is evicted.
+
+  - CACHE_EVICTION_S3FIFO: new entries go on probation (the small queue),
+    or to the main list if their hash is in the ghost table (keys lately
+    evicted from probation). While probation holds 1 / S3FIFO_SMALL_RATIO
+    of the entries of the type or more, its oldest entry is evicted (its
+    hash becoming a ghost) if it was never read, or moved to the main list
+    otherwise. Else the oldest main entry is evicted if its count is 0, or
+    moved to the newest end with its count decremented. Keys read once go
+    through probation without flushing the main list.
+
+  - CACHE_EVICTION_TINYLFU: new entries go on probation (the window, up to
+    1 / TINYLFU_WINDOW_RATIO of the entries of the type). Puts count an
+    access to their key in a count-min sketch (4 counters of 4 bits per
+    key, all halved every TINYLFU_SAMPLE_RATIO increments per word, so that
+    it forgets). The oldest window entry is only admitted to the main list
+    if its key was accessed more often (sketch plus count) than the main
+    entry it competes with, which is evicted then; otherwise it is evicted
+    itself. Main entries are given another chance like with CLOCK, their
+    count being added to the sketch.
+
+  The ghost table is direct mapped (a ghost replaces that of another key in
+  its slot). It and the sketch have 2 ** POLICY_TABLE_PAGE_ORDER slots or
+  words per data page, and are only used with the meta lock held.
+
+*/
+
+/*
+
+  Deferred promotion,
+  Keeps the LRU order without gets taking the meta lock.
+
+  With CACHE_EVICTION_LRU, each process opening the cache claims one of
+  PROMOTE_RINGS rings (one left by a dead process if none is free), and
+  gets record their hits in it: the LRU index of the entry and the low 24
+  bits of its hash, at <head>, which they then flag in <promote_pending>.
+  Writers holding the meta lock anyway apply up to PROMOTE_DRAIN_MAX
+  pending hits first (puts, and evictions before picking their victim), as
+  does mmap_cache_drain, moving each entry read to the newest end of its
+  list once (hits on entries since evicted or overwritten by another key
+  are told apart by their hash, and dropped).
+
+  Hence an entry read may be evicted as if it was not, until its hit is
+  applied: gets of a process run at most PROMOTE_RING_SLOTS hits ahead of
+  writers, hits past that being dropped. A process with no ring (when more
+  than PROMOTE_RINGS have the cache open) moves entries itself, under the
+  meta lock.
+
+  Rings are multi producer (threads, fork()ed children) single consumer
+  (the meta lock): producers reserve a slot by moving <head> forward, then
+  write it; the consumer only goes past written slots, and resets them to
+  all bits set before moving <tail> forward. All rings are emptied when
+  the meta lock is recovered.
+
+*/
+
+// rings of hits of gets, at most one per process
+#define PROMOTE_RINGS           64
+// hits per ring
+#define PROMOTE_RING_SLOTS      256
+// pending hits applied per meta lock acquisition, at most
+#define PROMOTE_DRAIN_MAX       64
+// <pid> of free rings
+#define PROMOTE_RING_FREE       -1
+// slot of a ring not written yet
+#define PROMOTE_HIT_NONE        0xFFFFFFFFFFFFFFFFULL
+
+// 2176 byte ring of hits of a process (34 cache lines)
+struct promote_ring_
+{
+  // process that claimed the ring, PROMOTE_RING_FREE if none
+  int32_t       pid;
+  // slots reserved by gets so far (modulo 2 ** 32)
+  uint32_t      head;
+  // start time of <pid> (see lease.h), as pids get reused
+  uint64_t      started;
+  // padding, <tail> is written by other processes (all bits set)
+  uint8_t       __r1[48];
+  // slots applied so far (modulo 2 ** 32), written with the meta lock held
+  uint32_t      tail;
+  // padding (all bits set)
+  uint8_t       __r2[60];
+  // LRU index (low 40 bits) and low 24 bits of the hash of the entries
+  // read, slot <n> at <n> % PROMOTE_RING_SLOTS
+  uint64_t      hits[PROMOTE_RING_SLOTS];
+};
+
+typedef struct promote_ring_ promote_ring_t;
+
+/*
+
+  Recovery,
+  Repairs what a process killed holding a lock left half written.
+
+  A stripe is repaired by dropping its entries that fail validation, which
+  retires their chains, and the meta lock by relinking the LRU and page
+  lists (valid entries the LRU lists lost are appended again), counting
+  free chunks again from the page allocators, and sweeping the leases of
+  dead processes (see lock.h).
+
+  For recovery never to keep an entry pointing at chunks that another entry
+  or the allocator owns, writers:
+  - rewrite used entries with their hash set to HASH_UNUSED meanwhile, and
+    write new entries (or copies, when moving them) hash last;
+  - retire chains once no entry refers to them anymore.
+  A dying writer thus leaks the chunks it was writing or retiring instead.
+  A dying move leaves two entries sharing a chain, which recovery tells
+  apart, keeping the valid one.
+
+*/
+
+// reference bits of an entry, 4 per entry in the <refs> of its bucket,
+// extent or group (entry <k> in bits 4 * (<k> % 2) of byte <k> / 2)
+// accesses since the entry was written or last given another chance
+#define REFS_FREQ               0x03
+// the entry is in the main list of its type, on probation otherwise
+#define REFS_MAIN               0x04
+// the entry was relinked already, only while repairing the LRU lists
+#define REFS_SEEN               0x08
+
+// entries given another chance by an eviction, at most
+#define EVICT_ROTATIONS_MAX     64
+// S3-FIFO: share of the entries of a type on probation, at most
+#define S3FIFO_SMALL_RATIO      10
+// W-TinyLFU: share of the entries of a type in the window, at most
+#define TINYLFU_WINDOW_RATIO    100
+// W-TinyLFU: increments per sketch word before counters are halved
+#define TINYLFU_SAMPLE_RATIO    10
+// ghost table slots or sketch words per data page (1024)
+#define POLICY_TABLE_PAGE_ORDER 10
+// largest ghost table or sketch (256MB or 512MB)
+#define POLICY_TABLE_ORDER_MAX  26
+
+// maximum order of the hash table (32GB of buckets)
+#define HASH_ORDER_MAX        30
+// load factor above which the table grows
+#define HASH_LOAD_MAX         0.8
+// load factor plus standard deviation above which the table grows
+#define HASH_LOAD_STDDEV_MAX  0.9
+// buckets split by each put while the table grows
+#define HASH_SPLIT_STEP       2
+// extents (or overflow groups) of a new cache
+#define HASH_EXTENTS_INITIAL  1024
+// buckets of the table at its largest per extent new caches have room for
+#define HASH_EXTENTS_RESERVE_RATIO 8
+
+// <hash> of unused entries
+#define HASH_UNUSED       0xFFFFFFFFU
+// <older_entry>, <newer_entry> at either end of the LRU list
+#define HASH_ENTRY_NONE   0xFFFFFFFFFFULL
+// same, as stored in hash_entry_aligned_t
+#define HASH_LINK_NONE    0xFFFFFFFFU
+// <page> of inline entries (see "Inline values")
+#define HASH_PAGE_INLINE  0xFFFFFFFFU
+// bytes of key and value an inline entry holds
+#define HASH_INLINE_BYTES 32
+// <extent> of buckets without an extent
+#define HASH_EXTENT_NONE  0xFFFFFFFFU
+// <expiry> of entries that never expire
+#define HASH_EXPIRY_NONE  0x3FFFFFFU
+
+// most entries in a bucket and its extent, in any layout
+#define HASH_SLOTS_MAX    32
+
+// cache_info_t.magic, 'µµch' (written last when creating a cache)
+#define CACHE_MAGIC           "\xB5\xB5" "ch"
+
+// values of cache_info_t.version
+// buckets of 1 entry, extents of 4 (hash_bucket_t, hash_extent_t)
+#define CACHE_VERSION_PACKED  0x01
+// groups of 16 tagged entries, overflowing to 1 group (hash_group_t)
+#define CACHE_VERSION_TAGGED  0x02
+// as CACHE_VERSION_PACKED and CACHE_VERSION_TAGGED, with key fingerprints
+// (see "Key fingerprints"); new caches use these
+#define CACHE_VERSION_PACKED_FP 0x03
+#define CACHE_VERSION_TAGGED_FP 0x04
+// buckets of 2 aligned entries, extents of 4, with key fingerprints
+// (hash_bucket_aligned_t, hash_extent_aligned_t, see "Aligned layout")
+#define CACHE_VERSION_ALIGNED   0x05
+
+
+
+// 26 bytes per entry (packed and tagged layouts)
+struct PACKED_STRUCT hash_entry_packed_
 {
   // hash of cache key (2**32-1 if entry unused)
   unsigned int hash: 32;
@@ -203,25 +1010,58 @@ struct PACKED_STRUCT hash_entry_
   unsigned int chunk: 16;
   // size of key
   unsigned int keysize: 10;
-  // bytes stored (maximum is 1<<20 - 8), excluding key
+  // value bytes stored in the last segment (see "Chained values")
   unsigned int bytes: 20;
-  // index of the entry older than this one (2**56-1 if oldest)
-  unsigned int older_entry: 40;
-  // index of the entry newer than this one (2**56-1 if newest)
-  unsigned int newer_entry: 40;
+  // index of the entry older than this one (2**40-1 if oldest)
+  uint64_t     older_entry: 40;
+  // index of the entry newer than this one (2**40-1 if newest)
+  uint64_t     newer_entry: 40;
   // expiry (seconds from time origin, 26 bits ~ 2 years, all bits set to not expire)
   unsigned int expiry: 26;
 };
 
-typedef struct hash_entry_ hash_entry_t
+typedef struct hash_entry_packed_ hash_entry_packed_t;
+
+
+// 28 bytes per entry (aligned layout), fields as in hash_entry_packed_t
+struct hash_entry_aligned_
+{
+  uint32_t     hash;
+  uint32_t     page;
+  uint16_t     chunk;
+  uint16_t     keysize;
+  uint32_t     bytes;
+  // HASH_EXPIRY_NONE to not expire
+  uint32_t     expiry;
+  // HASH_LINK_NONE at either end of the LRU list
+  uint32_t     older_entry;
+  uint32_t     newer_entry;
+};
+
+typedef struct hash_entry_aligned_ hash_entry_aligned_t;
+
+
+// an entry of either format, as per the version of the cache (only ever
+// accessed through a pointer into the table, or copied as per its format;
+// packed, as packed entries are not aligned)
+union PACKED_STRUCT hash_entry_
+{
+  hash_entry_packed_t  packed;
+  hash_entry_aligned_t aligned;
+};
+
+typedef union hash_entry_ hash_entry_t;
 
 
 // 32 bytes per bucket (1/2 cache line)
 struct PACKED_STRUCT hash_bucket_
 {
-  hash_entry_t entry;
-  // padding (all bits set)
-  uint16_t     __r1;
+  hash_entry_packed_t entry;
+  // reference bits of the entry (see "Eviction")
+  uint8_t      refs;
+  // fingerprint of the entry's key (see "Key fingerprints"), all bits set
+  // in CACHE_VERSION_PACKED
+  uint8_t      fingerprint;
   // index of extent, 2**32-1 if no extent
   uint32_t     extent;
 };
@@ -232,12 +1072,94 @@ typedef struct hash_bucket_ hash_bucket_t;
 // 128 bytes per extent (2 cache lines)
 struct PACKED_STRUCT hash_extent_
 {
-  hash_entry_t entries[4];
+  hash_entry_packed_t entries[4];
+  // reference bits of the entries (see "Eviction")
+  uint8_t      refs[2];
+  // fingerprints of the entries' keys, as in hash_bucket_t
+  uint8_t      fingerprints[4];
   // padding (all bits set)
-  uint8_t      __r1[20];
+  uint8_t      __r1[14];
   // used by the free list allocator
   uint32_t     __r2;
 };
 
 typedef struct hash_extent_ hash_extent_t;
 
+
+// 512 bytes per group (8 cache lines), used as bucket or extent
+struct PACKED_STRUCT hash_group_
+{
+  // tag of each entry, see hash_tags.h (and "Key fingerprints")
+  uint8_t      tags[HASH_TAGS_COUNT];
+  // index of overflow group, 2**32-1 if none
+  uint32_t     overflow;
+  // reference bits of the entries (see "Eviction")
+  uint8_t      refs[8];
+  // padding (all bits set)
+  uint8_t      __r1[4];
+  hash_entry_packed_t entries[HASH_TAGS_COUNT];
+  // padding (all bits set)
+  uint8_t      __r2[60];
+  // used by the free list allocator
+  uint32_t     __r3;
+};
+
+typedef struct hash_group_ hash_group_t;
+
+
+// 64 bytes per bucket (1 cache line, aligned), aligned layout
+struct hash_bucket_aligned_
+{
+  // index of extent, 2**32-1 if no extent
+  uint32_t     extent;
+  // reference bits of the entries (see "Eviction")
+  uint8_t      refs;
+  // fingerprints of the entries' keys (see "Key fingerprints")
+  uint8_t      fingerprints[2];
+  // padding (all bits set)
+  uint8_t      __r1;
+  hash_entry_aligned_t entries[2];
+};
+
+typedef struct hash_bucket_aligned_ hash_bucket_aligned_t;
+
+
+// 128 bytes per extent (2 cache lines), aligned layout
+struct hash_extent_aligned_
+{
+  // reference bits of the entries (see "Eviction")
+  uint8_t      refs[2];
+  // fingerprints of the entries' keys (see "Key fingerprints")
+  uint8_t      fingerprints[4];
+  // padding (all bits set)
+  uint8_t      __r1[2];
+  hash_entry_aligned_t entries[4];
+  // padding (all bits set)
+  uint32_t     __r2;
+  // used by the free list allocator
+  uint32_t     __r3;
+};
+
+typedef struct hash_extent_aligned_ hash_extent_aligned_t;
+
+
+// 128 bytes per bucket (2 cache lines, aligned), with CACHE_OPTION_INLINE
+struct hash_bucket_inline_
+{
+  hash_bucket_aligned_t bucket;
+  // inline data of the entries (see "Inline values")
+  uint8_t      data[2][HASH_INLINE_BYTES];
+};
+
+typedef struct hash_bucket_inline_ hash_bucket_inline_t;
+
+
+// 256 bytes per extent (4 cache lines), with CACHE_OPTION_INLINE
+struct hash_extent_inline_
+{
+  // inline data of the entries (see "Inline values")
+  uint8_t      data[4][HASH_INLINE_BYTES];
+  hash_extent_aligned_t extent;
+};
+
+typedef struct hash_extent_inline_ hash_extent_inline_t;
@@ -17,31 +17,33 @@
 
 
 #define _FL_BAIL(_ERR) \
-    do { errno = _ERR ; res = _ERR ; goto cleanup } while(0)
+    do { errno = _ERR ; res = _ERR ; goto cleanup ; } while(0)
 
 // pointer to the payload of slot <_IDX>
 #define _FL_PAYLOAD_PTR(_FL,_IDX) \
-    assert(_IDX >= 0 && _IDX < _FL->slots_count) \
-    (_FL->payload_ptr + _IDX * _FL->slots_stride)
+    (assert((_IDX) < (_FL)->slots_count), \
+    (_FL)->payload_ptr + (size_t)(_IDX) * (_FL)->slots_stride)
 
 // pointer to the next-offset of slot <_IDX>
 #define _FL_NEXT_PTR(_FL, _IDX) \
-    assert(_IDX >= 0 && _IDX < _FL->slots_count) \
-    (_FL->payload_ptr + (_IDX + 1) * _FL->slots_stride - _FL->offset_bytes)
+    (assert((_IDX) < (_FL)->slots_count), \
+    (_FL)->payload_ptr + ((size_t)(_IDX) + 1) * (_FL)->slots_stride - (_FL)->offset_bytes)
 
 // offset used when there is no next free slot
 #define _FL_NO_NEXT(_FL) \
-    (_FL->offset_bytes == 2) ? 0xFFFFU : 0xFFFFFFFFU
+    (((_FL)->offset_bytes == 2) ? 0xFFFFU : 0xFFFFFFFFU)
 
 
 // check if a payload address is valid
 #define _FL_VALID_PAYLOAD(_FL,_ADDR) \
-    (((uint8_t*)_ADDR - _FL->payload_ptr) % (_FL->slots_stride) == 0)
+    ((uint8_t*)(_ADDR) >= (_FL)->payload_ptr && \
+     ((uint8_t*)(_ADDR) - (_FL)->payload_ptr) % (_FL)->slots_stride == 0 && \
+     ((uint8_t*)(_ADDR) - (_FL)->payload_ptr) / (_FL)->slots_stride < (_FL)->slots_count)
 
 // slot offset of a given payload
 #define _FL_PAYLOAD_SLOT(_FL,_ADDR) \
-    assert(_FL_VALID_PAYLOAD(_FL,_ADDR)) \
-    ((uint8_t*)_ADDR - _FL->payload_ptr) / (_FL->slots_stride)
+    (assert(_FL_VALID_PAYLOAD(_FL,_ADDR)), \
+    (uint32_t)(((uint8_t*)(_ADDR) - (_FL)->payload_ptr) / (_FL)->slots_stride))
 
 
 inline static
@@ -49,11 +51,12 @@ int _free_list_valid(free_list_t* fl)
 {
   if (
     (fl->offset_bytes != 2 && fl->offset_bytes != 4)       ||
-    (fl->offset_bytes == 2 && fl->slots_count > (1<<16-1)) || // because we use 0xFFFF as the "free" marker
-    (fl->offset_bytes == 4 && fl->slots_count > (1<<32-1)) || // this should never happen, as <slots_count> is uint32_t
+    (fl->offset_bytes == 2 && fl->slots_count > 0xFFFFU)   || // because we use 0xFFFF as the "free" marker
+    (fl->offset_bytes == 4 && fl->slots_count > 0xFFFFFFFEU) ||
+    fl->slots_count == 0                                   ||
     fl->slots_stride % 4 != 0                              ||
     fl->slots_stride < fl->offset_bytes                    ||
-    fl->slots_stride > (1<<10)                             ||
+    fl->slots_stride > (1<<20)                             ||
     fl->head_slot_ptr == NULL                              ||
     fl->payload_ptr == NULL
   ) return 0;
@@ -124,9 +127,10 @@ void _free_list_get_head(free_list_t* fl, uint32_t* value)
 int free_list_init(free_list_t* fl)
 {
   int res = 0;
-  _FL_CHECK(fl);
 
-  for (uint32_t k = 0; k < fl->slots_count - 1, ++k) {
+  if (!_free_list_valid(fl)) _FL_BAIL(EINVAL);
+
+  for (uint32_t k = 0; k < fl->slots_count - 1; ++k) {
     _free_list_set_next(fl, k, k+1);
   }
 
@@ -135,6 +139,64 @@ int free_list_init(free_list_t* fl)
 
   // last slot has no next slot:
   _free_list_set_next(fl, fl->slots_count-1, _FL_NO_NEXT(fl));
+  fl->slots_free = fl->slots_count;
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+
+int free_list_attach(free_list_t* fl)
+{
+  int      res  = 0;
+  uint32_t slot = _FL_NO_NEXT(fl);
+
+  if (!_free_list_valid(fl)) _FL_BAIL(EINVAL);
+
+  fl->slots_free = 0;
+  _free_list_get_head(fl, &slot);
+  while (slot != _FL_NO_NEXT(fl)) {
+    // dangling or looping
+    if (slot >= fl->slots_count || fl->slots_free == fl->slots_count) _FL_BAIL(EPROTO);
+    ++fl->slots_free;
+    _free_list_get_next(fl, slot, &slot);
+  }
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+
+int free_list_extend(free_list_t* fl, uint32_t count)
+{
+  int      res  = 0;
+  uint32_t from = fl->slots_count;
+  uint32_t head = _FL_NO_NEXT(fl);
+
+  if (!_free_list_valid(fl)) _FL_BAIL(EINVAL);
+  if (count <= from)         _FL_BAIL(EINVAL);
+
+  fl->slots_count = count;
+  if (!_free_list_valid(fl)) {
+    fl->slots_count = from;
+    _FL_BAIL(EINVAL);
+  }
+
+  for (uint32_t k = from; k < count - 1; ++k) {
+    _free_list_set_next(fl, k, k+1);
+  }
+
+  // the last new slot leads to the former head
+  _free_list_get_head(fl, &head);
+  _free_list_set_next(fl, count-1, head);
+  _free_list_set_head(fl, from);
+  fl->slots_free += count - from;
 
 cleanup:
   return res;
@@ -156,9 +218,12 @@ int free_list_alloc(free_list_t* fl, void** payload)
   _free_list_get_head(fl, &slot);
   if (slot == _FL_NO_NEXT(fl)) _FL_BAIL(ENOMEM); // no free slot
 
+  // (head first: if the process dies in between, the slot is lost rather
+  // than the rest of the list)
   _free_list_get_next(fl, slot, &new_head);
-  _free_list_set_next(fl, slot, _FL_NO_NEXT(fl));
   _free_list_set_head(fl, new_head);
+  _free_list_set_next(fl, slot, _FL_NO_NEXT(fl));
+  --fl->slots_free;
 
   *payload = (void*) _FL_PAYLOAD_PTR(fl,slot);
 
@@ -181,8 +246,10 @@ int free_list_free(free_list_t* fl, void* payload)
   
   slot = _FL_PAYLOAD_SLOT(fl,payload);
 
+  _free_list_get_head(fl, &old_head);
   _free_list_set_next(fl, slot, old_head);
   _free_list_set_head(fl, slot);
+  ++fl->slots_free;
 
 cleanup:
   return res;
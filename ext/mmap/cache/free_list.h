@@ -63,4 +63,8 @@ int free_list_alloc(free_list_t* free_list, void** payload);
 // Returns 0 on success, non-0 on failure and sets errno.
 int free_list_free(free_list_t* free_list, void* payload);
 
-// FIXME: add free list extension (memory block gets bigger)
\ No newline at end of file
+// Adds slots <slots_count> to <count> (excluded), which the memory block
+// got room for, to the list (they come first) and sets <slots_count>.
+// Only the next-offsets of the new slots are written.
+// Returns 0 on success, non-0 on failure and sets errno.
+int free_list_extend(free_list_t* free_list, uint32_t count);
@@ -1,9 +1,314 @@
+#include <string.h>
+#include <pthread.h>
 #include "hash.h"
+
+// (lookup3.h is vendored as is, and does not build warning-free)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
 #include "lookup3.h"
+#pragma GCC diagnostic pop
 
 #define MMAP_HASH_SEED 0x00000000
 
-uint32_t mmap_hash(cont char* input)
+// reflected CRC32C (Castagnoli) polynomial
+#define _CRC32C_POLY   0x82F63B78U
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+  #define _HAVE_SSE42_CRC32 1
+  #include <nmmintrin.h>
+#endif
+
+
+static uint32_t       _crc32c_table[256];
+// (threads of a process may select hashers at once)
+static pthread_once_t _crc32c_table_once = PTHREAD_ONCE_INIT;
+
+
+static
+uint64_t _hash_lookup3(const void* input, size_t length)
+{
+  uint32_t hash   = MMAP_HASH_SEED;
+  uint32_t second = 0;
+
+  // (<hash> comes out as hashlittle()'s)
+  hashlittle2(input, length, &hash, &second);
+  return ((uint64_t)second << 32) | hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CRC32C
+
+// CRC bits are linear in the input: mix them so that both the low bits
+// (bucket index) and the high bits (tags) depend on the whole key.
+inline static
+uint32_t _crc32c_finalize(uint32_t crc)
+{
+  uint32_t h = ~crc;
+
+  h ^= h >> 16;
+  h *= 0x85ebca6bU;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35U;
+  h ^= h >> 16;
+  return h;
+}
+
+
+// CRC bits being linear, keys with the same CRC are easy to come by: the
+// second hash runs a multiplicative (non-linear) one over the same words.
+inline static
+uint64_t _crc32c_second_mix(uint64_t second, uint64_t word)
+{
+  return (second ^ word) * 0x9E3779B97F4A7C15ULL;
+}
+
+
+inline static
+uint32_t _crc32c_second_finalize(uint64_t second)
+{
+  second ^= second >> 33;
+  second *= 0xff51afd7ed558ccdULL;
+  second ^= second >> 33;
+  second *= 0xc4ceb9fe1a85ec53ULL;
+  second ^= second >> 33;
+  return (uint32_t)(second >> 32);
+}
+
+
+// second hash of the <length> bytes at <p>, for the soft CRC32C (the SSE4.2
+// one computes it in its own loop)
+static
+uint32_t _crc32c_second(const uint8_t* p, size_t length)
+{
+  uint64_t second = length;
+  uint64_t word   = 0;
+
+  for (; length >= 8; length -= 8, p += 8) {
+    memcpy(&word, p, 8);
+    second = _crc32c_second_mix(second, word);
+  }
+  if (length) {
+    word = 0;
+    memcpy(&word, p, length);
+    second = _crc32c_second_mix(second, word);
+  }
+  return _crc32c_second_finalize(second);
+}
+
+
+static
+void _crc32c_init_table(void)
+{
+  for (uint32_t n = 0; n < 256; ++n) {
+    uint32_t crc = n;
+    for (int k = 0; k < 8; ++k) {
+      crc = (crc & 1) ? (crc >> 1) ^ _CRC32C_POLY : (crc >> 1);
+    }
+    _crc32c_table[n] = crc;
+  }
+}
+
+
+static
+uint64_t _hash_crc32c_soft(const void* input, size_t length)
+{
+  const uint8_t* p      = (const uint8_t*)input;
+  uint32_t       crc    = 0xFFFFFFFFU;
+  uint64_t       second = _crc32c_second(p, length);
+
+  while (length--) {
+    crc = _crc32c_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  }
+  return (second << 32) | _crc32c_finalize(crc);
+}
+
+
+#ifdef _HAVE_SSE42_CRC32
+
+__attribute__((target("sse4.2")))
+static
+uint64_t _hash_crc32c_sse42(const void* input, size_t length)
+{
+  const uint8_t* p      = (const uint8_t*)input;
+  uint64_t       crc    = 0xFFFFFFFFU;
+  uint64_t       second = length;
+  uint64_t       word;
+
+  // (both chains are independent, and run side by side)
+  for (; length >= 8; length -= 8, p += 8) {
+    memcpy(&word, p, 8);
+    crc    = _mm_crc32_u64(crc, word);
+    second = _crc32c_second_mix(second, word);
+  }
+  if (length) {
+    word = 0;
+    memcpy(&word, p, length);
+    second = _crc32c_second_mix(second, word);
+  }
+  while (length--) {
+    crc = _mm_crc32_u8((uint32_t)crc, *p++);
+  }
+  return ((uint64_t)_crc32c_second_finalize(second) << 32) | _crc32c_finalize((uint32_t)crc);
+}
+
+#endif
+
+
+// non-zero if the CPU has a CRC32C instruction
+static
+int _crc32c_hardware(void)
+{
+#ifdef _HAVE_SSE42_CRC32
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.2");
+#else
+  return 0;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// wyhash (final version 4, public domain, https://github.com/wangyi-fudan/wyhash)
+
+static const uint64_t _wyp[4] = {
+  0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+
+inline static
+void _wymum(uint64_t* a, uint64_t* b)
+{
+  __uint128_t r = (__uint128_t)*a * *b;
+
+  *a = (uint64_t)r;
+  *b = (uint64_t)(r >> 64);
+}
+
+
+inline static
+uint64_t _wymix(uint64_t a, uint64_t b)
+{
+  _wymum(&a, &b);
+  return a ^ b;
+}
+
+
+inline static
+uint64_t _wyr8(const uint8_t* p)
+{
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+
+inline static
+uint64_t _wyr4(const uint8_t* p)
+{
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+
+inline static
+uint64_t _wyr3(const uint8_t* p, size_t k)
 {
-  return hashlittle((const void*)input, strnlen(input, MMAP_HASH_KEY_MAX), MMAP_HASH_SEED);
+  return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+
+static
+uint64_t _hash_wyhash(const void* input, size_t length)
+{
+  const uint8_t* p    = (const uint8_t*)input;
+  uint64_t       seed = MMAP_HASH_SEED ^ _wymix(MMAP_HASH_SEED ^ _wyp[0], _wyp[1]);
+  uint64_t       a    = 0;
+  uint64_t       b    = 0;
+  size_t         i    = length;
+
+  if (length <= 16) {
+    if (length >= 4) {
+      a = (_wyr4(p) << 32) | _wyr4(p + ((length >> 3) << 2));
+      b = (_wyr4(p + length - 4) << 32) | _wyr4(p + length - 4 - ((length >> 3) << 2));
+    }
+    else if (length > 0) {
+      a = _wyr3(p, length);
+    }
+  }
+  else {
+    if (i > 48) {
+      uint64_t see1 = seed;
+      uint64_t see2 = seed;
+      do {
+        seed = _wymix(_wyr8(p)      ^ _wyp[1], _wyr8(p + 8)  ^ seed);
+        see1 = _wymix(_wyr8(p + 16) ^ _wyp[2], _wyr8(p + 24) ^ see1);
+        see2 = _wymix(_wyr8(p + 32) ^ _wyp[3], _wyr8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = _wymix(_wyr8(p) ^ _wyp[1], _wyr8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = _wyr8(p + i - 16);
+    b = _wyr8(p + i - 8);
+  }
+
+  a ^= _wyp[1];
+  b ^= seed;
+  _wymum(&a, &b);
+  a = _wymix(a ^ _wyp[0] ^ length, b ^ _wyp[1]);
+  // (the high half as second hash: with the hash, the whole 64 bits)
+  return (a & 0xFFFFFFFF00000000ULL) | (uint32_t)(a ^ (a >> 32));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+mmap_hash_t mmap_hash_select(uint8_t function)
+{
+  switch(function) {
+    case MMAP_HASH_LOOKUP3:
+      return _hash_lookup3;
+    case MMAP_HASH_CRC32C:
+#ifdef _HAVE_SSE42_CRC32
+      if (_crc32c_hardware()) return _hash_crc32c_sse42;
+#endif
+      pthread_once(&_crc32c_table_once, _crc32c_init_table);
+      return _hash_crc32c_soft;
+    case MMAP_HASH_WYHASH:
+      return _hash_wyhash;
+    default:
+      return NULL;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint8_t mmap_hash_default(void)
+{
+  return _crc32c_hardware() ? MMAP_HASH_CRC32C : MMAP_HASH_WYHASH;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t mmap_hash(mmap_hash_t hasher, const void* key, size_t length)
+{
+  return (uint32_t)hasher(key, length);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t mmap_hash_fingerprint(mmap_hash_t hasher, const void* key, size_t length, uint8_t* fingerprint)
+{
+  uint64_t both = hasher(key, length);
+
+  *fingerprint = (uint8_t)(both >> 56);
+  return (uint32_t)both;
 }
@@ -1,10 +1,41 @@
 // 
 // hash.h --
 // 
-// A fast, non-cryptographic string hasher.
+// Fast, non-cryptographic string hashers.
 //
+// Several hash functions are available; each cache records the one it was
+// created with (cache_info_t.hash_function), and every process attaching to
+// it must use that one.
+//
+#include <stddef.h>
 #include <stdint.h>
 
-#define MMAP_HASH_KEY_MAX 1024
+// hash functions, as recorded in cache files
+// Bob Jenkins' lookup3 (hashlittle)
+#define MMAP_HASH_LOOKUP3  0x00
+// CRC32C with a final avalanche, SSE4.2 accelerated when available
+#define MMAP_HASH_CRC32C   0x01
+// Wang Yi's wyhash, folded to 32 bits
+#define MMAP_HASH_WYHASH   0x02
+
+// Hashers return the hash of the key in their low 32 bits, and a second
+// hash of it, computed in the same pass and independent from the first, in
+// their high 32 bits.
+typedef uint64_t (*mmap_hash_t)(const void* input, size_t length);
+
+// Return the implementation of hash <function>, picking the fastest
+// available on this CPU, or NULL if <function> is unknown.
+mmap_hash_t mmap_hash_select(uint8_t function);
+
+// Return the hash function new caches should use on this CPU.
+uint8_t mmap_hash_default(void);
+
+// Hash the <length> bytes at <key> with <hasher>.
+// Keys are arbitrary bytes: callers pass the length they already know
+// rather than have it rescanned.
+uint32_t mmap_hash(mmap_hash_t hasher, const void* key, size_t length);
 
-uint32_t mmap_hash(const char* input);
+// As <mmap_hash>, also setting <fingerprint> to 8 bits of the second hash:
+// keys with the same hash only get the same fingerprint by chance (1 in
+// 256).
+uint32_t mmap_hash_fingerprint(mmap_hash_t hasher, const void* key, size_t length, uint8_t* fingerprint);
@@ -0,0 +1,41 @@
+#include "hash_tags.h"
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+
+uint8_t hash_tag(uint32_t hash)
+{
+  uint8_t tag = (uint8_t)(hash >> 24);
+
+  return (tag == HASH_TAG_FREE) ? 1 : tag;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(__SSE2__)
+
+// one compare and one movemask for the whole group
+uint32_t hash_tags_match(const uint8_t* tags, uint8_t tag)
+{
+  __m128i row    = _mm_loadu_si128((const __m128i*)tags);
+  __m128i needle = _mm_set1_epi8((char)tag);
+
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(row, needle));
+}
+
+#else
+
+uint32_t hash_tags_match(const uint8_t* tags, uint8_t tag)
+{
+  uint32_t mask = 0;
+
+  for (int k = 0; k < HASH_TAGS_COUNT; ++k) {
+    mask |= (uint32_t)(tags[k] == tag) << k;
+  }
+  return mask;
+}
+
+#endif
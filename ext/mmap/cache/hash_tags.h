@@ -0,0 +1,22 @@
+//
+// hash_tags.h --
+//
+// 8-bit tags of hash entries, used by the tagged group layout to rule out
+// most entries of a group without reading them.
+//
+#include <stdint.h>
+
+// number of tags compared at once (one group)
+#define HASH_TAGS_COUNT 16
+
+// tag of free slots
+#define HASH_TAG_FREE   0x00
+
+// Tag stored for <hash>; never HASH_TAG_FREE.
+// Uses the high bits, which bucket indices only use in huge tables.
+uint8_t hash_tag(uint32_t hash);
+
+// Return a bitmask of the positions among the HASH_TAGS_COUNT <tags> equal
+// to <tag> (least significant bit for the first tag).
+// Passing HASH_TAG_FREE returns the free slots.
+uint32_t hash_tags_match(const uint8_t* tags, uint8_t tag);
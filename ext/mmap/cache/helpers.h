@@ -14,3 +14,6 @@
 #else
   #define LOG(...)
 #endif
+
+// always logged: the caller got a degraded but working result
+#define WARN(...) fprintf(stderr, "mmap-cache: " __VA_ARGS__)
@@ -0,0 +1,254 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lease.h"
+
+#if defined(PLATFORM_DARWIN)
+  #include <sys/sysctl.h>
+#endif
+
+
+#define _LEASE_BAIL(_ERR) \
+    do { errno = _ERR ; res = _ERR ; goto cleanup ; } while(0)
+
+// home slot of a chunk
+#define _LEASE_HOME(_LT,_PAGE,_CHUNK) \
+    ((((_PAGE) * 0x9E3779B1U) ^ (_CHUNK)) & ((_LT)->count - 1))
+
+#define _LEASE_NEXT(_LT,_IDX) \
+    (((_IDX) + 1) & ((_LT)->count - 1))
+
+
+inline static
+int _lease_table_valid(lease_table_t* lt)
+{
+  if (
+    lt == NULL                          ||
+    lt->count == 0                      ||
+    (lt->count & (lt->count - 1)) != 0  ||
+    lt->leases == NULL
+  ) return 0;
+
+  return 1;
+}
+
+
+// Remove the lease at <slot>, shifting back later leases of the same
+// cluster so that probes never need tombstones.
+static
+void _lease_remove(lease_table_t* lt, uint32_t slot)
+{
+  uint32_t hole = slot;
+  uint32_t next = _LEASE_NEXT(lt, slot);
+  uint32_t home = 0;
+
+  while (lt->leases[next].page != LEASE_FREE) {
+    home = _LEASE_HOME(lt, lt->leases[next].page, lt->leases[next].chunk);
+    // move <next> into the hole unless its home lies cyclically in (hole, next]
+    if (((next - home) & (lt->count - 1)) >= ((next - hole) & (lt->count - 1))) {
+      lt->leases[hole] = lt->leases[next];
+      hole = next;
+    }
+    next = _LEASE_NEXT(lt, next);
+  }
+  lt->leases[hole].page = LEASE_FREE;
+}
+
+
+// non-zero if another lease of the cluster at <slot> pins the same chunk
+static
+int _lease_shared(lease_table_t* lt, uint32_t slot)
+{
+  lease_t* lease = &lt->leases[slot];
+
+  for (uint32_t k = _LEASE_HOME(lt, lease->page, lease->chunk); lt->leases[k].page != LEASE_FREE; k = _LEASE_NEXT(lt, k)) {
+    if (k == slot) continue;
+    if (lt->leases[k].page == lease->page && lt->leases[k].chunk == lease->chunk) return 1;
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int lease_table_init(lease_table_t* lt)
+{
+  int res = 0;
+
+  if (!_lease_table_valid(lt)) _LEASE_BAIL(EINVAL);
+
+  for (uint32_t k = 0; k < lt->count; ++k) {
+    lt->leases[k].page = LEASE_FREE;
+  }
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+int lease_pin(lease_table_t* lt, uint32_t page, uint32_t chunk, pid_t pid, uint64_t started)
+{
+  int      res     = 0;
+  uint32_t slot    = 0;
+  uint32_t retired = 0;
+  lease_t* lease   = NULL;
+
+  if (!_lease_table_valid(lt)) _LEASE_BAIL(EINVAL);
+
+  for (uint32_t n = 0; n < lt->count; ++n) {
+    slot  = (_LEASE_HOME(lt, page, chunk) + n) & (lt->count - 1);
+    lease = &lt->leases[slot];
+
+    if (lease->page == LEASE_FREE) {
+      lease->chunk   = chunk;
+      lease->pid     = pid;
+      lease->started = started;
+      lease->pins    = retired | 1;
+      lease->page    = page;
+      goto cleanup;
+    }
+    if (lease->page != page || lease->chunk != chunk) continue;
+    if (lease->pid == pid && lease->started == started) {
+      ++lease->pins;
+      goto cleanup;
+    }
+    retired = lease->pins & LEASE_RETIRED;
+  }
+  _LEASE_BAIL(ENOSPC);
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+int lease_unpin(lease_table_t* lt, uint32_t page, uint32_t chunk, pid_t pid, uint64_t started, int* reclaim)
+{
+  int      res   = 0;
+  lease_t* lease = NULL;
+
+  if (!_lease_table_valid(lt)) _LEASE_BAIL(EINVAL);
+  *reclaim = 0;
+
+  for (uint32_t k = _LEASE_HOME(lt, page, chunk); lt->leases[k].page != LEASE_FREE; k = _LEASE_NEXT(lt, k)) {
+    lease = &lt->leases[k];
+    if (lease->page != page || lease->chunk != chunk || lease->pid != pid || lease->started != started) continue;
+
+    if (--lease->pins & ~LEASE_RETIRED) goto cleanup;
+
+    *reclaim = (lease->pins & LEASE_RETIRED) && !_lease_shared(lt, k);
+    _lease_remove(lt, k);
+    goto cleanup;
+  }
+  _LEASE_BAIL(ENOENT);
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+int lease_retire(lease_table_t* lt, uint32_t page, uint32_t chunk, int* pinned)
+{
+  int      res   = 0;
+  lease_t* lease = NULL;
+
+  if (!_lease_table_valid(lt)) _LEASE_BAIL(EINVAL);
+  *pinned = 0;
+
+  for (uint32_t k = _LEASE_HOME(lt, page, chunk); lt->leases[k].page != LEASE_FREE; k = _LEASE_NEXT(lt, k)) {
+    lease = &lt->leases[k];
+    if (lease->page != page || lease->chunk != chunk) continue;
+    lease->pins |= LEASE_RETIRED;
+    *pinned = 1;
+  }
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+int lease_sweep(lease_table_t* lt, int (*reclaim)(void* context, uint32_t page, uint32_t chunk), void* context)
+{
+  int      res   = 0;
+  lease_t  dead;
+  uint32_t k     = 0;
+
+  if (!_lease_table_valid(lt)) _LEASE_BAIL(EINVAL);
+
+  while (k < lt->count) {
+    dead = lt->leases[k];
+    if (dead.page == LEASE_FREE || lease_alive(dead.pid, dead.started)) {
+      ++k;
+      continue;
+    }
+
+    if ((dead.pins & LEASE_RETIRED) && !_lease_shared(lt, k)) {
+      res = reclaim(context, dead.page, dead.chunk);
+      if (res) goto cleanup;
+    }
+    // a lease may have been shifted into <k>: look at it again
+    _lease_remove(lt, k);
+  }
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint64_t lease_started(pid_t pid)
+{
+#if defined(PLATFORM_LINUX)
+  char     path[32];
+  char     line[512];
+  char*    field = NULL;
+  size_t   bytes = 0;
+  FILE*    file  = NULL;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  file = fopen(path, "r");
+  if (file == NULL) return 0;
+  bytes = fread(line, 1, sizeof(line) - 1, file);
+  fclose(file);
+  line[bytes] = 0;
+
+  // clock ticks since boot, field 22, ie. the 20th past the command name
+  // (which may hold spaces and parentheses)
+  field = strrchr(line, ')');
+  for (int k = 0; k < 20 && field != NULL; ++k) field = strchr(field + 1, ' ');
+  if (field == NULL) return 0;
+  return strtoull(field + 1, NULL, 10);
+#elif defined(PLATFORM_DARWIN)
+  int               mib[4] = { CTL_KERN, KERN_PROC, KERN_PROC_PID, pid };
+  struct kinfo_proc info;
+  size_t            bytes  = sizeof(info);
+
+  if (sysctl(mib, 4, &info, &bytes, NULL, 0) || bytes == 0) return 0;
+  return (uint64_t)info.kp_proc.p_starttime.tv_sec * 1000000 + info.kp_proc.p_starttime.tv_usec;
+#else
+  (void)pid;
+  return 0;
+#endif
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+int lease_alive(pid_t pid, uint64_t started)
+{
+  uint64_t current = 0;
+
+  if (kill(pid, 0) && errno == ESRCH) return 0;
+
+  current = lease_started(pid);
+  return started == 0 || current == 0 || current == started;
+}
@@ -0,0 +1,89 @@
+//
+// lease.h --
+//
+// Pins on data chunks, so that zero-copy readers can keep pointing into the
+// data mapping while entries get overwritten or evicted.
+//
+// The table is a small open-addressing hash table (linear probing) in the
+// metadata file, keyed by chunk. Each process pinning a chunk gets its own
+// lease, so that pins held by dead processes can be swept. Processes are
+// told apart by pid and start time, as pids get reused.
+//
+// When the cache lets go of a chunk (overwrite, eviction) it retires it: if
+// the chunk is pinned, its leases are flagged and the last unpin reports the
+// chunk as reclaimable instead of the cache freeing it right away.
+//
+// None of the functions here lock: callers should hold the meta lock.
+//
+#include <stdint.h>
+#include <sys/types.h>
+#include "helpers.h"
+
+// default order of the lease table, ie. 1024 leases (24kB)
+#define LEASE_TABLE_ORDER_DEFAULT 10
+
+// <page> of free leases
+#define LEASE_FREE     0xFFFFFFFFU
+// flag in <pins> once the cache retired the chunk
+#define LEASE_RETIRED  0x80000000U
+
+// 24 bytes per lease
+struct PACKED_STRUCT lease_
+{
+  // pinned chunk, LEASE_FREE if the lease is free
+  uint32_t page;
+  uint32_t chunk;
+  // process holding the pins
+  int32_t  pid;
+  // number of pins, possibly flagged with LEASE_RETIRED
+  uint32_t pins;
+  // start time of the process (see <lease_started>)
+  uint64_t started;
+};
+
+typedef struct lease_ lease_t;
+
+// You need to allocate space yourself for the leases
+// (sizeof(lease_t) * <count>).
+struct lease_table_
+{
+  // number of leases, a power of two
+  uint32_t count;
+  // address of the first lease
+  lease_t* leases;
+};
+
+typedef struct lease_table_ lease_table_t;
+
+// Marks all leases as free.
+// Returns 0 on success, non-0 on failure and sets errno.
+int lease_table_init(lease_table_t* table);
+
+// Add a pin by process <pid>, started at <started>, on <chunk> of <page>.
+// Returns 0 on success, non-0 on failure and sets errno.
+// ENOSPC: the table is full (see <lease_sweep>).
+int lease_pin(lease_table_t* table, uint32_t page, uint32_t chunk, pid_t pid, uint64_t started);
+
+// Remove a pin by process <pid>, started at <started>, on <chunk> of <page>.
+// Sets <reclaim> if the chunk was retired and this was its last pin: the
+// caller should free it.
+// Returns 0 on success, non-0 on failure and sets errno.
+// ENOENT: no such pin.
+int lease_unpin(lease_table_t* table, uint32_t page, uint32_t chunk, pid_t pid, uint64_t started, int* reclaim);
+
+// Flag <chunk> of <page> as no longer used by the cache. Sets <pinned> if
+// any process has it pinned, in which case the caller should not free it.
+// Returns 0 on success, non-0 on failure and sets errno.
+int lease_retire(lease_table_t* table, uint32_t page, uint32_t chunk, int* pinned);
+
+// Drop the leases of processes that no longer exist, calling <reclaim> for
+// each retired chunk that ends up with no pins.
+// Returns 0 on success, non-0 on failure and sets errno.
+int lease_sweep(lease_table_t* table, int (*reclaim)(void* context, uint32_t page, uint32_t chunk), void* context);
+
+// Start time of process <pid>, in a platform-specific unit; 0 if unknown.
+uint64_t lease_started(pid_t pid);
+
+// Non-zero unless process <pid> is gone, or is not the one started at
+// <started> anymore (unless either start time is unknown).
+int lease_alive(pid_t pid, uint64_t started);
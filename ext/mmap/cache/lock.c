@@ -1,18 +1,249 @@
+#include <errno.h>
 #include "lock.h"
 
-int lock_acquire_read(mmap_cache_t* cache)
+
+#define _LOCK_BAIL(_ERR) \
+    do { errno = _ERR ; res = _ERR ; goto cleanup ; } while(0)
+
+// pthread functions return the error rather than setting errno
+#define _LOCK_CHECK(_CALL) \
+    do { int _err = (_CALL) ; if (_err) _LOCK_BAIL(_err) ; } while(0)
+
+// index of the stripe guarding the buckets for <_HASH>
+#define _LOCK_STRIPE_INDEX(_LT,_HASH) \
+    ((int)((_HASH) & ((1U << (_LT)->order) - 1)))
+
+// lock guarding the buckets for <_HASH>
+#define _LOCK_STRIPE(_LT,_HASH) \
+    (&(_LT)->stripes[_LOCK_STRIPE_INDEX(_LT,_HASH)])
+
+// hint to the CPU that we're busy-waiting
+#if defined(__i386__) || defined(__x86_64__)
+  #define _LOCK_PAUSE() __builtin_ia32_pause()
+#else
+  #define _LOCK_PAUSE()
+#endif
+
+
+inline static
+int _lock_table_valid(lock_table_t* lt)
+{
+  if (
+    lt == NULL            ||
+    lt->order > 24        ||
+    lt->stripes == NULL   ||
+    lt->meta == NULL
+  ) return 0;
+
+  return 1;
+}
+
+
+static
+int _lock_init(lock_t* lock)
+{
+  int                 res = 0;
+  pthread_mutexattr_t attr;
+
+  _LOCK_CHECK(pthread_mutexattr_init(&attr));
+  _LOCK_CHECK(pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED));
+  _LOCK_CHECK(pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST));
+  _LOCK_CHECK(pthread_mutex_init(&lock->mutex, &attr));
+  _LOCK_CHECK(pthread_mutexattr_destroy(&attr));
+  lock->sequence = 0;
+
+cleanup:
+  return res;
+}
+
+
+// Lock <lock>, which is <stripe> in the table (or LOCK_META); if <try> is
+// set, fail with EBUSY rather than wait.
+// If the previous owner died holding it, have the cache repair whatever
+// the owner was modifying before marking the lock consistent again.
+static
+int _lock_acquire(lock_table_t* lt, lock_t* lock, int stripe, int try)
+{
+  int res = 0;
+  int err = try ? pthread_mutex_trylock(&lock->mutex) : pthread_mutex_lock(&lock->mutex);
+
+  if (err == EOWNERDEAD) {
+    // keep optimistic readers out while repairing (a dead writer already did)
+    if (!(lock->sequence & 1)) {
+      __atomic_store_n(&lock->sequence, lock->sequence + 1, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+    err = (lt->recover != NULL) ? lt->recover(lt->context, stripe) : 0;
+
+    if (err) {
+      // leave the lock unrecoverable rather than expose corrupt state, and
+      // the sequence odd so that optimistic reads fail too
+      pthread_mutex_unlock(&lock->mutex);
+      _LOCK_BAIL(ENOTRECOVERABLE);
+    }
+
+    // readers would otherwise wait forever
+    __atomic_store_n(&lock->sequence, lock->sequence + 1, __ATOMIC_RELEASE);
+    _LOCK_CHECK(pthread_mutex_consistent(&lock->mutex));
+  }
+  else if (err) _LOCK_BAIL(err);
+
+cleanup:
+  return res;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int lock_table_init(lock_table_t* lt)
+{
+  int res = 0;
+
+  if (!_lock_table_valid(lt)) _LOCK_BAIL(EINVAL);
+
+  for (uint32_t k = 0; k < (1U << lt->order); ++k) {
+    res = _lock_init(&lt->stripes[k]);
+    if (res) goto cleanup;
+  }
+  res = _lock_init(lt->meta);
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+int lock_acquire_read(lock_table_t* lt, uint32_t hash)
+{
+  int res = 0;
+
+  if (!_lock_table_valid(lt)) _LOCK_BAIL(EINVAL);
+  res = _lock_acquire(lt, _LOCK_STRIPE(lt,hash), _LOCK_STRIPE_INDEX(lt,hash), 0);
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+static
+int _lock_acquire_write(lock_table_t* lt, uint32_t hash, int try)
+{
+  int     res  = 0;
+  lock_t* lock = NULL;
+
+  if (!_lock_table_valid(lt)) _LOCK_BAIL(EINVAL);
+  lock = _LOCK_STRIPE(lt,hash);
+  res = _lock_acquire(lt, lock, _LOCK_STRIPE_INDEX(lt,hash), try);
+  if (res) goto cleanup;
+
+  // make the sequence odd before any data gets written
+  __atomic_store_n(&lock->sequence, lock->sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+cleanup:
+  return res;
+}
+
+
+int lock_acquire_write(lock_table_t* lt, uint32_t hash)
+{
+  return _lock_acquire_write(lt, hash, 0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+int lock_try_write(lock_table_t* lt, uint32_t hash)
+{
+  return _lock_acquire_write(lt, hash, 1);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+int lock_release(lock_table_t* lt, uint32_t hash)
+{
+  int     res  = 0;
+  lock_t* lock = NULL;
+
+  if (!_lock_table_valid(lt)) _LOCK_BAIL(EINVAL);
+  lock = _LOCK_STRIPE(lt,hash);
+
+  // Only the writer makes the sequence odd, so if we hold the stripe and the
+  // sequence is odd, we are the writer: make it even again once all data has
+  // been written.
+  if (lock->sequence & 1) {
+    __atomic_store_n(&lock->sequence, lock->sequence + 1, __ATOMIC_RELEASE);
+  }
+  _LOCK_CHECK(pthread_mutex_unlock(&lock->mutex));
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint32_t lock_read_begin(lock_table_t* lt, uint32_t hash)
+{
+  lock_t*  lock     = _LOCK_STRIPE(lt,hash);
+  uint32_t sequence = 0;
+
+  for (int spins = 1; (sequence = __atomic_load_n(&lock->sequence, __ATOMIC_ACQUIRE)) & 1; ++spins) {
+    if (spins % LOCK_READ_SPINS) {
+      _LOCK_PAUSE();
+      continue;
+    }
+    // the writer may be dead, in which case the sequence stays odd until
+    // the stripe is taken and repaired
+    if (_lock_acquire(lt, lock, _LOCK_STRIPE_INDEX(lt,hash), 0)) break;
+    pthread_mutex_unlock(&lock->mutex);
+  }
+  return sequence;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+int lock_read_retry(lock_table_t* lt, uint32_t hash, uint32_t sequence)
 {
-  return 0;
+  lock_t* lock = _LOCK_STRIPE(lt,hash);
+
+  // (an odd sequence was returned by a read that could not wait for the
+  // writer, see <lock_read_begin>)
+  if (sequence & 1) return 1;
+
+  // order the reads of the protected data before re-reading the sequence
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&lock->sequence, __ATOMIC_RELAXED) != sequence;
 }
 
 
-int lock_acquire_write(mmap_cache_t* cache)
+////////////////////////////////////////////////////////////////////////////////
+
+int lock_acquire_meta(lock_table_t* lt)
 {
-  return 0;
+  int res = 0;
+
+  if (!_lock_table_valid(lt)) _LOCK_BAIL(EINVAL);
+  res = _lock_acquire(lt, lt->meta, LOCK_META, 0);
+
+cleanup:
+  return res;
 }
 
 
-int lock_release(mmap_cache_t* cache)
+////////////////////////////////////////////////////////////////////////////////
+
+int lock_release_meta(lock_table_t* lt)
 {
-  return 0;
+  int res = 0;
+
+  if (!_lock_table_valid(lt)) _LOCK_BAIL(EINVAL);
+  _LOCK_CHECK(pthread_mutex_unlock(&lt->meta->mutex));
+
+cleanup:
+  return res;
 }
@@ -1,15 +1,130 @@
-// 
+//
 // lock.h --
-// 
+//
 // Abstraction over a platform cross-process shared/exclusive lock mechanism.
-// 
-#include "mmap-cache.h"
+//
+// Locks are stored in the metadata file and striped over the hash table:
+// stripe <k> guards every bucket whose index has <k> as its lower <order>
+// bits. Since the stripe only depends on the lower bits of the key hash, it
+// does not change when the hash table grows.
+//
+// A separate, short-lived "meta" lock guards the LRU list and the allocator
+// state (page infos, extents free list, counters in cache_info_t).
+//
+// Each stripe also carries a sequence number (a "seqlock"), odd while a
+// writer holds the stripe, which lets readers skip locking entirely:
+//
+//   do {
+//     seq = lock_read_begin(table, hash);
+//     ... copy the hash entry and payload ...
+//   } while (lock_read_retry(table, hash, seq));
+//
+// Optimistic readers never write to shared memory, but may observe torn
+// data: anything they read (page and chunk indices, sizes) must be bounds
+// checked before being dereferenced, and only trusted once
+// <lock_read_retry> returns 0. Readers failing <LOCK_READ_RETRIES> times in
+// a row should fall back to <lock_acquire_read>.
+//
+// Locks are robust process-shared mutexes: if a process dies while holding
+// one (OOM killer, kill -9...), the next process to acquire it calls the
+// table's <recover> callback to repair the buckets or LRU list the dead owner
+// may have left half-written, then carries on. If the repair fails, the lock
+// is left unrecoverable, and its sequence odd, so that every later read or
+// write of the stripe fails. Since readers normally use the optimistic path
+// above, there is no separate shared mode.
+//
+// Lock ordering, to avoid deadlocks:
+// - stripes before the meta lock;
+// - several stripes in increasing stripe index, unless using
+//   <lock_try_write>.
+//
+#include <stdint.h>
+#include <pthread.h>
+#include "helpers.h"
 
-// Acquire a share lock on this <cache>
-int lock_acquire_read(mmap_cache_t* cache);
+// default order of the lock table, ie. 256 stripes (16kB)
+#define LOCK_TABLE_ORDER_DEFAULT 8
 
-// Acquire an exclusive lock on this <cache>
-int lock_acquire_write(mmap_cache_t* cache);
+// optimistic reads attempted before falling back to locking
+#define LOCK_READ_RETRIES 8
 
-// Release any acquired lock.
-int lock_release(mmap_cache_t* cache);
+// pauses an optimistic reader waits for a writer before taking the stripe,
+// which has it repaired if the writer died
+#define LOCK_READ_SPINS   1024
+
+// stripe number passed to <recover> for the LRU list / allocator lock
+#define LOCK_META -1
+
+// 64 bytes per lock (1 cache line), so that stripes never false-share
+union lock_
+{
+  struct {
+    pthread_mutex_t mutex;
+    // incremented when a writer acquires and releases the lock
+    uint32_t        sequence;
+  };
+  // padding
+  uint8_t           __r1[64];
+};
+
+typedef union lock_ lock_t;
+
+// You need to allocate space yourself for
+// - the stripes (sizeof(lock_t) * 2 ** <order>)
+// - the meta lock (sizeof(lock_t))
+struct lock_table_
+{
+  // number of stripes is 2 ** <order>; should not exceed the hash table order
+  uint8_t  order;
+  // address of the first stripe
+  lock_t*  stripes;
+  // address of the LRU list / allocator lock
+  lock_t*  meta;
+  // called with the lock held when its previous owner died holding it, with
+  // the stripe number (or LOCK_META); should return 0 once the data guarded
+  // is consistent again, non-0 and set errno otherwise.
+  int    (*recover)(void* context, int stripe);
+  // passed to <recover>
+  void*    context;
+};
+
+typedef struct lock_table_ lock_table_t;
+
+// Sets up all locks in a freshly created lock table, for use by several
+// processes.
+// Returns 0 on success, non-0 on failure and sets errno.
+int lock_table_init(lock_table_t* table);
+
+// All acquisition functions below return 0 on success, non-0 on failure and
+// set errno; ENOTRECOVERABLE if a previous owner died and <recover> failed.
+
+// Acquire a lock for reading the stripe guarding <hash>.
+// This is exclusive: prefer <lock_read_begin> where possible.
+int lock_acquire_read(lock_table_t* table, uint32_t hash);
+
+// Acquire an exclusive lock on the stripe guarding <hash>.
+int lock_acquire_write(lock_table_t* table, uint32_t hash);
+
+// As <lock_acquire_write>, but fail with EBUSY if the stripe is held.
+// Lets a writer holding a stripe lock another one regardless of ordering.
+int lock_try_write(lock_table_t* table, uint32_t hash);
+
+// Release any lock acquired on the stripe guarding <hash>.
+int lock_release(lock_table_t* table, uint32_t hash);
+
+// Start an optimistic read of the stripe guarding <hash>.
+// Waits for any writer to leave, and returns the sequence number to pass to
+// <lock_read_retry>. Past <LOCK_READ_SPINS> pauses, waits by acquiring the
+// stripe instead, so that a writer that died holding it gets noticed.
+uint32_t lock_read_begin(lock_table_t* table, uint32_t hash);
+
+// Return non-zero if a writer acquired the stripe guarding <hash> since
+// <lock_read_begin> returned <sequence>, ie. if the data read is invalid.
+int lock_read_retry(lock_table_t* table, uint32_t hash, uint32_t sequence);
+
+// Acquire an exclusive lock on the LRU list and allocator state.
+// Should only be held for short periods, and never while acquiring a stripe.
+int lock_acquire_meta(lock_table_t* table);
+
+// Release the LRU list and allocator lock.
+int lock_release_meta(lock_table_t* table);
@@ -1,8 +1,46 @@
 #include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "mmap-cache.h"
 #include "common.h"
-#include "lock.h"
+#include "free_list.h"
+#include "hash.h"
+
+#if defined(PLATFORM_LINUX)
+  #include <sys/vfs.h>
+  #include <linux/magic.h>
+#endif
+
+// a chunk type, as worked out from its size (see "Size classes" in common.h)
+struct chunk_class_
+{
+  // bytes between consecutive chunks
+  uint32_t size;
+  // bytes of key and payload a chunk holds, short of its footers
+  uint32_t capacity;
+  // chunks in a page
+  uint32_t chunks;
+  // set if chunks have an EXT footer
+  uint8_t  chained;
+  // set if chunks are allocated through a bitmap (in page_info_t, or a
+  // wide_bitmap_t), rather than a free list
+  uint8_t  bitmapped;
+  // padding
+  uint8_t  __r1[2];
+};
+
+typedef struct chunk_class_ chunk_class_t;
 
 struct mmap_cache_
 {
@@ -13,70 +51,4704 @@ struct mmap_cache_
 
   void* map_meta;
   void* map_data;
+  // mapped bytes (room for the files to grow, see "Resizing" and "Extent
+  // growth" in common.h)
+  size_t size_meta;
+  size_t size_data;
 
   cache_info_t*  cache_info;
+  page_list_t*   page_lists;
+  lru_list_t*    lru_lists;
   page_info_t*   page_infos;
+  // NULL unless CACHE_OPTION_WIDE_BITMAPS
+  wide_bitmap_t* page_bitmaps;
+  // NULL unless CACHE_OPTION_SIZE_CLASSES
+  uint32_t*      chunk_sizes;
+  // page lists (PAGE_LISTS, or twice as many with size classes); LRU lists
+  // are twice as many, the probation ones from index <page_lists_count>
+  uint32_t       page_lists_count;
+  wheel_slot_t*  wheel;
+  // NULL unless CACHE_EVICTION_S3FIFO, CACHE_EVICTION_TINYLFU respectively
+  uint32_t*      ghosts;
+  uint64_t*      sketch;
+  // NULL unless CACHE_EVICTION_LRU
+  promote_ring_t* promote_rings;
   hash_bucket_t* hash_table;
   hash_extent_t* hash_extents;
+  // same as above, in the tagged layout
+  hash_group_t*  hash_groups;
+  hash_group_t*  hash_overflows;
+  // same as above, in the aligned layout
+  hash_bucket_aligned_t* hash_aligned_buckets;
+  hash_extent_aligned_t* hash_aligned_extents;
+  // same, with CACHE_OPTION_INLINE (the above then point to the same memory,
+  // and buckets and extents are reached through _hash_aligned_bucket() and
+  // _hash_aligned_extent())
+  hash_bucket_inline_t*  hash_inline_buckets;
+  hash_extent_inline_t*  hash_inline_extents;
 
   free_list_t    hash_extents_list;
+  lock_table_t   locks;
+  lease_table_t  leases;
+
+  // as recorded in the cache, see hash.h
+  mmap_hash_t    hasher;
+
+  // chunk types, from the sizes recorded in the cache (see "Size classes"
+  // in common.h); the page list of unused pages and the LRU list of inline
+  // entries come after the last one, at index <page_types>
+  uint32_t       page_types;
+  chunk_class_t  classes[PAGE_CLASSES_MAX];
+
+  // type of chunk the last put had to evict for, -1 if none
+  int            rebalance_type;
+  // set if that put found nothing to evict
+  int            rebalance_starving;
+
+  // promotion ring claimed by this process, -1 if none
+  int            promote_ring;
+
+  // process using the cache and its start time, as recorded in leases and
+  // promotion rings (see <_cache_started>)
+  pid_t          pid;
+  uint64_t       started;
 };
 
 
+#define _CACHE_BAIL(_ERR) \
+    do { errno = _ERR ; res = _ERR ; goto cleanup ; } while(0)
+
+// entries handled together by batched reads and writes
+#define _CACHE_BATCH 64
+
+
 ////////////////////////////////////////////////////////////////////////////////
 static
-void _validate_structure_sizes()
+void _validate_structure_sizes(void)
 {
   assert(sizeof(cache_info_t)  == 256);
-  assert(sizeof(page_info_t)   ==   8);
-  assert(sizeof(hash_entry_t)  ==  26);
+  assert(sizeof(page_info_t)   ==  16);
+  assert(sizeof(page_list_t)   ==   8);
+  assert(sizeof(lru_list_t)    ==  16);
+  assert(sizeof(wide_bitmap_t) ==  32);
+  assert(sizeof(wheel_slot_t)  == 128);
+  assert(sizeof(promote_ring_t) == 2176);
+  assert(sizeof(hash_entry_packed_t)  ==  26);
+  assert(sizeof(hash_entry_aligned_t) ==  28);
   assert(sizeof(hash_bucket_t) ==  32);
   assert(sizeof(hash_extent_t) == 128);
+  assert(sizeof(hash_group_t)  == 512);
+  assert(sizeof(hash_bucket_aligned_t) ==  64);
+  assert(sizeof(hash_extent_aligned_t) == 128);
+  assert(sizeof(hash_bucket_inline_t)  == 128);
+  assert(sizeof(hash_extent_inline_t)  == 256);
+  assert(sizeof(lock_t)        ==  64);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
+// Files
+
+// file systems the cache files may live on
+#define _CACHE_FS_OTHER    0
+#define _CACHE_FS_TMPFS    1
+#define _CACHE_FS_HUGETLB  2
+
+
+// File system of <fd>, and the size its files should be a multiple of.
+static
+int _cache_file_system(int fd, uint64_t* granularity)
+{
+#if defined(PLATFORM_LINUX)
+  struct statfs fs;
+#endif
+
+  *granularity = 1;
+
+#if defined(PLATFORM_LINUX)
+  if (fstatfs(fd, &fs)) return _CACHE_FS_OTHER;
+  if (fs.f_type == HUGETLBFS_MAGIC) {
+    *granularity = fs.f_bsize;
+    return _CACHE_FS_HUGETLB;
+  }
+  if (fs.f_type == TMPFS_MAGIC) return _CACHE_FS_TMPFS;
+#endif
 
-int mmap_cache_open(mmap_cache_t** cache, char* path, int pages)
+  return _CACHE_FS_OTHER;
+}
+
+
+// Make sure the file of <fd> holds bytes <start> to <end> (excluded): extend
+// it if needed, and on hugetlbfs allocate their huge pages, which the
+// mappings do not reserve (see "Resizing" and "Extent growth").
+// Returns 0 on success, non-0 on failure and sets errno.
+// ENOMEM: not enough huge pages.
+static
+int _cache_file_alloc(int fd, uint64_t start, uint64_t end)
 {
-  int res = 0;
-  _validate_structure_sizes();
+  int         res         = 0;
+  uint64_t    granularity = 0;
+  int         fs          = _cache_file_system(fd, &granularity);
+  struct stat st;
+
+  start = start / granularity * granularity;
+  end   = (end + granularity - 1) / granularity * granularity;
+  if (end <= start) goto cleanup;
+
+#if defined(PLATFORM_LINUX)
+  if (fs == _CACHE_FS_HUGETLB) {
+    if (fallocate(fd, 0, start, end - start)) _CACHE_BAIL(errno == ENOSPC ? ENOMEM : errno);
+    goto cleanup;
+  }
+#else
+  (void)fs;
+#endif
 
+  if (fstat(fd, &st)) _CACHE_BAIL(errno);
+  if ((uint64_t)st.st_size < end && ftruncate(fd, end)) _CACHE_BAIL(errno);
 
 cleanup:
   return res;
 }
 
-
 ////////////////////////////////////////////////////////////////////////////////
+// Hash table entries
 
-int mmap_cache_close(mmap_cache_t* cache)
+// Pick the implementation of the cache's hash function.
+// Returns 0 on success, ENOTSUP if this version does not know it.
+static
+int _attach_hasher(mmap_cache_t* cache)
 {
-  int res = 0;
+  cache->hasher = mmap_hash_select(cache->cache_info->hash_function);
+  if (cache->hasher != NULL) return 0;
 
+  errno = ENOTSUP;
+  return ENOTSUP;
+}
 
-cleanup:
-  return res;
+
+// index of the bucket holding <hash>, when <buckets> are in use
+// (see "Hash table growth" in common.h)
+static
+uint32_t _hash_bucket_index(uint32_t hash, uint32_t buckets)
+{
+  uint32_t mask  = (uint32_t)((2ULL << (31 - __builtin_clz(buckets))) - 1);
+  uint32_t index = hash & mask;
+
+  return (index < buckets) ? index : (index & (mask >> 1));
 }
 
 
-////////////////////////////////////////////////////////////////////////////////
+// non-zero if caches of <version> use the tagged group layout
+static
+int _hash_version_tagged(uint8_t version)
+{
+  return version == CACHE_VERSION_TAGGED || version == CACHE_VERSION_TAGGED_FP;
+}
 
-int mmap_cache_get(mmap_cache_t* cache, cache_entry_t* entry)
+
+// non-zero if the cache uses the tagged group layout
+static
+int _hash_tagged(mmap_cache_t* cache)
 {
-  int res = 0;
+  return _hash_version_tagged(cache->cache_info->version);
+}
 
 
-cleanup:
-  return res;
+// non-zero if the cache uses the aligned layout (set when attaching, so
+// that entry accessors need not look at the version)
+static inline
+int _hash_aligned(mmap_cache_t* cache)
+{
+  return cache->hash_aligned_buckets != NULL;
 }
 
 
-////////////////////////////////////////////////////////////////////////////////
+// non-zero if the cache keeps small entries inline (see "Inline values" in
+// common.h)
+static inline
+int _hash_inline(mmap_cache_t* cache)
+{
+  return cache->hash_inline_buckets != NULL;
+}
 
-int mmap_cache_put(mmap_cache_t* cache, cache_entry_t* entry)
+
+// <bucket>, <extent> of the aligned layout
+static inline
+hash_bucket_aligned_t* _hash_aligned_bucket(mmap_cache_t* cache, uint32_t bucket)
 {
-  int res = 0;
+  if (_hash_inline(cache)) return &cache->hash_inline_buckets[bucket].bucket;
+  return &cache->hash_aligned_buckets[bucket];
+}
+
+
+static inline
+hash_extent_aligned_t* _hash_aligned_extent(mmap_cache_t* cache, uint32_t extent)
+{
+  if (_hash_inline(cache)) return &cache->hash_inline_extents[extent].extent;
+  return &cache->hash_aligned_extents[extent];
+}
+
+
+// non-zero if the entries of the cache have key fingerprints
+static
+int _hash_fingerprinted(mmap_cache_t* cache)
+{
+  uint8_t version = cache->cache_info->version;
+
+  return version == CACHE_VERSION_PACKED_FP || version == CACHE_VERSION_TAGGED_FP ||
+    version == CACHE_VERSION_ALIGNED;
+}
+
+
+// number of entries in a bucket, not counting its extent
+static
+uint32_t _hash_bucket_slots_count(mmap_cache_t* cache)
+{
+  if (_hash_aligned(cache)) return 2;
+  return _hash_tagged(cache) ? HASH_TAGS_COUNT : 1;
+}
+
+
+// number of entries in an extent
+static
+uint32_t _hash_extent_slots_count(mmap_cache_t* cache)
+{
+  return _hash_tagged(cache) ? HASH_TAGS_COUNT : 4;
+}
+
+
+// LRU index of the first entry in an extent
+static
+uint64_t _hash_extents_base(mmap_cache_t* cache)
+{
+  return (uint64_t)_hash_bucket_slots_count(cache) << cache->cache_info->hash_table_max_size;
+}
+
+
+// number of entries addressable in the hash table (buckets and extents)
+static
+uint64_t _hash_entry_count(mmap_cache_t* cache)
+{
+  return _hash_extents_base(cache) +
+    (uint64_t)_hash_extent_slots_count(cache) * cache->cache_info->hash_extents_count;
+}
+
+
+// LRU index of entry <k> in <extent>
+static
+uint64_t _hash_extent_entry_index(mmap_cache_t* cache, uint32_t extent, int k)
+{
+  return _hash_extents_base(cache) + (uint64_t)_hash_extent_slots_count(cache) * extent + k;
+}
+
+
+// index of the extent of <bucket>
+static
+uint32_t _hash_bucket_extent(mmap_cache_t* cache, uint32_t bucket)
+{
+  if (_hash_aligned(cache)) return _hash_aligned_bucket(cache, bucket)->extent;
+  if (_hash_tagged(cache))  return cache->hash_groups[bucket].overflow;
+  return cache->hash_table[bucket].extent;
+}
+
+
+static
+void _hash_bucket_set_extent(mmap_cache_t* cache, uint32_t bucket, uint32_t extent)
+{
+  if (_hash_aligned(cache))     _hash_aligned_bucket(cache, bucket)->extent = extent;
+  else if (_hash_tagged(cache)) cache->hash_groups[bucket].overflow        = extent;
+  else                          cache->hash_table[bucket].extent           = extent;
+}
+
+
+// Fill <slots> with the LRU indices of all entries of <bucket>, including
+// its extent's. Returns the number of entries.
+static
+int _hash_bucket_slots(mmap_cache_t* cache, uint32_t bucket, uint64_t* slots)
+{
+  uint32_t primary = _hash_bucket_slots_count(cache);
+  uint32_t extent  = _hash_bucket_extent(cache, bucket);
+  int      count   = 0;
+
+  for (uint32_t k = 0; k < primary; ++k) {
+    slots[count++] = (uint64_t)bucket * primary + k;
+  }
+  if (extent == HASH_EXTENT_NONE) return count;
+  for (uint32_t k = 0; k < _hash_extent_slots_count(cache); ++k) {
+    slots[count++] = _hash_extent_entry_index(cache, extent, k);
+  }
+  return count;
+}
+
+
+// entry for LRU <index>, NULL if out of range (including HASH_ENTRY_NONE)
+static
+hash_entry_t* _hash_entry_at(mmap_cache_t* cache, uint64_t index)
+{
+  uint64_t base    = _hash_extents_base(cache);
+  uint64_t index_e = index - base;
+
+  if (index < base) {
+    if (index / _hash_bucket_slots_count(cache) >= cache->cache_info->hash_buckets) return NULL;
+    if (_hash_aligned(cache)) return (hash_entry_t*)&_hash_aligned_bucket(cache, index >> 1)->entries[index & 1];
+    if (_hash_tagged(cache))  return (hash_entry_t*)&cache->hash_groups[index >> 4].entries[index & 15];
+    return (hash_entry_t*)&cache->hash_table[index].entry;
+  }
+  if (index >= _hash_entry_count(cache)) return NULL;
+  if (_hash_aligned(cache)) return (hash_entry_t*)&_hash_aligned_extent(cache, index_e >> 2)->entries[index_e & 3];
+  if (_hash_tagged(cache))  return (hash_entry_t*)&cache->hash_overflows[index_e >> 4].entries[index_e & 15];
+  return (hash_entry_t*)&cache->hash_extents[index_e >> 2].entries[index_e & 3];
+}
+
+
+// Fields of <entry>, as per the layout of the cache (see "Aligned layout"
+// in common.h). Links are HASH_ENTRY_NONE in either layout.
+static inline
+uint32_t _entry_hash(mmap_cache_t* cache, hash_entry_t* entry)
+{
+  return _hash_aligned(cache) ? entry->aligned.hash : entry->packed.hash;
+}
+
+
+static inline
+uint32_t _entry_page(mmap_cache_t* cache, hash_entry_t* entry)
+{
+  return _hash_aligned(cache) ? entry->aligned.page : entry->packed.page;
+}
+
+
+static inline
+uint32_t _entry_chunk(mmap_cache_t* cache, hash_entry_t* entry)
+{
+  return _hash_aligned(cache) ? entry->aligned.chunk : entry->packed.chunk;
+}
+
+
+static inline
+uint32_t _entry_keysize(mmap_cache_t* cache, hash_entry_t* entry)
+{
+  return _hash_aligned(cache) ? entry->aligned.keysize : entry->packed.keysize;
+}
+
+
+static inline
+uint32_t _entry_bytes(mmap_cache_t* cache, hash_entry_t* entry)
+{
+  return _hash_aligned(cache) ? entry->aligned.bytes : entry->packed.bytes;
+}
+
+
+static inline
+uint32_t _entry_expiry(mmap_cache_t* cache, hash_entry_t* entry)
+{
+  return _hash_aligned(cache) ? entry->aligned.expiry : entry->packed.expiry;
+}
+
+
+static inline
+uint64_t _entry_older(mmap_cache_t* cache, hash_entry_t* entry)
+{
+  if (!_hash_aligned(cache)) return entry->packed.older_entry;
+  return (entry->aligned.older_entry == HASH_LINK_NONE) ? HASH_ENTRY_NONE : entry->aligned.older_entry;
+}
+
+
+static inline
+uint64_t _entry_newer(mmap_cache_t* cache, hash_entry_t* entry)
+{
+  if (!_hash_aligned(cache)) return entry->packed.newer_entry;
+  return (entry->aligned.newer_entry == HASH_LINK_NONE) ? HASH_ENTRY_NONE : entry->aligned.newer_entry;
+}
+
+
+static inline
+void _entry_set_hash(mmap_cache_t* cache, hash_entry_t* entry, uint32_t hash)
+{
+  if (_hash_aligned(cache)) entry->aligned.hash = hash;
+  else                      entry->packed.hash  = hash;
+}
+
+
+// set the first segment of <entry>
+static inline
+void _entry_set_chunk(mmap_cache_t* cache, hash_entry_t* entry, uint32_t page, uint32_t chunk)
+{
+  if (_hash_aligned(cache)) { entry->aligned.page = page; entry->aligned.chunk = chunk; }
+  else                      { entry->packed.page  = page; entry->packed.chunk  = chunk; }
+}
+
+
+// set the sizes and expiry of <entry>
+static inline
+void _entry_set_value(mmap_cache_t* cache, hash_entry_t* entry, uint32_t keysize, uint32_t bytes, uint32_t expiry)
+{
+  if (_hash_aligned(cache)) {
+    entry->aligned.keysize = keysize;
+    entry->aligned.bytes   = bytes;
+    entry->aligned.expiry  = expiry;
+  }
+  else {
+    entry->packed.keysize  = keysize;
+    entry->packed.bytes    = bytes;
+    entry->packed.expiry   = expiry;
+  }
+}
+
+
+static inline
+void _entry_set_older(mmap_cache_t* cache, hash_entry_t* entry, uint64_t index)
+{
+  if (_hash_aligned(cache)) entry->aligned.older_entry = (uint32_t)index;
+  else                      entry->packed.older_entry  = index;
+}
+
+
+static inline
+void _entry_set_newer(mmap_cache_t* cache, hash_entry_t* entry, uint64_t index)
+{
+  if (_hash_aligned(cache)) entry->aligned.newer_entry = (uint32_t)index;
+  else                      entry->packed.newer_entry  = index;
+}
+
+
+// copy <src> to unused <dst> (only the entry: the union is larger than
+// packed entries, which are next to each other), its hash last so that a
+// process dying meanwhile leaves <dst> unused
+static inline
+void _entry_copy(mmap_cache_t* cache, hash_entry_t* dst, hash_entry_t* src)
+{
+  hash_entry_aligned_t aligned;
+  hash_entry_packed_t  packed;
+
+  if (_hash_aligned(cache)) {
+    aligned      = src->aligned;
+    aligned.hash = HASH_UNUSED;
+    dst->aligned = aligned;
+  }
+  else {
+    packed       = src->packed;
+    packed.hash  = HASH_UNUSED;
+    dst->packed  = packed;
+  }
+  _entry_set_hash(cache, dst, _entry_hash(cache, src));
+}
+
+
+// non-zero if the key and value of <entry> are inline (see "Inline values"
+// in common.h)
+static inline
+int _entry_inline(mmap_cache_t* cache, hash_entry_t* entry)
+{
+  return _hash_inline(cache) && entry->aligned.page == HASH_PAGE_INLINE;
+}
+
+
+// tag of the entries of a key hashing to <hash>, with <fingerprint>, in the
+// tagged layout
+static inline
+uint8_t _hash_key_tag(mmap_cache_t* cache, uint32_t hash, uint8_t fingerprint)
+{
+  return hash_tag(_hash_fingerprinted(cache) ? (uint32_t)fingerprint << 24 : hash);
+}
+
+
+// Fill <slots> with the LRU indices of the entries of <bucket> whose hash
+// is <hash>. In the tagged layout, only the tags and the entries whose tag
+// matches (as per <fingerprint> if tags are fingerprints) are read. Returns
+// the number of entries.
+static
+int _hash_bucket_find(mmap_cache_t* cache, uint32_t bucket, uint32_t hash, uint8_t fingerprint, uint64_t* slots)
+{
+  uint64_t      candidates[HASH_SLOTS_MAX];
+  int           count = 0;
+  int           found = 0;
+  uint8_t       tag   = _hash_key_tag(cache, hash, fingerprint);
+  uint32_t      mask  = 0;
+  uint64_t      base  = (uint64_t)bucket * HASH_TAGS_COUNT;
+  hash_group_t* group = NULL;
+  hash_entry_t* entry = NULL;
+
+  if (!_hash_tagged(cache)) {
+    count = _hash_bucket_slots(cache, bucket, candidates);
+    for (int k = 0; k < count; ++k) {
+      // (NULL if an optimistic reader saw a torn extent index)
+      entry = _hash_entry_at(cache, candidates[k]);
+      if (entry != NULL && _entry_hash(cache, entry) == hash) slots[found++] = candidates[k];
+    }
+    return found;
+  }
+
+  // the group, then its overflow group (which doesn't overflow itself)
+  group = &cache->hash_groups[bucket];
+  for (int pass = 0; pass < 2; ++pass) {
+    for (mask = hash_tags_match(group->tags, tag); mask; mask &= mask - 1) {
+      int k = __builtin_ctz(mask);
+      if (group->entries[k].hash == hash) slots[found++] = base + k;
+    }
+    if (group->overflow >= cache->cache_info->hash_extents_count) break;
+    base  = _hash_extent_entry_index(cache, group->overflow, 0);
+    group = &cache->hash_overflows[group->overflow];
+  }
+  return found;
+}
+
+
+// address of the tag of the entry at LRU <index>, NULL in the packed layout
+static
+uint8_t* _hash_tag_at(mmap_cache_t* cache, uint64_t index)
+{
+  uint64_t base    = _hash_extents_base(cache);
+  uint64_t index_e = index - base;
+
+  if (!_hash_tagged(cache)) return NULL;
+  if (index < base) return &cache->hash_groups[index >> 4].tags[index & 15];
+  return &cache->hash_overflows[index_e >> 4].tags[index_e & 15];
+}
+
+
+// address of the key fingerprint of the entry at LRU <index>, NULL unless
+// the cache is CACHE_VERSION_PACKED_FP (see "Key fingerprints" in common.h)
+static
+uint8_t* _hash_fingerprint_at(mmap_cache_t* cache, uint64_t index)
+{
+  uint64_t base    = _hash_extents_base(cache);
+  uint64_t index_e = index - base;
+
+  if (_hash_tagged(cache) || !_hash_fingerprinted(cache)) return NULL;
+  if (_hash_aligned(cache)) {
+    if (index < base) return &_hash_aligned_bucket(cache, index >> 1)->fingerprints[index & 1];
+    return &_hash_aligned_extent(cache, index_e >> 2)->fingerprints[index_e & 3];
+  }
+  if (index < base) return &cache->hash_table[index].fingerprint;
+  return &cache->hash_extents[index_e >> 2].fingerprints[index_e & 3];
+}
+
+
+// address of the inline data of the entry at LRU <index>, NULL unless the
+// cache has CACHE_OPTION_INLINE (see "Inline values" in common.h)
+static
+uint8_t* _hash_inline_at(mmap_cache_t* cache, uint64_t index)
+{
+  uint64_t base    = _hash_extents_base(cache);
+  uint64_t index_e = index - base;
+
+  if (!_hash_inline(cache)) return NULL;
+  if (index < base) return cache->hash_inline_buckets[index >> 1].data[index & 1];
+  return cache->hash_inline_extents[index_e >> 2].data[index_e & 3];
+}
+
+
+// Address of the byte holding the reference bits of the entry at LRU
+// <index>, and their <shift> in it (see "Eviction" in common.h). NULL if
+// out of range.
+static
+uint8_t* _hash_refs_at(mmap_cache_t* cache, uint64_t index, int* shift)
+{
+  uint64_t base    = _hash_extents_base(cache);
+  uint64_t index_e = index - base;
+
+  if (_hash_entry_at(cache, index) == NULL) return NULL;
+  if (index < base) {
+    *shift = (_hash_tagged(cache) || _hash_aligned(cache)) ? 4 * (index & 1) : 0;
+    if (_hash_aligned(cache)) return &_hash_aligned_bucket(cache, index >> 1)->refs;
+    if (_hash_tagged(cache))  return &cache->hash_groups[index >> 4].refs[(index & 15) >> 1];
+    return &cache->hash_table[index].refs;
+  }
+  *shift = 4 * (index_e & 1);
+  if (_hash_aligned(cache)) return &_hash_aligned_extent(cache, index_e >> 2)->refs[(index_e & 3) >> 1];
+  if (_hash_tagged(cache))  return &cache->hash_overflows[index_e >> 4].refs[(index_e & 15) >> 1];
+  return &cache->hash_extents[index_e >> 2].refs[(index_e & 3) >> 1];
+}
+
+
+// reference bits of the entry at LRU <index>
+static inline
+uint8_t _refs_get(mmap_cache_t* cache, uint64_t index)
+{
+  int      shift = 0;
+  uint8_t* refs  = _hash_refs_at(cache, index, &shift);
+
+  return (__atomic_load_n(refs, __ATOMIC_RELAXED) >> shift) & 0x0F;
+}
+
+
+// Set the reference bits of the entry at LRU <index> to <bits>, atomically
+// as readers may be counting a hit on its neighbour.
+// Call with the meta lock held.
+static
+void _refs_set(mmap_cache_t* cache, uint64_t index, uint8_t bits)
+{
+  int      shift = 0;
+  uint8_t* refs  = _hash_refs_at(cache, index, &shift);
+  uint8_t  old   = __atomic_load_n(refs, __ATOMIC_RELAXED);
+  uint8_t  value = 0;
+
+  do value = (old & ~(0x0F << shift)) | (bits << shift);
+  while (!__atomic_compare_exchange_n(refs, &old, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+
+// Count a hit on the entry at LRU <index>, unless its count already is
+// <max> (in which case nothing is written). Works without locking.
+static
+void _refs_hit(mmap_cache_t* cache, uint64_t index, uint8_t max)
+{
+  int      shift = 0;
+  uint8_t* refs  = _hash_refs_at(cache, index, &shift);
+  uint8_t  old   = 0;
+
+  if (refs == NULL) return;
+  old = __atomic_load_n(refs, __ATOMIC_RELAXED);
+  do if (((old >> shift) & REFS_FREQ) >= max) return;
+  while (!__atomic_compare_exchange_n(refs, &old, old + (1 << shift), 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+
+// mark the entry at LRU <index> unused (it should not be in the LRU list)
+static
+void _hash_entry_clear(mmap_cache_t* cache, uint64_t index)
+{
+  uint8_t* tag = _hash_tag_at(cache, index);
+
+  // clear the tag first, so lookups skip the entry
+  if (tag != NULL) *tag = HASH_TAG_FREE;
+  _entry_set_hash(cache, _hash_entry_at(cache, index), HASH_UNUSED);
+}
+
+
+// prepare a bucket in the sparse part of the table for use
+static
+void _hash_bucket_init(mmap_cache_t* cache, uint32_t bucket)
+{
+  hash_group_t* group = NULL;
+
+  if (_hash_aligned(cache)) {
+    if (_hash_inline(cache)) memset(&cache->hash_inline_buckets[bucket], 0xFF, sizeof(hash_bucket_inline_t));
+    else                     memset(&cache->hash_aligned_buckets[bucket], 0xFF, sizeof(hash_bucket_aligned_t));
+    return;
+  }
+  if (!_hash_tagged(cache)) {
+    memset(&cache->hash_table[bucket], 0xFF, sizeof(hash_bucket_t));
+    return;
+  }
+  group = &cache->hash_groups[bucket];
+  memset(group, 0xFF, sizeof(hash_group_t));
+  memset(group->tags, HASH_TAG_FREE, sizeof(group->tags));
+}
+
+
+// number of extents caches with <info> have room for (see "Extent growth")
+static
+uint32_t _hash_extents_max(cache_info_t* info)
+{
+  return (info->hash_extents_max == HASH_EXTENT_NONE) ? info->hash_extents_count : info->hash_extents_max;
+}
+
+
+// The extent allocator, with as many slots as the cache now has extents
+// (another process may have added some, see "Extent growth").
+// Call with the meta lock held.
+static
+free_list_t* _hash_extents_list(mmap_cache_t* cache)
+{
+  cache->hash_extents_list.slots_count = cache->cache_info->hash_extents_count;
+  return &cache->hash_extents_list;
+}
+
+
+// Double the extents (up to <hash_extents_max>), and give the new ones to
+// the allocator (see "Extent growth").
+// Call with the meta lock held.
+// Returns 0 on success, non-0 on failure and sets errno.
+// ENOMEM: no room for more extents, or not enough huge pages.
+static
+int _hash_extents_grow(mmap_cache_t* cache)
+{
+  int           res   = 0;
+  cache_info_t* info  = cache->cache_info;
+  free_list_t*  list  = _hash_extents_list(cache);
+  uint64_t      base  = list->payload_ptr - (uint8_t*)cache->map_meta;
+  uint32_t      count = info->hash_extents_count;
+  uint32_t      max   = _hash_extents_max(info);
+  uint32_t      grown = (count > max - count) ? max : 2 * count;
+
+  if (count >= max) _CACHE_BAIL(ENOMEM);
+
+  res = _cache_file_alloc(cache->fd_meta, base + (uint64_t)list->slots_stride * count, base + (uint64_t)list->slots_stride * grown);
+  if (res) goto cleanup;
+
+  // (no bucket links to the new extents yet, readers may see them early)
+  __atomic_store_n(&info->hash_extents_count, grown, __ATOMIC_RELEASE);
+  res = free_list_extend(list, grown);
+  if (res) goto cleanup;
+
+  LOG("hash extents grown from %u to %u\n", count, grown);
+
+cleanup:
+  return res;
+}
+
+
+// Allocate an empty extent, and return its index in <extent>; adds extents
+// if none is free.
+// Call with the meta lock held.
+// Returns 0 on success, non-0 on failure and sets errno (ENOMEM if there is
+// no free extent, and no room for more).
+static
+int _hash_extent_alloc(mmap_cache_t* cache, uint32_t* extent)
+{
+  int           res     = 0;
+  cache_info_t* info    = cache->cache_info;
+  void*         payload = NULL;
+  hash_group_t* group   = NULL;
+
+  res = free_list_alloc(_hash_extents_list(cache), &payload);
+  if (res == ENOMEM) {
+    res = _hash_extents_grow(cache);
+    if (res == 0) res = free_list_alloc(&cache->hash_extents_list, &payload);
+  }
+  if (res) goto cleanup;
+
+  if (_hash_tagged(cache)) {
+    group = (hash_group_t*)payload;
+    memset(group, 0xFF, sizeof(hash_group_t) - sizeof(group->__r3));
+    memset(group->tags, HASH_TAG_FREE, sizeof(group->tags));
+    *extent = group - cache->hash_overflows;
+  }
+  else if (_hash_inline(cache)) {
+    memset(payload, 0xFF, sizeof(hash_extent_inline_t) - sizeof(uint32_t));
+    *extent = (hash_extent_inline_t*)payload - cache->hash_inline_extents;
+  }
+  else if (_hash_aligned(cache)) {
+    memset(payload, 0xFF, sizeof(hash_extent_aligned_t) - sizeof(uint32_t));
+    *extent = (hash_extent_aligned_t*)payload - cache->hash_aligned_extents;
+  }
+  else {
+    memset(payload, 0xFF, sizeof(hash_extent_t) - sizeof(uint32_t));
+    *extent = (hash_extent_t*)payload - cache->hash_extents;
+  }
+
+  ++info->hash_extents_used;
+  if (info->hash_extents_used > info->hash_extents_peak) info->hash_extents_peak = info->hash_extents_used;
+
+cleanup:
+  return res;
+}
+
+
+// Give back <extent> to the allocator.
+// Call with the meta lock held.
+static
+int _hash_extent_free(mmap_cache_t* cache, uint32_t extent)
+{
+  int   res     = 0;
+  void* payload = NULL;
+
+  if (_hash_inline(cache))       payload = &cache->hash_inline_extents[extent];
+  else if (_hash_aligned(cache)) payload = &cache->hash_aligned_extents[extent];
+  else if (_hash_tagged(cache))  payload = &cache->hash_overflows[extent];
+  else                           payload = &cache->hash_extents[extent];
+
+  res = free_list_free(_hash_extents_list(cache), payload);
+  if (res == 0) --cache->cache_info->hash_extents_used;
+
+  return res;
+}
+
+
+// bytes of key and payload a chunk of <type> holds, short of its footers
+static inline
+uint32_t _chunk_capacity(mmap_cache_t* cache, uint8_t type)
+{
+  return cache->classes[type].capacity;
+}
+
+
+// smallest type of chunk holding <bytes> (at most a 1MB chunk's capacity)
+static
+uint8_t _chunk_type(mmap_cache_t* cache, uint32_t bytes)
+{
+  uint8_t type = 0;
+
+  while (_chunk_capacity(cache, type) < bytes) ++type;
+  return type;
+}
+
+
+// number of chunks in a page of <type>
+static inline
+uint32_t _page_chunks_count(mmap_cache_t* cache, uint8_t type)
+{
+  return cache->classes[type].chunks;
+}
+
+
+// non-zero if <chunk> of <page> exists
+static
+int _chunk_valid(mmap_cache_t* cache, uint32_t page, uint32_t chunk)
+{
+  uint8_t type = 0;
+
+  if (page >= cache->cache_info->page_count)    return 0;
+  type = cache->page_infos[page].type;
+  if (type >= cache->page_types)                return 0;
+  if (chunk >= _page_chunks_count(cache, type)) return 0;
+
+  return 1;
+}
+
+
+// Non-zero if a used <entry> found in <bucket> looks sane.
+// The value's segments are checked when walking the chain.
+static
+int _hash_entry_valid(mmap_cache_t* cache, hash_entry_t* entry, uint32_t bucket)
+{
+  uint32_t page = _entry_page(cache, entry);
+
+  if (_hash_bucket_index(_entry_hash(cache, entry), cache->cache_info->hash_buckets) != bucket) return 0;
+  if (_entry_inline(cache, entry)) {
+    return (uint64_t)_entry_keysize(cache, entry) + _entry_bytes(cache, entry) <= HASH_INLINE_BYTES;
+  }
+  if (!_chunk_valid(cache, page, _entry_chunk(cache, entry)))                               return 0;
+  if (_entry_keysize(cache, entry) > _chunk_capacity(cache, cache->page_infos[page].type)) return 0;
+
+  return 1;
+}
+
+
+// address of <chunk> in <page>
+static
+uint8_t* _chunk_at(mmap_cache_t* cache, uint32_t page, uint32_t chunk)
+{
+  uint8_t type = cache->page_infos[page].type;
+
+  return (uint8_t*)cache->map_data + (size_t)page * DATA_PAGE_SIZE + (size_t)chunk * cache->classes[type].size;
+}
+
+
+// address of the key of the entry at LRU <index> (<entry>), followed by its
+// payload: its inline data, or its first chunk
+static
+uint8_t* _hash_entry_key(mmap_cache_t* cache, uint64_t index, hash_entry_t* entry)
+{
+  if (_entry_inline(cache, entry)) return _hash_inline_at(cache, index);
+  return _chunk_at(cache, _entry_page(cache, entry), _entry_chunk(cache, entry));
+}
+
+
+// type of the first chunk of <entry>, which picks its LRU lists
+// (<page_types> for inline entries)
+static inline
+uint8_t _entry_type(mmap_cache_t* cache, hash_entry_t* entry)
+{
+  if (_entry_inline(cache, entry)) return (uint8_t)cache->page_types;
+  return cache->page_infos[_entry_page(cache, entry)].type;
+}
+
+
+// seconds from the time origin
+static inline
+uint32_t _cache_now(mmap_cache_t* cache)
+{
+  return (uint32_t)(time(NULL) - cache->cache_info->time_origin);
+}
+
+
+// non-zero if <entry> has expired at <now> (seconds from the time origin)
+static
+int _hash_entry_expired(mmap_cache_t* cache, hash_entry_t* entry, uint32_t now)
+{
+  uint32_t expiry = _entry_expiry(cache, entry);
+
+  return expiry != HASH_EXPIRY_NONE && expiry <= now;
+}
+
+
+// Look up the entry for <key> (<keysize> bytes, hashing to <hash>, with
+// <fingerprint>) in <bucket>, and set <index> to its LRU index.
+// Key sizes and fingerprints are compared first, so the data page is only
+// read for entries whose hash, size and fingerprint all match (and that pass
+// validation, as optimistic readers may see torn entries).
+// Returns 0 on success, ENOENT if there is no such entry.
+static
+int _hash_lookup(mmap_cache_t* cache, uint32_t bucket, uint32_t hash, uint8_t fingerprint, const void* key, int keysize, uint64_t* index)
+{
+  uint64_t      slots[HASH_SLOTS_MAX];
+  int           count = _hash_bucket_find(cache, bucket, hash, fingerprint, slots);
+  hash_entry_t* entry = NULL;
+  uint8_t*      print = NULL;
+
+  for (int k = 0; k < count; ++k) {
+    entry = _hash_entry_at(cache, slots[k]);
+    if (_entry_keysize(cache, entry) != (uint32_t)keysize) continue;
+    print = _hash_fingerprint_at(cache, slots[k]);
+    if (print != NULL && *print != fingerprint) continue;
+    if (!_hash_entry_valid(cache, entry, bucket)) continue;
+    if (memcmp(_hash_entry_key(cache, slots[k], entry), key, keysize) != 0) continue;
+    *index = slots[k];
+    return 0;
+  }
+  return ENOENT;
+}
+
+
+// Prefetch the part of <bucket> that lookups read first.
+static
+void _hash_prefetch_bucket(mmap_cache_t* cache, uint32_t bucket)
+{
+  if (_hash_aligned(cache))     __builtin_prefetch(_hash_aligned_bucket(cache, bucket));
+  else if (_hash_tagged(cache)) __builtin_prefetch(cache->hash_groups[bucket].tags);
+  else                          __builtin_prefetch(&cache->hash_table[bucket]);
+}
+
+
+// Prefetch the chunks of the entries of <bucket> that may hold the key of
+// <hash> and <fingerprint>.
+// Works without locking: entries are only validated.
+static
+void _hash_prefetch_chunks(mmap_cache_t* cache, uint32_t bucket, uint32_t hash, uint8_t fingerprint)
+{
+  uint64_t      slots[HASH_SLOTS_MAX];
+  int           count = _hash_bucket_find(cache, bucket, hash, fingerprint, slots);
+  hash_entry_t* entry = NULL;
+  uint8_t*      print = NULL;
+
+  for (int k = 0; k < count; ++k) {
+    entry = _hash_entry_at(cache, slots[k]);
+    print = _hash_fingerprint_at(cache, slots[k]);
+    if (print != NULL && *print != fingerprint) continue;
+    if (!_hash_entry_valid(cache, entry, bucket)) continue;
+    __builtin_prefetch(_hash_entry_key(cache, slots[k], entry));
+  }
+}
+
+
+// LRU list of the entry at <index> (see "Hash table" in common.h)
+static inline
+lru_list_t* _lru_list(mmap_cache_t* cache, uint64_t index)
+{
+  uint8_t type = _entry_type(cache, _hash_entry_at(cache, index));
+
+  if (_refs_get(cache, index) & REFS_MAIN) return &cache->lru_lists[type];
+  return &cache->lru_lists[cache->page_lists_count + type];
+}
+
+
+// number of entries of <type>, in both its lists
+static inline
+uint64_t _lru_entries(mmap_cache_t* cache, uint8_t type)
+{
+  return cache->lru_lists[type].entries + cache->lru_lists[cache->page_lists_count + type].entries;
+}
+
+
+// Move the entry at LRU index <from> to the unused entry at <to>, keeping
+// its place in the LRU list.
+// Call with the meta lock held.
+static
+void _hash_entry_move(mmap_cache_t* cache, uint64_t from, uint64_t to)
+{
+  lru_list_t*   list  = NULL;
+  hash_entry_t* src   = _hash_entry_at(cache, from);
+  hash_entry_t* dst   = _hash_entry_at(cache, to);
+  hash_entry_t* older = NULL;
+  hash_entry_t* newer = NULL;
+
+  _entry_copy(cache, dst, src);
+  if (_entry_inline(cache, src)) memcpy(_hash_inline_at(cache, to), _hash_inline_at(cache, from), HASH_INLINE_BYTES);
+  // (in the tagged layout, the tag may be the key's fingerprint)
+  if (_hash_tagged(cache)) *_hash_tag_at(cache, to) = *_hash_tag_at(cache, from);
+  else if (_hash_fingerprinted(cache)) *_hash_fingerprint_at(cache, to) = *_hash_fingerprint_at(cache, from);
+  _refs_set(cache, to, _refs_get(cache, from));
+  list  = _lru_list(cache, to);
+  older = _hash_entry_at(cache, _entry_older(cache, dst));
+  newer = _hash_entry_at(cache, _entry_newer(cache, dst));
+
+  if (older != NULL) _entry_set_newer(cache, older, to);
+  else               list->oldest = to;
+  if (newer != NULL) _entry_set_older(cache, newer, to);
+  else               list->newest = to;
+
+  _hash_entry_clear(cache, from);
+}
+
+
+// Remove the entry at LRU <index> from its LRU list (as per its current
+// first segment and reference bits).
+// Call with the meta lock held.
+static
+void _lru_unlink(mmap_cache_t* cache, uint64_t index)
+{
+  hash_entry_t* entry = _hash_entry_at(cache, index);
+  lru_list_t*   list  = _lru_list(cache, index);
+  uint64_t      prev  = _entry_older(cache, entry);
+  uint64_t      next  = _entry_newer(cache, entry);
+  hash_entry_t* older = _hash_entry_at(cache, prev);
+  hash_entry_t* newer = _hash_entry_at(cache, next);
+
+  // takes effect through the forward link
+  if (older != NULL) _entry_set_newer(cache, older, next);
+  else               list->oldest = next;
+  if (newer != NULL) _entry_set_older(cache, newer, prev);
+  else               list->newest = prev;
+  --list->entries;
+}
+
+
+// Add the entry at LRU <index> at the newest end of its LRU list.
+// Call with the meta lock held.
+static
+void _lru_append(mmap_cache_t* cache, uint64_t index)
+{
+  hash_entry_t* entry  = _hash_entry_at(cache, index);
+  lru_list_t*   list   = _lru_list(cache, index);
+  hash_entry_t* newest = _hash_entry_at(cache, list->newest);
+
+  _entry_set_older(cache, entry, list->newest);
+  _entry_set_newer(cache, entry, HASH_ENTRY_NONE);
+  if (newest != NULL) _entry_set_newer(cache, newest, index);
+  else                list->oldest = index;
+  list->newest = index;
+  ++list->entries;
+}
+
+
+// Move the entry at LRU <index> to the newest end of its LRU list.
+// Call with the meta lock held.
+static
+void _lru_touch(mmap_cache_t* cache, uint64_t index)
+{
+  if (_entry_newer(cache, _hash_entry_at(cache, index)) == HASH_ENTRY_NONE) return;
+  _lru_unlink(cache, index);
+  _lru_append(cache, index);
+}
+
+// Start time of this process (see <lease_started>), worked out again in
+// children forked since it last was.
+static
+uint64_t _cache_started(mmap_cache_t* cache)
+{
+  pid_t pid = getpid();
+
+  if (cache->pid != pid) {
+    cache->started = lease_started(pid);
+    cache->pid     = pid;
+  }
+  return cache->started;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Deferred promotion (see "Deferred promotion" in common.h)
+
+#define _PROMOTE_HIT(_INDEX,_HASH) ((uint64_t)(_INDEX) | ((uint64_t)((_HASH) & 0xFFFFFF) << 40))
+#define _PROMOTE_INDEX(_HIT)       ((_HIT) & 0xFFFFFFFFFFULL)
+#define _PROMOTE_HASH(_HIT)        ((uint32_t)((_HIT) >> 40))
+
+
+// bytes of the promotion rings of a cache
+static
+uint64_t _promote_rings_bytes(cache_info_t* info)
+{
+  if (info->eviction != CACHE_EVICTION_LRU) return 0;
+  return sizeof(promote_ring_t) * PROMOTE_RINGS;
+}
+
+
+// Record a hit on the entry at LRU <index>, for <hash>, in the ring of
+// this process. Works without locking.
+// Returns 0 on success, ENOSPC if the ring is full (the hit is dropped).
+static
+int _promote_record(mmap_cache_t* cache, uint64_t index, uint32_t hash)
+{
+  promote_ring_t* ring = &cache->promote_rings[cache->promote_ring];
+  uint64_t        bit  = 1ULL << cache->promote_ring;
+  uint32_t        head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+  do if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= PROMOTE_RING_SLOTS) return ENOSPC;
+  while (!__atomic_compare_exchange_n(&ring->head, &head, head + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  __atomic_store_n(&ring->hits[head % PROMOTE_RING_SLOTS], _PROMOTE_HIT(index, hash), __ATOMIC_RELEASE);
+  // (the flag is seldom cleared: mostly read only)
+  if (!(__atomic_load_n(&cache->cache_info->promote_pending, __ATOMIC_RELAXED) & bit)) {
+    __atomic_fetch_or(&cache->cache_info->promote_pending, bit, __ATOMIC_RELEASE);
+  }
+  return 0;
+}
+
+
+// Move the entries of <count> <hits> to the newest end of their LRU list,
+// in order but only once each (as of their last hit).
+// Call with the meta lock held.
+static
+void _promote_apply(mmap_cache_t* cache, uint64_t* hits, int count)
+{
+  // open addressing set of the entries seen, from the last hit back
+  uint64_t      seen[2 * PROMOTE_RING_SLOTS];
+  uint32_t      slot  = 0;
+  hash_entry_t* entry = NULL;
+
+  memset(seen, 0xFF, sizeof(seen));
+  for (int k = count - 1; k >= 0; --k) {
+    slot = (uint32_t)((_PROMOTE_INDEX(hits[k]) * 0x9E3779B97F4A7C15ULL) >> 32) % (2 * PROMOTE_RING_SLOTS);
+    while (seen[slot] != PROMOTE_HIT_NONE && seen[slot] != _PROMOTE_INDEX(hits[k])) {
+      slot = (slot + 1) % (2 * PROMOTE_RING_SLOTS);
+    }
+    if (seen[slot] == PROMOTE_HIT_NONE) seen[slot] = _PROMOTE_INDEX(hits[k]);
+    else                                hits[k]    = PROMOTE_HIT_NONE;
+  }
+
+  for (int k = 0; k < count; ++k) {
+    if (hits[k] == PROMOTE_HIT_NONE) continue;
+    entry = _hash_entry_at(cache, _PROMOTE_INDEX(hits[k]));
+    if (entry == NULL || _entry_hash(cache, entry) == HASH_UNUSED)   continue;
+    if ((_entry_hash(cache, entry) & 0xFFFFFF) != _PROMOTE_HASH(hits[k])) continue;
+    _lru_touch(cache, _PROMOTE_INDEX(hits[k]));
+  }
+}
+
+
+// Apply up to <budget> pending hits, from the rings flagged in
+// <promote_pending>. Returns the number of hits applied.
+// Call with the meta lock held.
+static
+int _promote_drain(mmap_cache_t* cache, int budget)
+{
+  cache_info_t*   info    = cache->cache_info;
+  uint64_t        pending = 0;
+  uint64_t        hits[PROMOTE_RING_SLOTS];
+  promote_ring_t* ring    = NULL;
+  uint32_t        head    = 0;
+  uint32_t        tail    = 0;
+  int             count   = 0;
+  int             done    = 0;
+  int             k       = 0;
+
+  if (cache->promote_rings == NULL) return 0;
+  pending = __atomic_load_n(&info->promote_pending, __ATOMIC_ACQUIRE);
+
+  for (; pending != 0 && done < budget; pending &= pending - 1) {
+    k    = __builtin_ctzll(pending);
+    ring = &cache->promote_rings[k];
+    // (cleared first: hits recorded from now on flag the ring again)
+    __atomic_fetch_and(&info->promote_pending, ~(1ULL << k), __ATOMIC_ACQ_REL);
+    head  = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    tail  = ring->tail;
+    count = 0;
+
+    // stop at slots reserved but not written yet
+    while (tail != head && done + count < budget) {
+      hits[count] = __atomic_load_n(&ring->hits[tail % PROMOTE_RING_SLOTS], __ATOMIC_ACQUIRE);
+      if (hits[count] == PROMOTE_HIT_NONE) break;
+      __atomic_store_n(&ring->hits[tail % PROMOTE_RING_SLOTS], PROMOTE_HIT_NONE, __ATOMIC_RELAXED);
+      ++count;
+      ++tail;
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    if (tail != head) __atomic_fetch_or(&info->promote_pending, 1ULL << k, __ATOMIC_RELEASE);
+
+    _promote_apply(cache, hits, count);
+    done += count;
+  }
+  return done;
+}
+
+
+// Claim a promotion ring for this process: a free one, or one whose owner
+// died (its pending hits are still good). Leaves <promote_ring> at -1 if
+// there are none.
+// Call with the meta lock held.
+static
+void _promote_claim(mmap_cache_t* cache)
+{
+  promote_ring_t* ring = NULL;
+
+  cache->promote_ring = -1;
+  if (cache->promote_rings == NULL) return;
+
+  for (int k = 0; k < PROMOTE_RINGS; ++k) {
+    ring = &cache->promote_rings[k];
+    if (ring->pid != PROMOTE_RING_FREE && lease_alive(ring->pid, ring->started)) continue;
+    ring->started = _cache_started(cache);
+    ring->pid     = cache->pid;
+    cache->promote_ring = k;
+    return;
+  }
+}
+
+
+// Free the ring of this process, if any (its pending hits stay flagged).
+// Call with the meta lock held.
+static
+void _promote_release(mmap_cache_t* cache)
+{
+  if (cache->promote_ring < 0) return;
+
+  cache->promote_rings[cache->promote_ring].pid = PROMOTE_RING_FREE;
+  cache->promote_ring = -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Expiry wheel
+
+// shift from a bucket to its region (see "Expiry" in common.h)
+static inline
+uint32_t _wheel_region_shift(mmap_cache_t* cache)
+{
+  uint8_t order = cache->cache_info->hash_table_max_size;
+
+  return (order > WHEEL_REGIONS_ORDER) ? order - WHEEL_REGIONS_ORDER : 0;
+}
+
+
+// low bits of a time telling apart the seconds of a level <_LEVEL> slot
+#define _WHEEL_SHIFT(_LEVEL) (WHEEL_TICK_ORDER + WHEEL_SLOTS_ORDER * (_LEVEL))
+
+// the slot an entry of <bucket> expiring at <expiry> is recorded in
+static
+wheel_slot_t* _wheel_slot(mmap_cache_t* cache, uint32_t bucket, uint32_t expiry)
+{
+  cache_info_t* info  = cache->cache_info;
+  uint32_t      time  = info->wheel_time;
+  uint32_t      shift = _wheel_region_shift(cache);
+  uint32_t      level = 0;
+
+  // entries already due go in the tick being reaped, or the next one if
+  // the reaper is done with their region
+  if (expiry < time) expiry = time;
+  if (
+    expiry < time + WHEEL_TICK && info->wheel_level == 0 && info->wheel_bucket > 0 &&
+    (bucket >> shift) <= ((info->wheel_bucket - 1) >> shift)
+  ) expiry = time + WHEEL_TICK;
+
+  while (level < WHEEL_LEVELS - 1 && (expiry >> _WHEEL_SHIFT(level + 1)) != (time >> _WHEEL_SHIFT(level + 1))) {
+    ++level;
+  }
+  return &cache->wheel[level * WHEEL_SLOTS + ((expiry >> _WHEEL_SHIFT(level)) & (WHEEL_SLOTS - 1))];
+}
+
+
+// Record that <bucket> holds an entry expiring at <expiry>.
+// Call with the meta lock held.
+static
+void _wheel_mark(mmap_cache_t* cache, uint32_t bucket, uint32_t expiry)
+{
+  wheel_slot_t* slot   = _wheel_slot(cache, bucket, expiry);
+  uint32_t      region = bucket >> _wheel_region_shift(cache);
+
+  slot->regions[region / 64] |= 1ULL << (region % 64);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Hash table growth
+
+// non-zero if the load (or its variance) calls for more buckets
+static
+int _hash_should_grow(mmap_cache_t* cache)
+{
+  cache_info_t* info     = cache->cache_info;
+  double        buckets  = info->hash_buckets;
+  double        load     = info->entries_used / buckets;
+  double        variance = info->entries_squared / buckets - load * load;
+
+  if (info->hash_buckets >= (1ULL << info->hash_table_max_size)) return 0;
+  if (load > HASH_LOAD_MAX) return 1;
+  if (variance > 0 && load + sqrt(variance) > HASH_LOAD_STDDEV_MAX) return 1;
+  return 0;
+}
+
+
+// Split the next bucket, <source>, into itself and a new bucket.
+// Call with the write lock of <source>'s stripe and the meta lock held.
+// Returns 0 on success, ENOMEM if an extent is needed and none is free.
+static
+int _hash_split(mmap_cache_t* cache, uint32_t source)
+{
+  int           res     = 0;
+  cache_info_t* info    = cache->cache_info;
+  uint32_t      target  = info->hash_buckets;
+  uint32_t      mask    = (2U << info->hash_table_size) - 1;
+  uint32_t      primary = _hash_bucket_slots_count(cache);
+  uint32_t      extent  = HASH_EXTENT_NONE;
+  uint64_t      from[HASH_SLOTS_MAX];
+  uint64_t      to[HASH_SLOTS_MAX];
+  int           slots   = 0;
+  int           slot    = 0;
+  uint64_t      count   = 0;
+  uint64_t      moving  = 0;
+  hash_entry_t* entry   = NULL;
+
+  // count entries before and after the split
+  slots = _hash_bucket_slots(cache, source, from);
+  for (int k = 0; k < slots; ++k) {
+    entry = _hash_entry_at(cache, from[k]);
+    if (_entry_hash(cache, entry) == HASH_UNUSED) continue;
+    ++count;
+    if ((_entry_hash(cache, entry) & mask) == target) ++moving;
+  }
+
+  // the new bucket lives in the sparse part of the file
+  _hash_bucket_init(cache, target);
+  if (moving > primary) {
+    res = _hash_extent_alloc(cache, &extent);
+    if (res) goto cleanup;
+    _hash_bucket_set_extent(cache, target, extent);
+  }
+
+  // from now on, entries left behind that belong to <target> are invalid
+  __atomic_store_n(&info->hash_buckets, target + 1, __ATOMIC_RELEASE);
+  if ((target + 1) == (2U << info->hash_table_size)) ++info->hash_table_size;
+
+  _hash_bucket_slots(cache, target, to);
+  for (int k = 0; k < slots; ++k) {
+    entry = _hash_entry_at(cache, from[k]);
+    if (_entry_hash(cache, entry) == HASH_UNUSED || (_entry_hash(cache, entry) & mask) != target) continue;
+    if (_entry_expiry(cache, entry) != HASH_EXPIRY_NONE) _wheel_mark(cache, target, _entry_expiry(cache, entry));
+    _hash_entry_move(cache, from[k], to[slot++]);
+  }
+
+  // give back the source extent if the bucket itself is enough
+  extent = _hash_bucket_extent(cache, source);
+  if (extent != HASH_EXTENT_NONE && count - moving <= primary) {
+    slot = 0;
+    for (int k = primary; k < slots; ++k) {
+      if (_entry_hash(cache, _hash_entry_at(cache, from[k])) == HASH_UNUSED) continue;
+      while (_entry_hash(cache, _hash_entry_at(cache, from[slot])) != HASH_UNUSED) ++slot;
+      _hash_entry_move(cache, from[k], from[slot]);
+    }
+    _hash_bucket_set_extent(cache, source, HASH_EXTENT_NONE);
+    res = _hash_extent_free(cache, extent);
+  }
+
+  info->entries_squared += (count - moving) * (count - moving) + moving * moving - count * count;
+
+cleanup:
+  return res;
+}
+
+
+// Split up to HASH_SPLIT_STEP buckets if the table needs to grow.
+// Call without holding any lock.
+static
+int _hash_grow_step(mmap_cache_t* cache)
+{
+  int           res     = 0;
+  cache_info_t* info    = cache->cache_info;
+  uint32_t      source  = 0;
+  uint32_t      buckets = 0;
+
+  for (int k = 0; k < HASH_SPLIT_STEP; ++k) {
+    if (!_hash_should_grow(cache)) break;
+
+    // the bucket to split depends on <hash_buckets>, which may change
+    // until we hold the meta lock
+    buckets = __atomic_load_n(&info->hash_buckets, __ATOMIC_ACQUIRE);
+    source  = buckets - (1U << (31 - __builtin_clz(buckets)));
+
+    res = lock_acquire_write(&cache->locks, source);
+    if (res) goto cleanup;
+    res = lock_acquire_meta(&cache->locks);
+    if (res) { lock_release(&cache->locks, source); goto cleanup; }
+
+    if (info->hash_buckets == buckets && _hash_should_grow(cache)) {
+      res = _hash_split(cache, source);
+    }
+
+    lock_release_meta(&cache->locks);
+    lock_release(&cache->locks, source);
+
+    // growth is best effort: buckets may still fill up their extent
+    if (res == ENOMEM) {
+      LOG("cannot split bucket %u: no free extent\n", source);
+      res = 0;
+      break;
+    }
+    if (res) goto cleanup;
+  }
+
+cleanup:
+  return res;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Data chunks
+
+
+// List <info>'s page belongs in, if it has free chunks and is not draining.
+static inline
+page_list_t* _page_list(mmap_cache_t* cache, page_info_t* info)
+{
+  if (info->type == PAGE_TYPE_UNUSED) return &cache->page_lists[cache->page_types];
+  return &cache->page_lists[info->type];
+}
+
+
+// Link <page> first in its list, or last if <last> is set (unless it is
+// past the end of a shrinking cache, see "Resizing").
+// Call with the meta lock held.
+static
+void _page_link(mmap_cache_t* cache, uint32_t page, int last)
+{
+  page_info_t* info = &cache->page_infos[page];
+  page_list_t* list = _page_list(cache, info);
+
+  if (page >= cache->cache_info->page_limit) return;
+  if (last) {
+    info->prev_page = list->last_page;
+    info->next_page = PAGE_NONE;
+  }
+  else {
+    info->prev_page = PAGE_NONE;
+    info->next_page = list->first_page;
+  }
+
+  if (info->prev_page != PAGE_NONE) cache->page_infos[info->prev_page].next_page = page;
+  else                              list->first_page = page;
+  if (info->next_page != PAGE_NONE) cache->page_infos[info->next_page].prev_page = page;
+  else                              list->last_page = page;
+}
+
+
+// Unlink <page> from its list.
+// Call with the meta lock held.
+static
+void _page_unlink(mmap_cache_t* cache, uint32_t page)
+{
+  page_info_t* info = &cache->page_infos[page];
+  page_list_t* list = _page_list(cache, info);
+
+  if (info->prev_page != PAGE_NONE) cache->page_infos[info->prev_page].next_page = info->next_page;
+  else                              list->first_page = info->next_page;
+  if (info->next_page != PAGE_NONE) cache->page_infos[info->next_page].prev_page = info->prev_page;
+  else                              list->last_page = info->prev_page;
+
+  info->prev_page = PAGE_NONE;
+  info->next_page = PAGE_NONE;
+}
+
+
+// Describe the free list of <page>, of a listed type, in <list>.
+static
+void _page_free_list(mmap_cache_t* cache, uint32_t page, free_list_t* list)
+{
+  page_info_t* info = &cache->page_infos[page];
+
+  list->offset_bytes  = 2;
+  list->slots_count   = _page_chunks_count(cache, info->type);
+  list->slots_free    = info->free_chunks;
+  list->slots_stride  = cache->classes[info->type].size;
+  list->head_slot_ptr = (uint8_t*)info + offsetof(page_info_t, head_slot);
+  list->payload_ptr   = _chunk_at(cache, page, 0);
+}
+
+
+// non-zero if chunks of <type> are allocated through a bitmap
+static inline
+int _page_bitmapped(mmap_cache_t* cache, uint8_t type)
+{
+  return cache->classes[type].bitmapped;
+}
+
+
+// non-zero if pages of <type> keep their bitmap in page_info_t.bitmap
+static inline
+int _page_narrow(mmap_cache_t* cache, uint8_t type)
+{
+  return _page_chunks_count(cache, type) <= PAGE_NARROW_CHUNKS_MAX;
+}
+
+
+// Describe the bitmap of <page>, of a bitmapped type, in <bitmap>.
+// The narrow bitmaps of the largest types are copied to <word>, and should
+// be written back with _page_bitmap_store.
+static
+void _page_bitmap(mmap_cache_t* cache, uint32_t page, page_bitmap_t* bitmap, uint64_t* word)
+{
+  page_info_t* info = &cache->page_infos[page];
+
+  bitmap->slots_count  = _page_chunks_count(cache, info->type);
+  bitmap->slots_free   = info->free_chunks;
+  bitmap->slots_stride = cache->classes[info->type].size;
+  bitmap->payload_ptr  = _chunk_at(cache, page, 0);
+
+  if (_page_narrow(cache, info->type)) {
+    *word = info->bitmap;
+    bitmap->bitmap_ptr = word;
+  }
+  else {
+    bitmap->bitmap_ptr = cache->page_bitmaps[page].words;
+  }
+}
+
+
+static inline
+void _page_bitmap_store(mmap_cache_t* cache, uint32_t page, uint64_t word)
+{
+  page_info_t* info = &cache->page_infos[page];
+
+  if (_page_narrow(cache, info->type)) info->bitmap = (uint16_t)word;
+}
+
+
+// Set up unused (or empty) <page> for chunks of <type>.
+// Call with the meta lock held.
+static
+int _page_init(mmap_cache_t* cache, uint32_t page, uint8_t type)
+{
+  int           res  = 0;
+  page_info_t*  info = &cache->page_infos[page];
+  uint64_t      word = 0;
+  free_list_t   list;
+  page_bitmap_t bitmap;
+
+  _page_unlink(cache, page);
+  info->type        = type;
+  info->free_chunks = _page_chunks_count(cache, type);
+  info->flags       = 0;
+
+  if (_page_bitmapped(cache, type)) {
+    _page_bitmap(cache, page, &bitmap, &word);
+    res = page_bitmap_init(&bitmap);
+    _page_bitmap_store(cache, page, word);
+  }
+  else {
+    _page_free_list(cache, page, &list);
+    res = free_list_init(&list);
+  }
+  _page_link(cache, page, 0);
+
+  return res;
+}
+
+
+// Find a page with a free chunk of <type>, setting up an unused page if
+// needed.
+// Call with the meta lock held.
+// Returns 0 on success, ENOMEM if there is no such page.
+static
+int _page_find(mmap_cache_t* cache, uint8_t type, uint32_t* page)
+{
+  page_list_t* lists = cache->page_lists;
+  uint32_t     last  = PAGE_NONE;
+
+  if (lists[type].first_page != PAGE_NONE) {
+    *page = lists[type].first_page;
+    return 0;
+  }
+  if (lists[cache->page_types].first_page != PAGE_NONE) {
+    *page = lists[cache->page_types].first_page;
+    return _page_init(cache, *page, type);
+  }
+  // an empty page of another type is as good as unused
+  for (uint8_t t = 0; t < cache->page_types; ++t) {
+    last = lists[t].last_page;
+    if (last == PAGE_NONE || cache->page_infos[last].free_chunks != _page_chunks_count(cache, t)) continue;
+    *page = last;
+    return _page_init(cache, last, type);
+  }
+
+  errno = ENOMEM;
+  return ENOMEM;
+}
+
+
+// Allocate a chunk of <type>, returning its <page> and <chunk> index.
+// Call with the meta lock held.
+// Returns 0 on success, ENOMEM if no chunk of <type> is free.
+static
+int _chunk_alloc(mmap_cache_t* cache, uint8_t type, uint32_t* page, uint32_t* chunk)
+{
+  int           res     = 0;
+  page_info_t*  info    = NULL;
+  void*         payload = NULL;
+  uint64_t      word    = 0;
+  free_list_t   list;
+  page_bitmap_t bitmap;
+
+  res = _page_find(cache, type, page);
+  if (res) goto cleanup;
+  info = &cache->page_infos[*page];
+
+  if (_page_bitmapped(cache, type)) {
+    _page_bitmap(cache, *page, &bitmap, &word);
+    res = page_bitmap_alloc(&bitmap, &payload);
+    if (res) goto cleanup;
+    _page_bitmap_store(cache, *page, word);
+  }
+  else {
+    _page_free_list(cache, *page, &list);
+    res = free_list_alloc(&list, &payload);
+    if (res) goto cleanup;
+  }
+  *chunk = (uint32_t)(((uint8_t*)payload - _chunk_at(cache, *page, 0)) / cache->classes[type].size);
+  if (--info->free_chunks == 0) _page_unlink(cache, *page);
+
+cleanup:
+  return res;
+}
+
+
+// Give back <chunk> of <page> to the page's allocator.
+// Call with the meta lock held.
+static
+int _chunk_free(mmap_cache_t* cache, uint32_t page, uint32_t chunk)
+{
+  int           res   = 0;
+  page_info_t*  info  = &cache->page_infos[page];
+  int           full  = info->free_chunks == 0;
+  int           empty = 0;
+  uint64_t      word  = 0;
+  free_list_t   list;
+  page_bitmap_t bitmap;
+
+  if (_page_bitmapped(cache, info->type)) {
+    _page_bitmap(cache, page, &bitmap, &word);
+    res = page_bitmap_free(&bitmap, _chunk_at(cache, page, chunk));
+    if (res) goto cleanup;
+    _page_bitmap_store(cache, page, word);
+  }
+  else {
+    _page_free_list(cache, page, &list);
+    res = free_list_free(&list, _chunk_at(cache, page, chunk));
+    if (res) goto cleanup;
+  }
+  ++info->free_chunks;
+  empty = info->free_chunks == _page_chunks_count(cache, info->type);
+
+  if (info->flags & PAGE_FLAG_DRAINING) {
+    // a drained page is up for grabs
+    if (!empty) goto cleanup;
+    info->type  = PAGE_TYPE_UNUSED;
+    info->flags = 0;
+    --cache->cache_info->pages_draining;
+    _page_link(cache, page, 0);
+  }
+  else if (empty) {
+    if (!full) _page_unlink(cache, page);
+    _page_link(cache, page, 1);
+  }
+  else if (full) _page_link(cache, page, 0);
+
+cleanup:
+  return res;
+}
+
+
+// <reclaim> callback for the lease table
+static
+int _chunk_reclaim(void* context, uint32_t page, uint32_t chunk)
+{
+  return _chunk_free((mmap_cache_t*)context, page, chunk);
+}
+
+
+// Let go of <chunk> of <page>, which no entry refers to anymore: free it,
+// unless a reader has it pinned (the last unpin frees it then).
+// Call with the meta lock held.
+static
+int _chunk_retire(mmap_cache_t* cache, uint32_t page, uint32_t chunk)
+{
+  int res    = 0;
+  int pinned = 0;
+
+  res = lease_retire(&cache->leases, page, chunk, &pinned);
+  if (res || pinned) goto cleanup;
+  res = _chunk_free(cache, page, chunk);
+
+cleanup:
+  return res;
+}
+
+
+// Pin <chunk> of <page> for this process, sweeping the leases of dead
+// processes if the lease table is full.
+static
+int _chunk_pin(mmap_cache_t* cache, uint32_t page, uint32_t chunk)
+{
+  int res = 0;
+
+  res = lock_acquire_meta(&cache->locks);
+  if (res) goto cleanup;
+
+  res = lease_pin(&cache->leases, page, chunk, cache->pid, _cache_started(cache));
+  if (res == ENOSPC) {
+    res = lease_sweep(&cache->leases, _chunk_reclaim, cache);
+    if (res == 0) res = lease_pin(&cache->leases, page, chunk, cache->pid, cache->started);
+  }
+
+  lock_release_meta(&cache->locks);
+
+cleanup:
+  return res;
+}
+
+
+// Unpin <chunk> of <page>, freeing it if it was retired meanwhile.
+static
+int _chunk_unpin(mmap_cache_t* cache, uint32_t page, uint32_t chunk)
+{
+  int res     = 0;
+  int reclaim = 0;
+
+  res = lock_acquire_meta(&cache->locks);
+  if (res) goto cleanup;
+
+  res = lease_unpin(&cache->leases, page, chunk, cache->pid, _cache_started(cache), &reclaim);
+  if (res == 0 && reclaim) res = _chunk_free(cache, page, chunk);
+
+  lock_release_meta(&cache->locks);
+
+cleanup:
+  return res;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Chained values
+
+#define _SEGMENT_LINK(_PAGE,_CHUNK) ((uint64_t)(_PAGE) | ((uint64_t)(_CHUNK) << 24))
+#define _SEGMENT_PAGE(_LINK)        ((uint32_t)((_LINK) & 0xFFFFFF))
+#define _SEGMENT_CHUNK(_LINK)       ((uint32_t)((_LINK) >> 24))
+
+
+// Link in the EXT footer of <chunk> of <page> to the next segment of its
+// value, SEGMENT_NONE if it is the last one (or has no footer).
+static
+uint64_t _chunk_link(mmap_cache_t* cache, uint32_t page, uint32_t chunk)
+{
+  uint8_t  type   = cache->page_infos[page].type;
+  uint8_t* footer = _chunk_at(cache, page, chunk) + _chunk_capacity(cache, type);
+  uint64_t link   = 0;
+
+  if (!cache->classes[type].chained) return SEGMENT_NONE;
+  for (int k = 4; k >= 0; --k) link = (link << 8) | footer[k];
+  return link;
+}
+
+
+static
+void _chunk_set_link(mmap_cache_t* cache, uint32_t page, uint32_t chunk, uint64_t link)
+{
+  uint8_t  type   = cache->page_infos[page].type;
+  uint8_t* footer = _chunk_at(cache, page, chunk) + _chunk_capacity(cache, type);
+
+  if (!cache->classes[type].chained) return;
+  for (int k = 0; k < 5; ++k, link >>= 8) footer[k] = (uint8_t)link;
+}
+
+
+// Fill <types> with the chunk types of the segments to hold <keysize> bytes
+// of key and <bytes> of value, and return the number of segments.
+static
+int _segment_plan(mmap_cache_t* cache, uint32_t keysize, uint32_t bytes, uint8_t* types)
+{
+  int      count = 0;
+  uint8_t  type  = 0;
+  uint8_t  last  = (uint8_t)(cache->page_types - 1);
+  uint32_t left  = keysize + bytes;
+  uint32_t size  = 0;
+
+  while (left > _chunk_capacity(cache, last)) {
+    types[count++] = last;
+    left -= _chunk_capacity(cache, last);
+  }
+
+  // split off a full chunk of the type below while the tail would waste too
+  // much of its chunk
+  for (;;) {
+    type = _chunk_type(cache, left);
+    size = cache->classes[type].size;
+    if (type == 0 || !cache->classes[type - 1].chained)                     break;
+    if (size - left <= size / SEGMENT_WASTE_RATIO)                          break;
+    if (count == 0 && _chunk_capacity(cache, type - 1) < keysize)           break;
+    types[count++] = type - 1;
+    left -= _chunk_capacity(cache, type - 1);
+  }
+  types[count++] = type;
+  return count;
+}
+
+
+// Allocate chunks of <types> for <count> segments, setting <links> to them.
+// On failure, frees the chunks allocated so far and sets <failed> to the type
+// that could not be allocated.
+// Call with the meta lock held.
+static
+int _chain_alloc(mmap_cache_t* cache, const uint8_t* types, int count, uint64_t* links, uint8_t* failed)
+{
+  int      res   = 0;
+  uint32_t page  = 0;
+  uint32_t chunk = 0;
+
+  for (int k = 0; k < count; ++k) {
+    res = _chunk_alloc(cache, types[k], &page, &chunk);
+    if (res) {
+      *failed = types[k];
+      while (k-- > 0) _chunk_free(cache, _SEGMENT_PAGE(links[k]), _SEGMENT_CHUNK(links[k]));
+      goto cleanup;
+    }
+    links[k] = _SEGMENT_LINK(page, chunk);
+  }
+
+cleanup:
+  return res;
+}
+
+
+// Write the key and value of <entry> to the <count> segments at <links>, and
+// return the number of value bytes in the last one.
+static
+uint32_t _chain_fill(mmap_cache_t* cache, cache_entry_t* entry, const uint64_t* links, int count)
+{
+  const uint8_t* value = (const uint8_t*)entry->value;
+  uint32_t       left  = entry->bytes;
+  uint32_t       room  = 0;
+  uint32_t       page  = 0;
+  uint32_t       chunk = 0;
+  uint8_t*       data  = NULL;
+
+  for (int k = 0; k < count; ++k) {
+    page  = _SEGMENT_PAGE(links[k]);
+    chunk = _SEGMENT_CHUNK(links[k]);
+    data  = _chunk_at(cache, page, chunk);
+    room  = _chunk_capacity(cache, cache->page_infos[page].type);
+
+    if (k == 0) {
+      memcpy(data, entry->key, entry->keysize);
+      data += entry->keysize;
+      room -= entry->keysize;
+    }
+    if (room > left) room = left;
+    memcpy(data, value, room);
+    value += room;
+    left  -= room;
+
+    _chunk_set_link(cache, page, chunk, (k + 1 < count) ? links[k + 1] : SEGMENT_NONE);
+  }
+  return room;
+}
+
+
+// Walk the segments of <entry>, adding up the size of their chunks in
+// <chunk_bytes> and of the value in <value_bytes>, and copying the value to
+// <dst> unless NULL (failing rather than writing more than <dst_size>).
+// Safe on torn entries and chains.
+// Returns 0 on success, ENOENT if the chain does not add up.
+static
+int _chain_walk(mmap_cache_t* cache, hash_entry_t* entry, uint8_t* dst, uint64_t dst_size, uint64_t* value_bytes, uint64_t* chunk_bytes)
+{
+  uint64_t link  = _SEGMENT_LINK(_entry_page(cache, entry), _entry_chunk(cache, entry));
+  uint64_t next  = SEGMENT_NONE;
+  uint32_t skip  = _entry_keysize(cache, entry);
+  uint32_t room  = 0;
+  uint32_t bytes = 0;
+
+  *value_bytes = 0;
+  *chunk_bytes = 0;
+
+  for (int k = 0; k < SEGMENTS_MAX; ++k) {
+    if (!_chunk_valid(cache, _SEGMENT_PAGE(link), _SEGMENT_CHUNK(link))) return ENOENT;
+
+    room  = _chunk_capacity(cache, cache->page_infos[_SEGMENT_PAGE(link)].type);
+    next  = _chunk_link(cache, _SEGMENT_PAGE(link), _SEGMENT_CHUNK(link));
+    if (skip > room) return ENOENT;
+    bytes = (next == SEGMENT_NONE) ? _entry_bytes(cache, entry) : room - skip;
+    if (skip + bytes > room) return ENOENT;
+
+    if (dst != NULL) {
+      if (*value_bytes + bytes > dst_size) return ENOENT;
+      memcpy(dst + *value_bytes, _chunk_at(cache, _SEGMENT_PAGE(link), _SEGMENT_CHUNK(link)) + skip, bytes);
+    }
+    *value_bytes += bytes;
+    *chunk_bytes += cache->classes[cache->page_infos[_SEGMENT_PAGE(link)].type].size;
+
+    if (next == SEGMENT_NONE) return 0;
+    link = next;
+    skip = 0;
+  }
+  return ENOENT;
+}
+
+
+// Retire all chunks of the chain starting at <chunk> of <page>.
+// Call with the meta lock held.
+static
+int _chain_retire(mmap_cache_t* cache, uint32_t page, uint32_t chunk)
+{
+  int      res  = 0;
+  uint64_t link = _SEGMENT_LINK(page, chunk);
+  uint64_t next = SEGMENT_NONE;
+
+  for (int k = 0; k < SEGMENTS_MAX && link != SEGMENT_NONE; ++k) {
+    if (!_chunk_valid(cache, _SEGMENT_PAGE(link), _SEGMENT_CHUNK(link))) break;
+
+    // (read before the chunk gets freed)
+    next = _chunk_link(cache, _SEGMENT_PAGE(link), _SEGMENT_CHUNK(link));
+    res  = _chunk_retire(cache, _SEGMENT_PAGE(link), _SEGMENT_CHUNK(link));
+    if (res) goto cleanup;
+    link = next;
+  }
+
+cleanup:
+  return res;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Adding and removing entries
+
+// Add (<sign> 1) or remove (-1) the chunks of <entry> from the usage stats.
+// Call with the meta lock held.
+static
+void _hash_entry_account(mmap_cache_t* cache, hash_entry_t* entry, int sign)
+{
+  cache_info_t* info  = cache->cache_info;
+  uint64_t      value = 0;
+  uint64_t      bytes = 0;
+  uint64_t      waste = 0;
+
+  // (inline entries take no chunk)
+  if (_entry_inline(cache, entry)) return;
+  if (_chain_walk(cache, entry, NULL, 0, &value, &bytes)) return;
+  waste = bytes - _entry_keysize(cache, entry) - value;
+
+  if (sign > 0) {
+    info->bytes_used   += bytes;
+    info->bytes_wasted += waste;
+  }
+  else {
+    info->bytes_used   -= bytes;
+    info->bytes_wasted -= waste;
+  }
+}
+
+
+// number of used entries in <bucket>
+static
+uint64_t _hash_bucket_used(mmap_cache_t* cache, uint32_t bucket)
+{
+  uint64_t slots[HASH_SLOTS_MAX];
+  int      count = _hash_bucket_slots(cache, bucket, slots);
+  uint64_t used  = 0;
+
+  for (int k = 0; k < count; ++k) {
+    if (_entry_hash(cache, _hash_entry_at(cache, slots[k])) != HASH_UNUSED) ++used;
+  }
+  return used;
+}
+
+
+// Remove the entry at LRU <index> from the cache, retiring its chunk.
+// The entry is cleared first: a process dying in between leaks the chunk,
+// rather than leave an entry to it for recovery to keep.
+// Call with the write lock of the entry's stripe and the meta lock held.
+static
+int _hash_entry_remove(mmap_cache_t* cache, uint64_t index)
+{
+  int           res    = 0;
+  cache_info_t* info   = cache->cache_info;
+  hash_entry_t* entry  = _hash_entry_at(cache, index);
+  uint64_t      used   = _hash_bucket_used(cache, _hash_bucket_index(_entry_hash(cache, entry), info->hash_buckets));
+  uint64_t      link   = _entry_inline(cache, entry) ? SEGMENT_NONE : _SEGMENT_LINK(_entry_page(cache, entry), _entry_chunk(cache, entry));
+
+  _lru_unlink(cache, index);
+  _hash_entry_account(cache, entry, -1);
+  _hash_entry_clear(cache, index);
+  if (link != SEGMENT_NONE) res = _chain_retire(cache, _SEGMENT_PAGE(link), _SEGMENT_CHUNK(link));
+
+  --info->entries_used;
+  info->entries_squared -= 2 * used - 1;
+  return res;
+}
+
+
+// Find an unused entry in <bucket>, adding an extent or evicting an entry of
+// the bucket if needed, and return its LRU index in <index>. The entry is
+// counted as used.
+// Call with the write lock of the bucket's stripe and the meta lock held.
+static
+int _hash_slot_alloc(mmap_cache_t* cache, uint32_t bucket, uint64_t* index)
+{
+  int           res    = 0;
+  cache_info_t* info   = cache->cache_info;
+  uint64_t      slots[HASH_SLOTS_MAX];
+  int           count  = _hash_bucket_slots(cache, bucket, slots);
+  int           slot   = -1;
+  uint64_t      used   = 0;
+  uint32_t      extent = HASH_EXTENT_NONE;
+
+  for (int k = 0; k < count; ++k) {
+    if (_entry_hash(cache, _hash_entry_at(cache, slots[k])) != HASH_UNUSED) ++used;
+    else if (slot < 0) slot = k;
+  }
+
+  if (slot < 0 && _hash_bucket_extent(cache, bucket) == HASH_EXTENT_NONE && _hash_extent_alloc(cache, &extent) == 0) {
+    _hash_bucket_set_extent(cache, bucket, extent);
+    slot  = count;
+    count = _hash_bucket_slots(cache, bucket, slots);
+  }
+  if (slot < 0) {
+    // the bucket is full: make room
+    res = _hash_entry_remove(cache, slots[0]);
+    if (res) goto cleanup;
+    slot = 0;
+    --used;
+  }
+
+  ++info->entries_used;
+  info->entries_squared += 2 * used + 1;
+  *index = slots[slot];
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Eviction (see "Eviction" in common.h)
+
+// bytes of the ghost table or sketch of a cache
+static
+uint64_t _policy_table_bytes(cache_info_t* info)
+{
+  if (info->eviction == CACHE_EVICTION_S3FIFO)  return sizeof(uint32_t) << info->policy_table_size;
+  if (info->eviction == CACHE_EVICTION_TINYLFU) return sizeof(uint64_t) << info->policy_table_size;
+  return 0;
+}
+
+
+// highest access count of entries
+static inline
+uint8_t _policy_freq_max(mmap_cache_t* cache)
+{
+  switch (cache->cache_info->eviction) {
+    case CACHE_EVICTION_LRU:   return 0;
+    case CACHE_EVICTION_CLOCK: return 1;
+    default:                   return REFS_FREQ;
+  }
+}
+
+
+// Word of the sketch holding counter <row> of <hash>, and the counter's
+// <shift> in it.
+static inline
+uint64_t* _sketch_counter(mmap_cache_t* cache, uint32_t hash, int row, int* shift)
+{
+  static const uint64_t seeds[4] = {
+    0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL
+  };
+  uint64_t mixed = (uint64_t)hash * seeds[row];
+
+  *shift = 4 * ((mixed >> 28) & 15);
+  return &cache->sketch[mixed >> (64 - cache->cache_info->policy_table_size)];
+}
+
+
+// estimated number of accesses to <hash> (the lowest of its counters)
+static
+uint32_t _sketch_estimate(mmap_cache_t* cache, uint32_t hash)
+{
+  uint32_t count = 15;
+  uint32_t value = 0;
+  int      shift = 0;
+
+  for (int row = 0; row < 4; ++row) {
+    value = (*_sketch_counter(cache, hash, row, &shift) >> shift) & 15;
+    if (value < count) count = value;
+  }
+  return count;
+}
+
+
+// Count <count> accesses to <hash>, then halve all counters if
+// TINYLFU_SAMPLE_RATIO increments per word were counted since last time.
+// Call with the meta lock held.
+static
+void _sketch_add(mmap_cache_t* cache, uint32_t hash, uint32_t count)
+{
+  cache_info_t* info  = cache->cache_info;
+  uint64_t*     word  = NULL;
+  uint64_t      value = 0;
+  int           shift = 0;
+
+  if (count == 0) return;
+  for (int row = 0; row < 4; ++row) {
+    word  = _sketch_counter(cache, hash, row, &shift);
+    value = (*word >> shift) & 15;
+    // (counters saturate at 15)
+    *word += ((value + count > 15) ? 15 - value : count) << shift;
+  }
+
+  info->policy_count += count;
+  if (info->policy_count < ((uint32_t)TINYLFU_SAMPLE_RATIO << info->policy_table_size)) return;
+  for (uint64_t k = 0; k < (1ULL << info->policy_table_size); ++k) {
+    cache->sketch[k] = (cache->sketch[k] >> 1) & 0x7777777777777777ULL;
+  }
+  info->policy_count /= 2;
+}
+
+
+// estimated number of accesses to the entry at LRU <index> with
+// CACHE_EVICTION_TINYLFU: those before it was written, and its hits
+static
+uint32_t _sketch_estimate_entry(mmap_cache_t* cache, uint64_t index)
+{
+  return _sketch_estimate(cache, _entry_hash(cache, _hash_entry_at(cache, index))) + (_refs_get(cache, index) & REFS_FREQ);
+}
+
+
+// slot of the ghost table for <hash>
+static inline
+uint32_t* _ghost_slot(mmap_cache_t* cache, uint32_t hash)
+{
+  return &cache->ghosts[hash >> (32 - cache->cache_info->policy_table_size)];
+}
+
+
+// Move the entry at LRU <index> to the newest end of its main list, with
+// reference bits <refs> (REFS_MAIN set).
+// Call with the meta lock held.
+static
+void _lru_requeue(mmap_cache_t* cache, uint64_t index, uint8_t refs)
+{
+  _lru_unlink(cache, index);
+  _refs_set(cache, index, refs);
+  _lru_append(cache, index);
+}
+
+
+// Add the entry at LRU <index> to its LRU list, as a new entry if <fresh>
+// is set, otherwise as one with reference bits <refs> being overwritten
+// (which counts as an access).
+// Call with the meta lock held.
+static
+void _policy_insert(mmap_cache_t* cache, uint64_t index, int fresh, uint8_t refs)
+{
+  uint8_t       policy = cache->cache_info->eviction;
+  hash_entry_t* entry  = _hash_entry_at(cache, index);
+  uint32_t      hash   = _entry_hash(cache, entry);
+  uint8_t       type   = _entry_type(cache, entry);
+  lru_list_t*   window = &cache->lru_lists[cache->page_lists_count + type];
+  uint32_t*     ghost  = NULL;
+
+  if (policy == CACHE_EVICTION_TINYLFU) _sketch_add(cache, hash, 1);
+  if (!fresh) {
+    if ((refs & REFS_FREQ) < _policy_freq_max(cache)) ++refs;
+  }
+  else if (policy == CACHE_EVICTION_TINYLFU) refs = 0;
+  else if (policy != CACHE_EVICTION_S3FIFO)  refs = REFS_MAIN;
+  else {
+    // keys evicted from probation lately skip it
+    ghost = _ghost_slot(cache, hash);
+    refs  = (*ghost == hash) ? REFS_MAIN : 0;
+    if (refs) *ghost = HASH_UNUSED;
+  }
+  _refs_set(cache, index, refs);
+  _lru_append(cache, index);
+
+  // W-TinyLFU: evictions keep the window to its share once the cache is
+  // full, until then it overflows to the main list
+  if (policy == CACHE_EVICTION_TINYLFU && window->entries * TINYLFU_WINDOW_RATIO > 2 * _lru_entries(cache, type)) {
+    _lru_requeue(cache, window->oldest, REFS_MAIN | (_refs_get(cache, window->oldest) & REFS_FREQ));
+  }
+}
+
+
+// Give the main entry at LRU <index>, with reference bits <refs> (and a
+// non-zero count), another chance.
+// Call with the meta lock held.
+static
+void _evict_spare(mmap_cache_t* cache, uint64_t index, uint8_t refs)
+{
+  uint8_t freq = refs & REFS_FREQ;
+
+  switch (cache->cache_info->eviction) {
+    case CACHE_EVICTION_S3FIFO:
+      --freq;
+      break;
+    case CACHE_EVICTION_TINYLFU:
+      _sketch_add(cache, _entry_hash(cache, _hash_entry_at(cache, index)), freq);
+      freq = 0;
+      break;
+    default:
+      freq = 0;
+  }
+  _lru_requeue(cache, index, REFS_MAIN | freq);
+}
+
+
+// non-zero if the next entry of <type> to evict should come from its
+// probation list
+static
+int _evict_probation(mmap_cache_t* cache, uint8_t type)
+{
+  uint64_t probation = cache->lru_lists[cache->page_lists_count + type].entries;
+  uint64_t main      = cache->lru_lists[type].entries;
+
+  if (probation == 0) return 0;
+  if (main == 0)      return 1;
+  if (cache->cache_info->eviction == CACHE_EVICTION_S3FIFO) return probation * S3FIFO_SMALL_RATIO >= probation + main;
+  return probation * TINYLFU_WINDOW_RATIO >= probation + main;
+}
+
+
+// Pick the entry of <type> to evict as per the policy, sparing or admitting
+// EVICT_ROTATIONS_MAX entries at most on the way. Returns its LRU index,
+// HASH_ENTRY_NONE if there are no entries of <type>.
+// Call with the meta lock held.
+static
+uint64_t _evict_select(mmap_cache_t* cache, uint8_t type)
+{
+  uint8_t     policy = cache->cache_info->eviction;
+  lru_list_t* main   = &cache->lru_lists[type];
+  uint64_t    index  = HASH_ENTRY_NONE;
+  uint64_t    victim = HASH_ENTRY_NONE;
+  uint8_t     refs   = 0;
+
+  for (int k = 0; k < EVICT_ROTATIONS_MAX; ++k) {
+    if (!_evict_probation(cache, type)) {
+      index = main->oldest;
+      if (index == HASH_ENTRY_NONE) return index;
+      refs  = _refs_get(cache, index);
+      if ((refs & REFS_FREQ) == 0)  return index;
+      _evict_spare(cache, index, refs);
+      continue;
+    }
+
+    index  = cache->lru_lists[cache->page_lists_count + type].oldest;
+    refs   = _refs_get(cache, index);
+    victim = main->oldest;
+    if (policy == CACHE_EVICTION_S3FIFO) {
+      if ((refs & REFS_FREQ) == 0) return index;
+      _lru_requeue(cache, index, REFS_MAIN);
+      continue;
+    }
+
+    // W-TinyLFU: the oldest window and main entries compete, once the
+    // latter had its other chance (the main list fills up first)
+    if (victim != HASH_ENTRY_NONE && (_refs_get(cache, victim) & REFS_FREQ)) {
+      _evict_spare(cache, victim, _refs_get(cache, victim));
+      continue;
+    }
+    if (victim != HASH_ENTRY_NONE && _sketch_estimate_entry(cache, index) <= _sketch_estimate_entry(cache, victim)) return index;
+    _lru_requeue(cache, index, REFS_MAIN | (refs & REFS_FREQ));
+    if (victim != HASH_ENTRY_NONE) return victim;
+  }
+
+  // all had another chance: the oldest goes anyway
+  if (main->oldest != HASH_ENTRY_NONE) return main->oldest;
+  return cache->lru_lists[cache->page_lists_count + type].oldest;
+}
+
+
+// Record the eviction of the entry at LRU <index> (in the ghost table, if
+// on probation with CACHE_EVICTION_S3FIFO).
+// Call with the meta lock held.
+static
+void _policy_evicted(mmap_cache_t* cache, uint64_t index)
+{
+  uint32_t hash = _entry_hash(cache, _hash_entry_at(cache, index));
+
+  if (cache->cache_info->eviction != CACHE_EVICTION_S3FIFO) return;
+  if (_refs_get(cache, index) & REFS_MAIN)                   return;
+  *_ghost_slot(cache, hash) = hash;
+}
+
+
+// Find an entry to evict to free a chunk of <type>: the one the policy
+// picks among the entries whose first segment is of that type, or if there
+// are none, of the type holding the most memory; or the <skip>th newer one
+// in its list.
+// Call with the meta lock held.
+// Returns 0 on success, ENOMEM if there is none.
+static
+int _evict_candidate(mmap_cache_t* cache, uint8_t type, int skip, uint64_t* index, uint32_t* hash)
+{
+  uint64_t      bytes   = 0;
+  uint64_t      current = 0;
+  hash_entry_t* entry   = NULL;
+
+  // none of that type: freeing the most memory may empty a page
+  if (_lru_entries(cache, type) == 0) {
+    for (uint32_t t = 0; t < cache->page_types; ++t) {
+      if (_lru_entries(cache, t) * cache->classes[t].size <= bytes) continue;
+      bytes = _lru_entries(cache, t) * cache->classes[t].size;
+      type  = (uint8_t)t;
+    }
+  }
+
+  current = _evict_select(cache, type);
+  for (entry = _hash_entry_at(cache, current); entry != NULL; entry = _hash_entry_at(cache, current)) {
+    if (skip-- == 0) {
+      *index = current;
+      *hash  = _entry_hash(cache, entry);
+      return 0;
+    }
+    current = _entry_newer(cache, entry);
+  }
+
+  errno = ENOMEM;
+  return ENOMEM;
+}
+
+
+// Evict an entry to free a chunk of <type> (see <_evict_candidate>).
+// Call with the write lock of the stripe of <held> (only) held. Entries of
+// other stripes are only evicted if their lock is free.
+// Returns 0 on success, EBUSY if the candidate's stripe was busy, ENOMEM if
+// there is no candidate.
+static
+int _evict(mmap_cache_t* cache, uint32_t held, uint8_t type, int skip)
+{
+  int      res   = 0;
+  uint64_t index = 0;
+  uint32_t hash  = 0;
+  int      other = 0;
+
+  res = lock_acquire_meta(&cache->locks);
+  if (res) goto cleanup;
+  // (entries read lately should not look old)
+  _promote_drain(cache, PROMOTE_DRAIN_MAX);
+  res = _evict_candidate(cache, type, skip, &index, &hash);
+  lock_release_meta(&cache->locks);
+  if (res) goto cleanup;
+
+  other = ((hash ^ held) & ((1U << cache->locks.order) - 1)) != 0;
+  if (other) {
+    res = lock_try_write(&cache->locks, hash);
+    if (res) goto cleanup;
+  }
+
+  res = lock_acquire_meta(&cache->locks);
+  if (res == 0) {
+    // the entry may have moved while we held no lock
+    if (_entry_hash(cache, _hash_entry_at(cache, index)) == hash) {
+      _policy_evicted(cache, index);
+      res = _hash_entry_remove(cache, index);
+    }
+    lock_release_meta(&cache->locks);
+  }
+  if (other) lock_release(&cache->locks, hash);
+
+cleanup:
+  return res;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Rebalancing
+
+// Flag <page> as draining, or make it unused right away if it is empty.
+// Call with the meta lock held.
+static
+void _rebalance_drain(mmap_cache_t* cache, uint32_t page)
+{
+  page_info_t* info = &cache->page_infos[page];
+  uint32_t     used = _page_chunks_count(cache, info->type) - info->free_chunks;
+
+  LOG("draining page %u of type %u (%u chunks used)\n", page, info->type, used);
+  if (info->free_chunks > 0) _page_unlink(cache, page);
+  if (used == 0) {
+    info->type = PAGE_TYPE_UNUSED;
+    _page_link(cache, page, 0);
+    return;
+  }
+  info->flags |= PAGE_FLAG_DRAINING;
+  ++cache->cache_info->pages_draining;
+}
+
+
+// Flag the least used of the next REBALANCE_SCAN_MAX pages as draining, if
+// it is of another type than <type>, used little enough, and another page
+// of its type has room for its chunks (or at all if <type> is <starving>).
+// Call with the meta lock held.
+static
+void _rebalance_pick(mmap_cache_t* cache, uint8_t type, int starving)
+{
+  cache_info_t* info  = cache->cache_info;
+  page_info_t*  page  = NULL;
+  page_list_t*  list  = NULL;
+  uint32_t      best  = info->page_count;
+  uint32_t      count = 0;
+  uint32_t      used  = 0;
+  uint32_t      least = 0xFFFFFFFFU;
+  int           alone = 0;
+  int           fits  = 0;
+
+  for (int k = 0; k < REBALANCE_SCAN_MAX && k < (int)info->page_count; ++k) {
+    if (info->rebalance_page >= info->page_count) info->rebalance_page = 0;
+    page = &cache->page_infos[info->rebalance_page];
+
+    if (page->type < cache->page_types && page->type != type && !(page->flags & PAGE_FLAG_DRAINING)) {
+      count = _page_chunks_count(cache, page->type);
+      used  = count - page->free_chunks;
+      // chunks moved out need another page of the type with free chunks
+      list  = &cache->page_lists[page->type];
+      alone = list->first_page == PAGE_NONE ||
+              (list->first_page == info->rebalance_page && page->next_page == PAGE_NONE);
+      fits  = used == 0 || (used * REBALANCE_USED_RATIO <= count && !alone);
+      if ((starving || fits) && used < least) {
+        best  = info->rebalance_page;
+        least = used;
+      }
+    }
+    ++info->rebalance_page;
+  }
+  if (best == info->page_count) return;
+  _rebalance_drain(cache, best);
+}
+
+
+// Flag the sparsest of the next REBALANCE_SCAN_MAX pages as draining, if at
+// most 1 / COMPACT_USED_RATIO of its chunks are in use and the other partly
+// used pages of its type have room for them all (see "Compaction"); set
+// <picked> if one was.
+// Returns the number of pages looked at.
+// Call with the meta lock held.
+static
+uint32_t _compact_pick(mmap_cache_t* cache, int* picked)
+{
+  cache_info_t* info    = cache->cache_info;
+  page_info_t*  page    = NULL;
+  uint32_t      index   = 0;
+  uint32_t      best    = info->page_count;
+  uint32_t      count   = 0;
+  uint32_t      used    = 0;
+  uint32_t      room    = 0;
+  uint32_t      next    = PAGE_NONE;
+  uint32_t      least   = 0xFFFFFFFFU;
+  uint32_t      scanned = 0;
+
+  for (; scanned < REBALANCE_SCAN_MAX && scanned < info->page_count; ++scanned) {
+    if (info->rebalance_page >= info->page_count) info->rebalance_page = 0;
+    index = info->rebalance_page++;
+    page  = &cache->page_infos[index];
+
+    if (page->type >= cache->page_types || (page->flags & PAGE_FLAG_DRAINING)) continue;
+    count = _page_chunks_count(cache, page->type);
+    used  = count - page->free_chunks;
+    if (used == 0 || used * COMPACT_USED_RATIO > count || used >= least) continue;
+
+    // (empty pages come last in the list, and moving chunks there would
+    // gain nothing)
+    room = 0;
+    next = cache->page_lists[page->type].first_page;
+    for (int k = 0; k < REBALANCE_SCAN_MAX && next != PAGE_NONE && room < used; ++k) {
+      if (cache->page_infos[next].free_chunks == count) break;
+      if (next != index) room += cache->page_infos[next].free_chunks;
+      next = cache->page_infos[next].next_page;
+    }
+    if (room < used) continue;
+
+    best  = index;
+    least = used;
+  }
+
+  *picked = best != info->page_count;
+  if (*picked) _rebalance_drain(cache, best);
+  return scanned;
+}
+
+
+// non-zero if a segment of <entry> is in a draining page
+static
+int _rebalance_entry_draining(mmap_cache_t* cache, hash_entry_t* entry)
+{
+  uint64_t link = _SEGMENT_LINK(_entry_page(cache, entry), _entry_chunk(cache, entry));
+
+  if (_entry_inline(cache, entry)) return 0;
+
+  for (int k = 0; k < SEGMENTS_MAX && link != SEGMENT_NONE; ++k) {
+    if (!_chunk_valid(cache, _SEGMENT_PAGE(link), _SEGMENT_CHUNK(link))) return 0;
+    if (cache->page_infos[_SEGMENT_PAGE(link)].flags & PAGE_FLAG_DRAINING) return 1;
+    link = _chunk_link(cache, _SEGMENT_PAGE(link), _SEGMENT_CHUNK(link));
+  }
+  return 0;
+}
+
+
+// Move the segments of the entry at <index> that are in draining pages to
+// chunks of the same type elsewhere, or evict the entry if there are none.
+// Call with the write lock of the entry's stripe (only) held.
+static
+int _rebalance_entry(mmap_cache_t* cache, uint64_t index)
+{
+  int           res   = 0;
+  hash_entry_t* slot  = _hash_entry_at(cache, index);
+  uint64_t      prev  = SEGMENT_NONE;
+  uint64_t      link  = _SEGMENT_LINK(_entry_page(cache, slot), _entry_chunk(cache, slot));
+  uint32_t      page  = 0;
+  uint32_t      chunk = 0;
+  uint32_t      hash  = 0;
+  uint8_t       type  = 0;
+
+  for (int k = 0; k < SEGMENTS_MAX && link != SEGMENT_NONE; ++k) {
+    if (!(cache->page_infos[_SEGMENT_PAGE(link)].flags & PAGE_FLAG_DRAINING)) {
+      prev = link;
+      link = _chunk_link(cache, _SEGMENT_PAGE(link), _SEGMENT_CHUNK(link));
+      continue;
+    }
+    type = cache->page_infos[_SEGMENT_PAGE(link)].type;
+
+    res = lock_acquire_meta(&cache->locks);
+    if (res) goto cleanup;
+    res = _chunk_alloc(cache, type, &page, &chunk);
+    if (res == ENOMEM) res = _hash_entry_remove(cache, index);
+    lock_release_meta(&cache->locks);
+    if (res || _entry_hash(cache, slot) == HASH_UNUSED) goto cleanup;
+
+    // nobody can see the new chunk yet: copy it without the meta lock (the
+    // link to the next segment comes along)
+    memcpy(_chunk_at(cache, page, chunk),
+           _chunk_at(cache, _SEGMENT_PAGE(link), _SEGMENT_CHUNK(link)),
+           _chunk_capacity(cache, type) + (cache->classes[type].chained ? 5 : 0));
+
+    res = lock_acquire_meta(&cache->locks);
+    if (res) goto cleanup;
+    // (the entry is unused meanwhile, so that a process dying in between
+    // leaks its chunks rather than leave it with a half written link)
+    hash = _entry_hash(cache, slot);
+    _entry_set_hash(cache, slot, HASH_UNUSED);
+    if (prev == SEGMENT_NONE) _entry_set_chunk(cache, slot, page, chunk);
+    else _chunk_set_link(cache, _SEGMENT_PAGE(prev), _SEGMENT_CHUNK(prev), _SEGMENT_LINK(page, chunk));
+    _entry_set_hash(cache, slot, hash);
+    res = _chunk_retire(cache, _SEGMENT_PAGE(link), _SEGMENT_CHUNK(link));
+    lock_release_meta(&cache->locks);
+    if (res) goto cleanup;
+
+    prev = _SEGMENT_LINK(page, chunk);
+    link = _chunk_link(cache, page, chunk);
+  }
+
+cleanup:
+  return res;
+}
+
+
+// Move entries out of draining pages from the next <budget> buckets, or
+// until no page drains anymore.
+// Call without holding any lock.
+static
+int _rebalance_buckets(mmap_cache_t* cache, int budget)
+{
+  int           res      = 0;
+  cache_info_t* info     = cache->cache_info;
+  uint32_t      bucket   = 0;
+  uint32_t      draining = info->pages_draining;
+  uint64_t      slots[HASH_SLOTS_MAX];
+  int           count    = 0;
+  hash_entry_t* entry    = NULL;
+
+  for (int k = 0; k < budget && draining > 0; ++k) {
+    // (the stripe of a bucket only depends on its lower bits, like hashes;
+    // buckets are never removed, so <bucket> stays valid)
+    bucket = __atomic_fetch_add(&info->rebalance_bucket, 1, __ATOMIC_RELAXED) % info->hash_buckets;
+    res = lock_acquire_write(&cache->locks, bucket);
+    if (res) goto cleanup;
+
+    count = _hash_bucket_slots(cache, bucket, slots);
+    for (int j = 0; j < count && res == 0; ++j) {
+      entry = _hash_entry_at(cache, slots[j]);
+      if (_entry_hash(cache, entry) == HASH_UNUSED || !_rebalance_entry_draining(cache, entry)) continue;
+      res = _rebalance_entry(cache, slots[j]);
+    }
+
+    lock_release(&cache->locks, bucket);
+    if (res) goto cleanup;
+    draining = info->pages_draining;
+  }
+
+cleanup:
+  return res;
+}
+
+
+// Pick a page to drain if the last put was short of chunks, then move
+// entries out of draining pages from the next REBALANCE_BUCKETS buckets
+// (REBALANCE_BUCKETS_STARVING if the put failed for lack of chunks).
+// Call without holding any lock.
+static
+int _rebalance_step(mmap_cache_t* cache)
+{
+  int           res    = 0;
+  cache_info_t* info   = cache->cache_info;
+  int           budget = cache->rebalance_starving ? REBALANCE_BUCKETS_STARVING : REBALANCE_BUCKETS;
+
+  if (cache->rebalance_type < 0 && info->pages_draining == 0) goto cleanup;
+
+  res = lock_acquire_meta(&cache->locks);
+  if (res) goto cleanup;
+  if (cache->rebalance_type >= 0 && info->pages_draining < REBALANCE_DRAINING_MAX) {
+    _rebalance_pick(cache, (uint8_t)cache->rebalance_type, cache->rebalance_starving);
+  }
+  lock_release_meta(&cache->locks);
+  cache->rebalance_type     = -1;
+  cache->rebalance_starving = 0;
+
+  res = _rebalance_buckets(cache, budget);
+
+cleanup:
+  return res;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Reaping expired entries
+
+// outcomes of <_reap_next>
+#define _REAP_DONE    0
+#define _REAP_BUCKET  1
+#define _REAP_SKIPPED 2
+
+// most slots or regions <_reap_next> skips over at once
+#define _REAP_SKIPS_MAX 64
+
+
+// index of the first region from <region> marked in <slot>, WHEEL_REGIONS
+// if none
+static
+uint32_t _reap_next_region(wheel_slot_t* slot, uint32_t region)
+{
+  uint32_t word = region / 64;
+  uint64_t bits = 0;
+
+  if (region >= WHEEL_REGIONS) return WHEEL_REGIONS;
+  bits = slot->regions[word] & (~0ULL << (region % 64));
+  while (bits == 0) {
+    if (++word == WHEEL_REGIONS / 64) return WHEEL_REGIONS;
+    bits = slot->regions[word];
+  }
+  return word * 64 + (uint32_t)__builtin_ctzll(bits);
+}
+
+
+// Move the reaper on to the next bucket to scan as of <now>, and return it
+// in <bucket>.
+// Returns _REAP_BUCKET if there is one, _REAP_DONE if the wheel is up to
+// date, _REAP_SKIPPED if there is more to skip over first.
+// Call with the meta lock held.
+static
+int _reap_next(mmap_cache_t* cache, uint32_t now, uint32_t* bucket)
+{
+  cache_info_t* info   = cache->cache_info;
+  uint32_t      shift  = _wheel_region_shift(cache);
+  uint32_t      next   = 0;
+  uint32_t      region = 0;
+  wheel_slot_t* slot   = NULL;
+
+  for (int k = 0; k < _REAP_SKIPS_MAX; ++k) {
+    if (now < info->wheel_time + WHEEL_TICK) return _REAP_DONE;
+
+    // upper levels only have a slot starting at some ticks
+    if (info->wheel_time & ((1U << _WHEEL_SHIFT(info->wheel_level)) - 1)) {
+      --info->wheel_level;
+      continue;
+    }
+
+    slot = &cache->wheel[info->wheel_level * WHEEL_SLOTS + ((info->wheel_time >> _WHEEL_SHIFT(info->wheel_level)) & (WHEEL_SLOTS - 1))];
+    next = info->wheel_bucket;
+
+    // entering a region: skip to the next marked one, and unmark it
+    if (next < info->hash_buckets && (next & ((1U << shift) - 1)) == 0) {
+      region = _reap_next_region(slot, next >> shift);
+      next   = (region < WHEEL_REGIONS) ? region << shift : info->hash_buckets;
+      if (next < info->hash_buckets) slot->regions[region / 64] &= ~(1ULL << (region % 64));
+    }
+
+    if (next < info->hash_buckets) {
+      info->wheel_bucket = next + 1;
+      *bucket = next;
+      return _REAP_BUCKET;
+    }
+
+    // done with the slot
+    info->wheel_bucket = 0;
+    if (info->wheel_level > 0) --info->wheel_level;
+    else {
+      info->wheel_time += WHEEL_TICK;
+      info->wheel_level = WHEEL_LEVELS - 1;
+    }
+  }
+
+  return _REAP_SKIPPED;
+}
+
+
+// Remove the expired entries of <bucket> as of <now>, and record the others
+// in the wheel again. Adds the entries removed to <reaped>.
+// Call without holding any lock.
+static
+int _reap_bucket(mmap_cache_t* cache, uint32_t bucket, uint32_t now, int* reaped)
+{
+  int           res   = 0;
+  uint64_t      slots[HASH_SLOTS_MAX];
+  int           count = 0;
+  hash_entry_t* entry = NULL;
+
+  res = lock_acquire_write(&cache->locks, bucket);
+  if (res) goto cleanup;
+  res = lock_acquire_meta(&cache->locks);
+  if (res) { lock_release(&cache->locks, bucket); goto cleanup; }
+
+  count = _hash_bucket_slots(cache, bucket, slots);
+  for (int k = 0; k < count && res == 0; ++k) {
+    entry = _hash_entry_at(cache, slots[k]);
+    if (_entry_hash(cache, entry) == HASH_UNUSED || _entry_expiry(cache, entry) == HASH_EXPIRY_NONE) continue;
+
+    if (_hash_entry_expired(cache, entry, now)) {
+      res = _hash_entry_remove(cache, slots[k]);
+      ++*reaped;
+    }
+    else _wheel_mark(cache, bucket, _entry_expiry(cache, entry));
+  }
+
+  lock_release_meta(&cache->locks);
+  lock_release(&cache->locks, bucket);
+
+cleanup:
+  return res;
+}
+
+
+// Run the reaper for up to <budget> buckets as of <now>, taking off
+// <budget> what was used (hence a positive <budget> is left if the reaper
+// is done). Adds the entries removed to <reaped>.
+// Call without holding any lock.
+static
+int _reap_step(mmap_cache_t* cache, uint32_t now, int* budget, int* reaped)
+{
+  int           res    = 0;
+  int           next   = _REAP_DONE;
+  uint32_t      bucket = 0;
+  cache_info_t* info   = cache->cache_info;
+
+  while (*budget > 0) {
+    // (a stale read only delays reaping until the next step)
+    if (now < __atomic_load_n(&info->wheel_time, __ATOMIC_RELAXED) + WHEEL_TICK) break;
+
+    res = lock_acquire_meta(&cache->locks);
+    if (res) goto cleanup;
+    next = _reap_next(cache, now, &bucket);
+    lock_release_meta(&cache->locks);
+
+    if (next == _REAP_DONE) break;
+    --*budget;
+    if (next == _REAP_BUCKET) {
+      res = _reap_bucket(cache, bucket, now, reaped);
+      if (res) goto cleanup;
+    }
+  }
+
+cleanup:
+  return res;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Recovery from processes dying while holding a lock
+
+// Relink the LRU lists from their <oldest> following <newer_entry>, which
+// writers only update once the rest of the list is ready, and count their
+// entries. Unused entries are spliced out, and the REFS_MAIN bit of others
+// set as per their list; the walk stops on dangling links, or on an entry
+// already relinked (flagged REFS_SEEN meanwhile), ie. a cycle.
+// Valid entries left out (past such a point, or published by a writer that
+// died before queuing them) are then appended to their list: writers
+// unlink entries they overwrite or remove, which must thus be listed.
+// Call with the meta lock held.
+static
+int _repair_lru(mmap_cache_t* cache)
+{
+  uint64_t      limit = _hash_entry_count(cache);
+  lru_list_t*   list  = NULL;
+  uint64_t      index = 0;
+  uint64_t      older = 0;
+  hash_entry_t* entry = NULL;
+  hash_entry_t* prev  = NULL;
+  uint8_t       main  = 0;
+  uint8_t       refs  = 0;
+  uint64_t      slots[HASH_SLOTS_MAX];
+  int           count = 0;
+
+  // (a repair that died midway may have left some flagged)
+  for (uint32_t b = 0; b < cache->cache_info->hash_buckets; ++b) {
+    count = _hash_bucket_slots(cache, b, slots);
+    for (int k = 0; k < count; ++k) {
+      refs = _refs_get(cache, slots[k]);
+      if (refs & REFS_SEEN) _refs_set(cache, slots[k], refs & ~REFS_SEEN);
+    }
+  }
+
+  for (uint32_t k = 0; k < 2 * cache->page_lists_count; ++k) {
+    if (k % cache->page_lists_count > cache->page_types - (_hash_inline(cache) ? 0 : 1)) continue;
+    main  = (k < cache->page_lists_count) ? REFS_MAIN : 0;
+    list  = &cache->lru_lists[k];
+    index = list->oldest;
+    older = HASH_ENTRY_NONE;
+    prev  = NULL;
+
+    list->oldest  = HASH_ENTRY_NONE;
+    list->entries = 0;
+
+    for (uint64_t steps = 0; index != HASH_ENTRY_NONE && steps < limit; ++steps) {
+      entry = _hash_entry_at(cache, index);
+      if (entry == NULL) break;
+
+      if (_entry_hash(cache, entry) != HASH_UNUSED) {
+        refs = _refs_get(cache, index);
+        if (refs & REFS_SEEN) break;
+        _refs_set(cache, index, (refs & ~REFS_MAIN) | main | REFS_SEEN);
+        _entry_set_older(cache, entry, older);
+        if (prev != NULL) _entry_set_newer(cache, prev, index);
+        else              list->oldest = index;
+        older = index;
+        prev  = entry;
+        ++list->entries;
+      }
+      index = _entry_newer(cache, entry);
+    }
+
+    if (prev != NULL) _entry_set_newer(cache, prev, HASH_ENTRY_NONE);
+    list->newest = older;
+  }
+
+  // (invalid entries are left to <_repair_stripe>)
+  for (uint32_t b = 0; b < cache->cache_info->hash_buckets; ++b) {
+    count = _hash_bucket_slots(cache, b, slots);
+    for (int k = 0; k < count; ++k) {
+      entry = _hash_entry_at(cache, slots[k]);
+      refs  = _refs_get(cache, slots[k]);
+      if (refs & REFS_SEEN) _refs_set(cache, slots[k], refs & ~REFS_SEEN);
+      else if (_entry_hash(cache, entry) != HASH_UNUSED && _hash_entry_valid(cache, entry, b)) _lru_append(cache, slots[k]);
+    }
+  }
+
+  return 0;
+}
+
+
+// Empty the promotion rings, whose slots the dead owner of the meta lock
+// may have left half consumed (hits recorded meanwhile may be lost).
+// Call with the meta lock held.
+static
+int _repair_promote(mmap_cache_t* cache)
+{
+  promote_ring_t* ring = NULL;
+
+  if (cache->promote_rings == NULL) return 0;
+
+  for (int k = 0; k < PROMOTE_RINGS; ++k) {
+    ring = &cache->promote_rings[k];
+    for (int n = 0; n < PROMOTE_RING_SLOTS; ++n) {
+      __atomic_store_n(&ring->hits[n], PROMOTE_HIT_NONE, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&ring->tail, __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&cache->cache_info->promote_pending, 0, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+
+// Count the free chunks of used <page> again from its bitmap or free list,
+// which the allocator updates before <free_chunks>. A broken free list is
+// emptied, leaking its chunks.
+// Call with the meta lock held.
+static
+void _repair_page_chunks(mmap_cache_t* cache, uint32_t page)
+{
+  page_info_t*  info   = &cache->page_infos[page];
+  uint64_t      word   = 0;
+  uint32_t      chunks = 0;
+  free_list_t   list;
+  page_bitmap_t bitmap;
+
+  if (_page_bitmapped(cache, info->type)) {
+    _page_bitmap(cache, page, &bitmap, &word);
+    for (uint32_t w = 0; w < PAGE_BITMAP_WORDS(bitmap.slots_count); ++w) {
+      chunks += (uint32_t)__builtin_popcountll(bitmap.bitmap_ptr[w]);
+    }
+  }
+  else {
+    _page_free_list(cache, page, &list);
+    if (free_list_attach(&list) == 0) chunks = list.slots_free;
+    else {
+      LOG("page %u has a broken free list\n", page);
+      info->head_slot = 0xFFFF;
+    }
+  }
+  info->free_chunks = (uint16_t)chunks;
+}
+
+
+// Relink the page lists (and count draining pages) from the page infos,
+// which are updated before the lists, once their free chunks are counted
+// again.
+// Call with the meta lock held.
+static
+int _repair_pages(mmap_cache_t* cache)
+{
+  cache_info_t* info = cache->cache_info;
+  page_info_t*  page = NULL;
+
+  for (uint32_t k = 0; k < cache->page_lists_count; ++k) {
+    cache->page_lists[k].first_page = PAGE_NONE;
+    cache->page_lists[k].last_page  = PAGE_NONE;
+  }
+  info->pages_draining = 0;
+
+  for (uint32_t p = 0; p < info->page_count; ++p) {
+    page = &cache->page_infos[p];
+    if (page->type == PAGE_TYPE_UNUSED) {
+      _page_link(cache, p, 1);
+      continue;
+    }
+    if (page->type >= cache->page_types) {
+      LOG("page %u has invalid type %u\n", p, page->type);
+      continue;
+    }
+    _repair_page_chunks(cache, p);
+    if (page->flags & PAGE_FLAG_DRAINING) ++info->pages_draining;
+    else if (page->free_chunks > 0) _page_link(cache, p, page->free_chunks == _page_chunks_count(cache, page->type));
+  }
+
+  return 0;
+}
+
+
+// Set the tag and fingerprint of the used, valid entry at LRU <index> again:
+// from its hash, or if the cache has fingerprints, from its key (see "Key
+// fingerprints" in common.h).
+// Returns 0 on success, EPROTO if the key does not hash to the entry's hash.
+static
+int _repair_entry_tag(mmap_cache_t* cache, uint64_t index)
+{
+  hash_entry_t* entry = _hash_entry_at(cache, index);
+  uint8_t*      tag   = _hash_tag_at(cache, index);
+  uint8_t*      print = _hash_fingerprint_at(cache, index);
+  uint8_t       fingerprint = 0;
+
+  if (
+    _hash_fingerprinted(cache) &&
+    mmap_hash_fingerprint(cache->hasher, _hash_entry_key(cache, index, entry), _entry_keysize(cache, entry), &fingerprint) !=
+      _entry_hash(cache, entry)
+  ) return EPROTO;
+
+  if (tag != NULL)   *tag   = _hash_key_tag(cache, _entry_hash(cache, entry), fingerprint);
+  if (print != NULL) *print = fingerprint;
+  return 0;
+}
+
+
+// a used entry found while repairing a stripe
+struct repair_slot_
+{
+  // first segment of the entry, SEGMENT_NONE if inline or invalid
+  uint64_t link;
+  // 0 to keep the entry, 1 to remove it, 2 to clear it as the copy of
+  // another (see <_repair_stripe>)
+  uint64_t drop;
+  // LRU index of the entry
+  uint64_t index;
+  // bucket it was found in
+  uint32_t bucket;
+};
+
+typedef struct repair_slot_ repair_slot_t;
+
+
+// order by first segment, entries kept first
+static
+int _compare_repair_slots(const void* a, const void* b)
+{
+  const repair_slot_t* x = (const repair_slot_t*)a;
+  const repair_slot_t* y = (const repair_slot_t*)b;
+
+  if (x->link != y->link) return (x->link > y->link) - (x->link < y->link);
+  return (x->drop > y->drop) - (x->drop < y->drop);
+}
+
+
+// Drop the entries of <stripe> that fail validation (or with fingerprints,
+// whose key does not hash to their hash) like <_hash_entry_remove> does,
+// retiring their chain and updating the counters, then fix the LRU list.
+// A process dying in <_hash_entry_move> leaves two entries sharing a chain
+// (both in the stripe, as splits keep entries in theirs): only the first
+// one kept (or if none is, the first one dropped) owns it, the others are
+// cleared without retiring anything.
+// Call with the stripe's lock held.
+static
+int _repair_stripe(mmap_cache_t* cache, int stripe)
+{
+  int            res     = 0;
+  cache_info_t*  info    = cache->cache_info;
+  uint32_t       buckets = info->hash_buckets;
+  uint32_t       extent  = HASH_EXTENT_NONE;
+  uint64_t       slots[HASH_SLOTS_MAX];
+  int            count   = 0;
+  hash_entry_t*  entry   = NULL;
+  uint8_t*       tag     = NULL;
+  repair_slot_t* found   = NULL;
+  repair_slot_t* grown   = NULL;
+  size_t         used    = 0;
+  size_t         room    = 0;
+  size_t         dropped = 0;
+  int            meta    = 0;
+
+  for (uint32_t b = stripe; b < buckets; b += 1U << cache->locks.order) {
+    extent = _hash_bucket_extent(cache, b);
+    if (extent != HASH_EXTENT_NONE && extent >= info->hash_extents_count) {
+      _hash_bucket_set_extent(cache, b, HASH_EXTENT_NONE);
+    }
+
+    count = _hash_bucket_slots(cache, b, slots);
+    for (int k = 0; k < count; ++k) {
+      entry = _hash_entry_at(cache, slots[k]);
+      tag   = _hash_tag_at(cache, slots[k]);
+
+      if (_entry_hash(cache, entry) == HASH_UNUSED) {
+        if (tag != NULL) *tag = HASH_TAG_FREE;
+        continue;
+      }
+
+      if (used == room) {
+        room  = room ? 2 * room : 64;
+        grown = realloc(found, room * sizeof(repair_slot_t));
+        if (grown == NULL) _CACHE_BAIL(ENOMEM);
+        found = grown;
+      }
+      found[used].link   = SEGMENT_NONE;
+      found[used].drop   = !_hash_entry_valid(cache, entry, b) || _repair_entry_tag(cache, slots[k]);
+      found[used].index  = slots[k];
+      found[used].bucket = b;
+      if (!_entry_inline(cache, entry) && _chunk_valid(cache, _entry_page(cache, entry), _entry_chunk(cache, entry))) {
+        found[used].link = _SEGMENT_LINK(_entry_page(cache, entry), _entry_chunk(cache, entry));
+      }
+      dropped += found[used].drop;
+      ++used;
+    }
+  }
+
+  if (used > 1) qsort(found, used, sizeof(repair_slot_t), _compare_repair_slots);
+  for (size_t k = 1; k < used; ++k) {
+    if (found[k].link == SEGMENT_NONE || found[k].link != found[k - 1].link) continue;
+    if (found[k].drop == 0) ++dropped;
+    found[k].drop = 2;
+  }
+  if (dropped == 0) goto cleanup;
+
+  res = lock_acquire_meta(&cache->locks);
+  if (res) goto cleanup;
+  meta = 1;
+
+  for (size_t k = 0; k < used; ++k) {
+    if (found[k].drop == 0) continue;
+    entry = _hash_entry_at(cache, found[k].index);
+
+    // (copies were never counted)
+    if (found[k].drop == 1) {
+      info->entries_squared -= 2 * _hash_bucket_used(cache, found[k].bucket) - 1;
+      --info->entries_used;
+      _hash_entry_account(cache, entry, -1);
+    }
+    _hash_entry_clear(cache, found[k].index);
+
+    // (a chunk found free already is not worth failing over)
+    if (found[k].drop == 1 && found[k].link != SEGMENT_NONE &&
+        _chain_retire(cache, _SEGMENT_PAGE(found[k].link), _SEGMENT_CHUNK(found[k].link))) {
+      LOG("cannot retire the chain of entry %lu\n", (unsigned long)found[k].index);
+    }
+  }
+
+  // dropped entries are still linked in the LRU list
+  _repair_lru(cache);
+
+cleanup:
+  if (meta) lock_release_meta(&cache->locks);
+  free(found);
+  return res;
+}
+
+
+// Count the extents in use from the free list, when the count is not known
+// or may be off (see "Extent growth").
+// Call with the meta lock held.
+static
+void _repair_extents(mmap_cache_t* cache)
+{
+  cache_info_t* info = cache->cache_info;
+  free_list_t*  list = _hash_extents_list(cache);
+
+  // (a broken free list is not worth failing over)
+  if (free_list_attach(list)) return;
+
+  info->hash_extents_used = info->hash_extents_count - list->slots_free;
+  if (info->hash_extents_peak == HASH_EXTENT_NONE || info->hash_extents_peak < info->hash_extents_used) {
+    info->hash_extents_peak = info->hash_extents_used;
+  }
+}
+
+
+// <recover> callback for the lock table
+static
+int _recover_lock(void* context, int stripe)
+{
+  mmap_cache_t* cache = (mmap_cache_t*)context;
+
+  LOG("recovering lock %d after owner died\n", stripe);
+  if (stripe != LOCK_META) return _repair_stripe(cache, stripe);
+
+  // the dead process' pins will never be released
+  _repair_lru(cache);
+  _repair_pages(cache);
+  _repair_extents(cache);
+  _repair_promote(cache);
+  return lease_sweep(&cache->leases, _chunk_reclaim, cache);
+}
+
+
+// Point the lock table at the mapped metadata.
+static
+void _attach_locks(mmap_cache_t* cache)
+{
+  cache->locks.order   = cache->cache_info->lock_table_size;
+  cache->locks.stripes = (lock_t*)(cache->cache_info + 1);
+  // (aligned, although cache_info_t is packed)
+  cache->locks.meta    = (lock_t*)((uint8_t*)cache->cache_info + offsetof(cache_info_t, meta_lock));
+  cache->locks.recover = _recover_lock;
+  cache->locks.context = (void*)cache;
+}
+
+
+// Point the lease table at the mapped metadata, just after the lock table.
+static
+void _attach_leases(mmap_cache_t* cache)
+{
+  cache->leases.count  = 1U << cache->cache_info->lease_table_size;
+  cache->leases.leases = (lease_t*)(cache->locks.stripes + (1U << cache->locks.order));
+}
+
+
+// number of page lists in caches with <info> (LRU lists are twice as many)
+static
+uint32_t _page_lists_count(cache_info_t* info)
+{
+  return (info->options & CACHE_OPTION_SIZE_CLASSES) ? 2 * PAGE_LISTS : PAGE_LISTS;
+}
+
+
+// number of pages caches with <info> have room for (see "Resizing")
+static
+uint32_t _page_count_max(cache_info_t* info)
+{
+  return (info->page_count_max == PAGE_NONE) ? info->page_count : info->page_count_max;
+}
+
+
+// Point the page lists, LRU lists (and chunk sizes), page infos (and wide
+// bitmaps), then the expiry wheel at the mapped metadata, just after the
+// lease table.
+static
+void _attach_pages(mmap_cache_t* cache)
+{
+  uint32_t lists = _page_lists_count(cache->cache_info);
+  uint32_t pages = _page_count_max(cache->cache_info);
+
+  cache->page_lists_count = lists;
+  cache->page_lists  = (page_list_t*)(cache->leases.leases + cache->leases.count);
+  cache->lru_lists   = (lru_list_t*)(cache->page_lists + lists);
+  cache->page_infos  = (page_info_t*)(cache->lru_lists + 2 * lists);
+
+  cache->chunk_sizes = NULL;
+  if (cache->cache_info->options & CACHE_OPTION_SIZE_CLASSES) {
+    cache->chunk_sizes = (uint32_t*)(cache->lru_lists + 2 * lists);
+    cache->page_infos  = (page_info_t*)(cache->chunk_sizes + 2 * PAGE_LISTS);
+  }
+  cache->wheel = (wheel_slot_t*)(cache->page_infos + pages);
+
+  cache->page_bitmaps = NULL;
+  if (cache->cache_info->options & CACHE_OPTION_WIDE_BITMAPS) {
+    cache->page_bitmaps = (wide_bitmap_t*)(cache->page_infos + pages);
+    cache->wheel        = (wheel_slot_t*)(cache->page_bitmaps + pages);
+  }
+
+  cache->ghosts = NULL;
+  cache->sketch = NULL;
+  if (cache->cache_info->eviction == CACHE_EVICTION_S3FIFO) {
+    cache->ghosts = (uint32_t*)(cache->wheel + WHEEL_LEVELS * WHEEL_SLOTS);
+  }
+  if (cache->cache_info->eviction == CACHE_EVICTION_TINYLFU) {
+    cache->sketch = (uint64_t*)(cache->wheel + WHEEL_LEVELS * WHEEL_SLOTS);
+  }
+
+  cache->promote_rings = NULL;
+  if (cache->cache_info->eviction == CACHE_EVICTION_LRU) {
+    cache->promote_rings = (promote_ring_t*)(cache->wheel + WHEEL_LEVELS * WHEEL_SLOTS);
+  }
+}
+
+
+// Fill <sizes> with the chunk sizes of types growing by <growth> percent
+// (see "Size classes" in common.h).
+// Returns their number, 0 if that is more than PAGE_CLASSES_MAX.
+static
+int _size_classes(uint32_t growth, uint32_t* sizes)
+{
+  uint64_t size  = PAGE_CLASS_MIN;
+  uint64_t next  = 0;
+  int      count = 0;
+
+  for (;;) {
+    if (size > DATA_PAGE_SIZE) size = DATA_PAGE_SIZE;
+    // the largest size with as many chunks per page
+    size = DATA_PAGE_SIZE / (DATA_PAGE_SIZE / size) / PAGE_CLASS_ALIGN * PAGE_CLASS_ALIGN;
+    if (count == PAGE_CLASSES_MAX) return 0;
+    sizes[count++] = (uint32_t)size;
+    if (size == DATA_PAGE_SIZE) return count;
+
+    next = (size * growth / 100 + PAGE_CLASS_ALIGN - 1) / PAGE_CLASS_ALIGN * PAGE_CLASS_ALIGN;
+    size = (next > size) ? next : size + PAGE_CLASS_ALIGN;
+  }
+}
+
+
+// Work out the chunk types from the sizes recorded in the cache, or from
+// powers of two (see "Size classes" in common.h), once the pages are
+// attached.
+// Returns 0 on success, EPROTO if the sizes are not valid.
+static
+int _attach_classes(mmap_cache_t* cache)
+{
+  int            res  = 0;
+  uint32_t       size = 0;
+  uint32_t       prev = 0;
+  chunk_class_t* type = NULL;
+
+  cache->page_types = PAGE_TYPE_MAX + 1;
+  if (cache->chunk_sizes != NULL) cache->page_types = cache->cache_info->page_types;
+
+  for (uint32_t t = 0; t < cache->page_types; ++t) {
+    size = (cache->chunk_sizes != NULL) ? cache->chunk_sizes[t] : (uint32_t)PAGE_CLASS_MIN << t;
+    if (size <= prev || size < PAGE_CLASS_MIN || size % PAGE_CLASS_ALIGN != 0) _CACHE_BAIL(EPROTO);
+    // (only the last type has 1MB chunks)
+    if (size > DATA_PAGE_SIZE || (size == DATA_PAGE_SIZE) != (t == cache->page_types - 1)) {
+      _CACHE_BAIL(EPROTO);
+    }
+    prev = size;
+
+    type            = &cache->classes[t];
+    type->size      = size;
+    // (the last chunk of a page of 16-byte chunks is lost to the free list
+    // sentinel)
+    type->chunks    = DATA_PAGE_SIZE / size;
+    if (type->chunks > 0xFFFFU) type->chunks = 0xFFFFU;
+    type->chained   = size >= SEGMENT_CHUNK_MIN;
+    type->bitmapped = type->chunks <= PAGE_NARROW_CHUNKS_MAX ||
+                      (cache->page_bitmaps != NULL && type->chunks <= PAGE_BITMAP_SLOTS_MAX);
+    type->capacity  = size;
+    if (type->chained)                         type->capacity -= 5;
+    if (type->chunks > PAGE_NARROW_CHUNKS_MAX) type->capacity -= 2;
+  }
+
+cleanup:
+  return res;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Opening and closing
+
+// 0xFF if this host is big endian, 0x00 otherwise (as cache_info_t.big_endian)
+static
+uint8_t _host_endianness(void)
+{
+  uint16_t probe = 0x00FF;
+
+  return (*(uint8_t*)&probe == 0xFF) ? 0x00 : 0xFF;
+}
+
+
+// Offsets in the metadata file of the hash table and its extents, the size
+// of the file, and the size it may grow to (see "Data Layout" and "Extent
+// growth" in common.h).
+static
+void _meta_layout(cache_info_t* info, uint64_t* table, uint64_t* extents, uint64_t* size, uint64_t* room)
+{
+  int      tagged  = _hash_version_tagged(info->version);
+  int      aligned = info->version == CACHE_VERSION_ALIGNED;
+  uint64_t bucket  = tagged ? sizeof(hash_group_t) : sizeof(hash_bucket_t);
+  uint64_t extent  = tagged ? sizeof(hash_group_t) : sizeof(hash_extent_t);
+
+  if (aligned) {
+    bucket = sizeof(hash_bucket_aligned_t);
+    extent = sizeof(hash_extent_aligned_t);
+  }
+  if (aligned && (info->options & CACHE_OPTION_INLINE)) {
+    bucket = sizeof(hash_bucket_inline_t);
+    extent = sizeof(hash_extent_inline_t);
+  }
+
+  *table = sizeof(cache_info_t)
+         + sizeof(lock_t)      * (1ULL << info->lock_table_size)
+         + sizeof(lease_t)     * (1ULL << info->lease_table_size)
+         + sizeof(page_list_t) * _page_lists_count(info)
+         + sizeof(lru_list_t)  * 2 * _page_lists_count(info)
+         + sizeof(page_info_t) * (uint64_t)_page_count_max(info);
+  if (info->options & CACHE_OPTION_SIZE_CLASSES) {
+    *table += sizeof(uint32_t) * 2 * PAGE_LISTS;
+  }
+  if (info->options & CACHE_OPTION_WIDE_BITMAPS) {
+    *table += sizeof(wide_bitmap_t) * (uint64_t)_page_count_max(info);
+  }
+  *table  += sizeof(wheel_slot_t) * WHEEL_LEVELS * WHEEL_SLOTS;
+  *table  += _policy_table_bytes(info);
+  *table  += _promote_rings_bytes(info);
+  // (buckets of the aligned layout start on a cache line)
+  if (aligned) *table = (*table + 63) & ~63ULL;
+  *extents = *table   + (bucket << info->hash_table_max_size);
+  *size    = *extents + extent * (uint64_t)info->hash_extents_count;
+  *room    = *extents + extent * (uint64_t)_hash_extents_max(info);
+}
+
+
+// Point the hash table (buckets and extents, or groups) and the extent
+// allocator at the mapped metadata, just after the page infos.
+static
+void _attach_hash_table(mmap_cache_t* cache)
+{
+  cache_info_t* info    = cache->cache_info;
+  uint8_t*      meta    = (uint8_t*)cache->map_meta;
+  free_list_t*  list    = &cache->hash_extents_list;
+  uint64_t      table   = 0;
+  uint64_t      extents = 0;
+  uint64_t      size    = 0;
+  uint64_t      room    = 0;
+
+  _meta_layout(info, &table, &extents, &size, &room);
+  if (info->version == CACHE_VERSION_ALIGNED) {
+    cache->hash_aligned_buckets = (hash_bucket_aligned_t*)(meta + table);
+    cache->hash_aligned_extents = (hash_extent_aligned_t*)(meta + extents);
+    if (info->options & CACHE_OPTION_INLINE) {
+      cache->hash_inline_buckets = (hash_bucket_inline_t*)(meta + table);
+      cache->hash_inline_extents = (hash_extent_inline_t*)(meta + extents);
+    }
+  }
+  else if (_hash_tagged(cache)) {
+    cache->hash_groups    = (hash_group_t*)(meta + table);
+    cache->hash_overflows = (hash_group_t*)(meta + extents);
+  }
+  else {
+    cache->hash_table     = (hash_bucket_t*)(meta + table);
+    cache->hash_extents   = (hash_extent_t*)(meta + extents);
+  }
+
+  list->offset_bytes  = 4;
+  list->slots_count   = info->hash_extents_count;
+  list->slots_stride  = _hash_tagged(cache) ? sizeof(hash_group_t) : sizeof(hash_extent_t);
+  if (_hash_aligned(cache)) list->slots_stride = sizeof(hash_extent_aligned_t);
+  if (_hash_inline(cache))  list->slots_stride = sizeof(hash_extent_inline_t);
+  list->head_slot_ptr = meta + offsetof(cache_info_t, hash_extents_head);
+  list->payload_ptr   = meta + extents;
+}
+
+
+// Fill in the header of a new cache of <pages> pages as per <flags>, with
+// <classes> chunk types of sizes to be recorded (0 for powers of two), but
+// for the magic.
+static
+void _cache_info_init(cache_info_t* info, int pages, int flags, int classes)
+{
+  int      aligned     = (flags & (MMAP_CACHE_ALIGNED | MMAP_CACHE_INLINE)) != 0;
+  int      tagged      = !(flags & MMAP_CACHE_PACKED) && !aligned;
+  uint8_t  order       = 0;
+  uint8_t  order_max   = HASH_ORDER_MAX - (tagged ? 4 : 0) - (aligned ? 1 : 0);
+  uint8_t  pages_order = 0;
+  uint8_t  room_order  = 0;
+  uint32_t room        = (uint32_t)pages * PAGE_RESERVE_RATIO;
+
+  memset(info, 0xFF, sizeof(cache_info_t));
+
+  if (room > PAGE_COUNT_MAX) room = PAGE_COUNT_MAX;
+
+  // room for an entry per 128 bytes of data (4 times less in groups, 2 in
+  // aligned buckets), once grown as far as it may
+  while ((1 << pages_order) < pages) ++pages_order;
+  while ((1U << room_order) < room)  ++room_order;
+  order = room_order + (tagged ? 9 : aligned ? 12 : 13);
+
+  info->big_endian          = _host_endianness();
+  info->version             = tagged ? CACHE_VERSION_TAGGED_FP : CACHE_VERSION_PACKED_FP;
+  if (aligned) info->version = CACHE_VERSION_ALIGNED;
+  info->hash_function       = mmap_hash_default();
+  info->page_count          = pages;
+  info->page_count_max      = room;
+  info->page_limit          = PAGE_NONE;
+  info->bytes_used          = 0;
+  info->bytes_wasted        = 0;
+  info->time_origin         = (uint32_t)time(NULL);
+  info->hash_table_size     = tagged ? 6 : aligned ? 9 : 10;
+  info->hash_table_max_size = order;
+  if (info->hash_table_max_size > order_max) {
+    info->hash_table_max_size = order_max;
+  }
+  if (info->hash_table_max_size < info->hash_table_size) {
+    info->hash_table_max_size = info->hash_table_size;
+  }
+  info->lock_table_size     = LOCK_TABLE_ORDER_DEFAULT;
+  if (info->lock_table_size > info->hash_table_size) {
+    info->lock_table_size   = info->hash_table_size;
+  }
+  info->hash_extents_count  = HASH_EXTENTS_INITIAL;
+  info->hash_extents_max    = (1U << info->hash_table_max_size) / HASH_EXTENTS_RESERVE_RATIO;
+  if (info->hash_extents_max < HASH_EXTENTS_INITIAL) {
+    info->hash_extents_max  = HASH_EXTENTS_INITIAL;
+  }
+  info->hash_extents_used   = 0;
+  info->hash_extents_peak   = 0;
+  info->entries_used        = 0;
+  info->entries_squared     = 0;
+  info->hash_buckets        = 1U << info->hash_table_size;
+  info->lease_table_size    = LEASE_TABLE_ORDER_DEFAULT;
+  info->pages_draining      = 0;
+  info->rebalance_page      = 0;
+  info->rebalance_bucket    = 0;
+  info->options             = (flags & MMAP_CACHE_WIDE_BITMAPS) ? CACHE_OPTION_WIDE_BITMAPS : 0;
+  if (flags & MMAP_CACHE_INLINE) info->options |= CACHE_OPTION_INLINE;
+  if (classes) info->options |= CACHE_OPTION_SIZE_CLASSES;
+  info->page_types          = classes ? classes : PAGE_TYPE_MAX + 1;
+  info->wheel_time          = 0;
+  info->wheel_bucket        = 0;
+  info->wheel_level         = WHEEL_LEVELS - 1;
+  info->eviction            = CACHE_EVICTION_LRU;
+  if (flags & MMAP_CACHE_EVICT_CLOCK)   info->eviction = CACHE_EVICTION_CLOCK;
+  if (flags & MMAP_CACHE_EVICT_S3FIFO)  info->eviction = CACHE_EVICTION_S3FIFO;
+  if (flags & MMAP_CACHE_EVICT_TINYLFU) info->eviction = CACHE_EVICTION_TINYLFU;
+  info->policy_table_size   = 0;
+  if (info->eviction == CACHE_EVICTION_S3FIFO || info->eviction == CACHE_EVICTION_TINYLFU) {
+    info->policy_table_size = pages_order + POLICY_TABLE_PAGE_ORDER;
+    if (info->policy_table_size > POLICY_TABLE_ORDER_MAX) info->policy_table_size = POLICY_TABLE_ORDER_MAX;
+  }
+  info->policy_count        = 0;
+  info->promote_pending     = 0;
+}
+
+
+// Check the header of an existing cache, which is to have <pages> pages
+// (any if 0).
+// Returns 0 on success, non-0 on failure and sets errno.
+static
+int _cache_info_check(cache_info_t* info, int pages)
+{
+  int res = 0;
+
+  if (memcmp(info->magic, CACHE_MAGIC, sizeof(info->magic)))          _CACHE_BAIL(EPROTO);
+  if (info->big_endian != _host_endianness())                         _CACHE_BAIL(ENOTSUP);
+  if (
+    info->version != CACHE_VERSION_PACKED    &&
+    info->version != CACHE_VERSION_TAGGED    &&
+    info->version != CACHE_VERSION_PACKED_FP &&
+    info->version != CACHE_VERSION_TAGGED_FP &&
+    info->version != CACHE_VERSION_ALIGNED
+  ) _CACHE_BAIL(ENOTSUP);
+  if (info->options & ~(CACHE_OPTION_WIDE_BITMAPS | CACHE_OPTION_INLINE | CACHE_OPTION_SIZE_CLASSES)) {
+    _CACHE_BAIL(ENOTSUP);
+  }
+  if (info->eviction > CACHE_EVICTION_TINYLFU)                        _CACHE_BAIL(ENOTSUP);
+  if (mmap_hash_select(info->hash_function) == NULL)                  _CACHE_BAIL(ENOTSUP);
+  if (pages != 0 && (uint32_t)pages != info->page_count)              _CACHE_BAIL(EINVAL);
+  if (
+    info->page_count == 0                                 ||
+    (info->page_count_max != PAGE_NONE && (
+      info->page_count_max < info->page_count || info->page_count_max > PAGE_COUNT_MAX
+    ))                                                    ||
+    (info->page_limit != PAGE_NONE && info->page_limit > info->page_count) ||
+    info->hash_table_max_size > HASH_ORDER_MAX            ||
+    info->hash_table_size > info->hash_table_max_size     ||
+    info->lock_table_size > info->hash_table_size         ||
+    info->hash_extents_count == 0                         ||
+    (info->hash_extents_max != HASH_EXTENT_NONE &&
+      info->hash_extents_max < info->hash_extents_count)  ||
+    (info->hash_extents_used != HASH_EXTENT_NONE &&
+      info->hash_extents_used > info->hash_extents_count) ||
+    ((info->options & CACHE_OPTION_INLINE) && info->version != CACHE_VERSION_ALIGNED) ||
+    ((info->options & CACHE_OPTION_SIZE_CLASSES) && (
+      info->page_types == 0 || info->page_types > PAGE_CLASSES_MAX
+    ))                                                    ||
+    // (aligned entries link to each other with 32-bit indices)
+    (info->version == CACHE_VERSION_ALIGNED && (
+      info->hash_table_max_size > HASH_ORDER_MAX - 1 ||
+      (2ULL << info->hash_table_max_size) + 4ULL * _hash_extents_max(info) > HASH_LINK_NONE
+    ))                                                    ||
+    info->wheel_level >= WHEEL_LEVELS                     ||
+    info->wheel_time % WHEEL_TICK != 0                    ||
+    info->policy_table_size > POLICY_TABLE_ORDER_MAX      ||
+    (_policy_table_bytes(info) && info->policy_table_size < POLICY_TABLE_PAGE_ORDER)
+  ) _CACHE_BAIL(EPROTO);
+
+cleanup:
+  return res;
+}
+
+
+// Set up the locks, leases, page lists, buckets and extents of a new cache,
+// then mark it as ready (other processes see EPROTO until then, if this one
+// dies).
+// Returns 0 on success, non-0 on failure and sets errno.
+static
+int _cache_init(mmap_cache_t* cache)
+{
+  int           res  = 0;
+  cache_info_t* info = cache->cache_info;
+
+  res = lock_table_init(&cache->locks);
+  if (res) goto cleanup;
+  res = lease_table_init(&cache->leases);
+  if (res) goto cleanup;
+
+  memset(cache->page_infos, 0xFF, sizeof(page_info_t) * info->page_count);
+  _repair_pages(cache);
+  memset(cache->lru_lists, 0xFF, sizeof(lru_list_t) * 2 * cache->page_lists_count);
+  _repair_lru(cache);
+  memset(cache->wheel, 0, sizeof(wheel_slot_t) * WHEEL_LEVELS * WHEEL_SLOTS);
+  // (no ghosts, all counters at 0)
+  if (cache->ghosts != NULL) memset(cache->ghosts, 0xFF, _policy_table_bytes(info));
+  if (cache->sketch != NULL) memset(cache->sketch, 0, _policy_table_bytes(info));
+  if (cache->promote_rings != NULL) {
+    memset(cache->promote_rings, 0xFF, _promote_rings_bytes(info));
+    for (int k = 0; k < PROMOTE_RINGS; ++k) {
+      cache->promote_rings[k].head = 0;
+      cache->promote_rings[k].tail = 0;
+    }
+  }
+
+  for (uint32_t bucket = 0; bucket < info->hash_buckets; ++bucket) {
+    _hash_bucket_init(cache, bucket);
+  }
+  res = free_list_init(&cache->hash_extents_list);
+  if (res) goto cleanup;
+
+  memcpy(info->magic, CACHE_MAGIC, sizeof(info->magic));
+
+cleanup:
+  return res;
+}
+
+
+// Map <size> bytes of <fd> (the file at <path>), asking for transparent huge
+// pages if <flags> have MMAP_CACHE_HUGE_PAGES. Not getting them is not an
+// error, but gets a warning. If <sparse>, the mapping may go past the end of
+// the file, and reserves no huge pages on hugetlbfs (see _cache_data_alloc).
+// Returns 0 on success, non-0 on failure and sets errno.
+static
+int _cache_map(int fd, const char* path, size_t size, int flags, int sparse, void** map)
+{
+  int      res         = 0;
+  uint64_t granularity = 0;
+  int      fs          = _cache_file_system(fd, &granularity);
+  int      options     = MAP_SHARED;
+
+#if defined(MAP_NORESERVE)
+  if (sparse && fs == _CACHE_FS_HUGETLB) options |= MAP_NORESERVE;
+#else
+  (void)sparse;
+#endif
+
+  *map = mmap(NULL, size, PROT_READ | PROT_WRITE, options, fd, 0);
+  if (*map == MAP_FAILED) {
+    *map = NULL;
+    _CACHE_BAIL(errno);
+  }
+
+  // hugetlbfs files only have huge pages
+  if (!(flags & MMAP_CACHE_HUGE_PAGES) || fs == _CACHE_FS_HUGETLB) goto cleanup;
+
+#if defined(MADV_HUGEPAGE)
+  // (the advice is accepted, but ignored, on other file systems)
+  if (fs != _CACHE_FS_TMPFS) {
+    WARN("%s is not on tmpfs or hugetlbfs, using normal pages\n", path);
+  }
+  else if (madvise(*map, size, MADV_HUGEPAGE)) {
+    WARN("no transparent huge pages for %s (%s), using normal pages\n", path, strerror(errno));
+  }
+#else
+  WARN("no transparent huge pages on this platform, using normal pages for %s\n", path);
+#endif
+
+cleanup:
+  return res;
+}
+
+
+// Make the file of <fd> <size> bytes long if <create>, rounded up to what
+// its file system needs, or else check that it is large enough (EPROTO
+// otherwise). On success, <size> is the size of the file.
+// Returns 0 on success, non-0 on failure and sets errno.
+static
+int _cache_file_size(int fd, int create, size_t* size)
+{
+  int         res         = 0;
+  uint64_t    granularity = 0;
+  struct stat st;
+
+  _cache_file_system(fd, &granularity);
+  *size = (*size + granularity - 1) / granularity * granularity;
+
+  if (create) {
+    if (ftruncate(fd, *size)) _CACHE_BAIL(errno);
+    goto cleanup;
+  }
+  if (fstat(fd, &st)) _CACHE_BAIL(errno);
+  if ((uint64_t)st.st_size < *size) _CACHE_BAIL(EPROTO);
+  *size = st.st_size;
+
+cleanup:
+  return res;
+}
+
+
+// Make sure the payload file holds pages <from> to <to> (excluded), see
+// _cache_file_alloc.
+// Returns 0 on success, non-0 on failure and sets errno.
+// ENOMEM: not enough huge pages.
+static
+int _cache_data_alloc(mmap_cache_t* cache, uint32_t from, uint32_t to)
+{
+  return _cache_file_alloc(cache->fd_data, (uint64_t)from * DATA_PAGE_SIZE, (uint64_t)to * DATA_PAGE_SIZE);
+}
+
+
+// Give back the memory of pages <from> to <to> (excluded) of the payload
+// file, keeping its size (see "Resizing"). Where holes cannot be punched,
+// the memory stays with the file, with a warning.
+static
+void _cache_data_release(mmap_cache_t* cache, uint32_t from, uint32_t to)
+{
+  uint64_t granularity = 0;
+  uint64_t start       = 0;
+  uint64_t end         = 0;
+
+  _cache_file_system(cache->fd_data, &granularity);
+  // (only whole huge pages can go)
+  start = ((uint64_t)from * DATA_PAGE_SIZE + granularity - 1) / granularity * granularity;
+  end   = (uint64_t)to * DATA_PAGE_SIZE / granularity * granularity;
+  if (end <= start) return;
+
+#if defined(PLATFORM_LINUX) && defined(FALLOC_FL_PUNCH_HOLE)
+  if (fallocate(cache->fd_data, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, end - start) == 0) return;
+  WARN("cannot give back the memory of pages %u to %u of %s (%s)\n", from, to, cache->path_data, strerror(errno));
+#else
+  WARN("cannot give back the memory of pages %u to %u of %s on this platform\n", from, to, cache->path_data);
+#endif
+}
+
+
+// Unmap and close whatever <cache> holds, and free it.
+// Returns 0 on success, or the first error met (and sets errno).
+static
+int _cache_release(mmap_cache_t* cache)
+{
+  int res = 0;
+
+  if (cache->map_data != NULL && munmap(cache->map_data, cache->size_data) && !res) res = errno;
+  if (cache->map_meta != NULL && munmap(cache->map_meta, cache->size_meta) && !res) res = errno;
+  if (cache->fd_data >= 0 && close(cache->fd_data) && !res) res = errno;
+  if (cache->fd_meta >= 0 && close(cache->fd_meta) && !res) res = errno;
+  free(cache);
+
+  if (res) errno = res;
+  return res;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int mmap_cache_open(mmap_cache_t** cache, char* path, int pages, int flags)
+{
+  int           res     = 0;
+  mmap_cache_t* c       = NULL;
+  int           create  = 0;
+  uint64_t      table   = 0;
+  uint64_t      extents = 0;
+  uint64_t      size    = 0;
+  uint64_t      room    = 0;
+  size_t        data    = 0;
+  uint64_t      grain   = 0;
+  uint32_t      growth  = (flags >> MMAP_CACHE_GROWTH_SHIFT) & 0xFF;
+  int           classes = 0;
+  uint32_t      sizes[PAGE_CLASSES_MAX];
+  cache_info_t  header;
+  struct stat   st;
+
+  _validate_structure_sizes();
+
+  if (cache == NULL || path == NULL)     _CACHE_BAIL(EINVAL);
+  if (pages < 0 || pages >= (1 << 24))   _CACHE_BAIL(EINVAL);
+  if (__builtin_popcount(flags & (MMAP_CACHE_EVICT_CLOCK | MMAP_CACHE_EVICT_S3FIFO | MMAP_CACHE_EVICT_TINYLFU)) > 1) {
+    _CACHE_BAIL(EINVAL);
+  }
+  if ((flags & MMAP_CACHE_PACKED) && (flags & (MMAP_CACHE_ALIGNED | MMAP_CACHE_INLINE))) {
+    _CACHE_BAIL(EINVAL);
+  }
+  if (growth != 0) {
+    if (growth <= 100) _CACHE_BAIL(EINVAL);
+    classes = _size_classes(growth, sizes);
+    if (classes == 0)  _CACHE_BAIL(EINVAL);
+  }
+
+  c = calloc(1, sizeof(mmap_cache_t));
+  if (c == NULL) _CACHE_BAIL(ENOMEM);
+  c->fd_meta        = -1;
+  c->fd_data        = -1;
+  c->rebalance_type = -1;
+  c->promote_ring   = -1;
+
+  if (snprintf(c->path_meta, PATH_MAX, "%s.meta", path) >= PATH_MAX) _CACHE_BAIL(ENAMETOOLONG);
+  if (snprintf(c->path_data, PATH_MAX, "%s.data", path) >= PATH_MAX) _CACHE_BAIL(ENAMETOOLONG);
+
+  // Processes opening the cache at once wait for whichever creates it. An
+  // empty metadata file is a cache yet to be created.
+  c->fd_meta = open(c->path_meta, O_RDWR | O_CREAT, 0644);
+  if (c->fd_meta < 0)                    _CACHE_BAIL(errno);
+  if (flock(c->fd_meta, LOCK_EX))        _CACHE_BAIL(errno);
+  if (fstat(c->fd_meta, &st))            _CACHE_BAIL(errno);
+  create = (st.st_size == 0);
+
+  if (create) {
+    if (pages == 0) _CACHE_BAIL(ENOENT);
+    // (each chunk type may hold a page, with at least one more to rebalance)
+    if (pages <= (classes ? classes : PAGE_TYPE_MAX + 1)) _CACHE_BAIL(EINVAL);
+    _cache_info_init(&header, pages, flags, classes);
+  }
+  else {
+    if (pread(c->fd_meta, &header, sizeof(header), 0) != sizeof(header)) _CACHE_BAIL(EPROTO);
+    res = _cache_info_check(&header, pages);
+    if (res) goto cleanup;
+  }
+
+  c->fd_data = open(c->path_data, O_RDWR | O_CREAT, 0644);
+  if (c->fd_data < 0) _CACHE_BAIL(errno);
+
+  _meta_layout(&header, &table, &extents, &size, &room);
+  c->size_meta = size;
+  res = _cache_file_size(c->fd_meta, create, &c->size_meta);
+  if (res) goto cleanup;
+  // (room for the extents the hash table may grow to, see "Extent growth")
+  _cache_file_system(c->fd_meta, &grain);
+  c->size_meta = (room + grain - 1) / grain * grain;
+  data = (size_t)header.page_count * DATA_PAGE_SIZE;
+  res = _cache_file_size(c->fd_data, create, &data);
+  if (res) goto cleanup;
+  // (room for the pages the cache may grow to, see "Resizing")
+  _cache_file_system(c->fd_data, &grain);
+  c->size_data = ((size_t)_page_count_max(&header) * DATA_PAGE_SIZE + grain - 1) / grain * grain;
+
+  res = _cache_map(c->fd_meta, c->path_meta, c->size_meta, flags, 1, &c->map_meta);
+  if (res) goto cleanup;
+  res = _cache_file_alloc(c->fd_meta, 0, size);
+  if (res) goto cleanup;
+  res = _cache_map(c->fd_data, c->path_data, c->size_data, flags, 1, &c->map_data);
+  if (res) goto cleanup;
+  res = _cache_data_alloc(c, 0, header.page_count);
+  if (res) goto cleanup;
+
+  c->cache_info = (cache_info_t*)c->map_meta;
+  if (create) memcpy(c->cache_info, &header, sizeof(header));
+
+  _attach_locks(c);
+  _attach_leases(c);
+  _attach_pages(c);
+  if (create && c->chunk_sizes != NULL) {
+    memset(c->chunk_sizes, 0xFF, sizeof(uint32_t) * 2 * PAGE_LISTS);
+    memcpy(c->chunk_sizes, sizes, sizeof(uint32_t) * classes);
+  }
+  res = _attach_classes(c);
+  if (res) goto cleanup;
+  _attach_hash_table(c);
+  res = _attach_hasher(c);
+  if (res) goto cleanup;
+
+  if (create) {
+    res = _cache_init(c);
+    if (res) goto cleanup;
+  }
+
+  res = lock_acquire_meta(&c->locks);
+  if (res) goto cleanup;
+  _promote_claim(c);
+  if (c->cache_info->hash_extents_used == HASH_EXTENT_NONE) _repair_extents(c);
+  lock_release_meta(&c->locks);
+
+  // (the cache is complete: keep it whatever happens now)
+  create = 0;
+  if (flock(c->fd_meta, LOCK_UN)) _CACHE_BAIL(errno);
+
+  *cache = c;
+  c      = NULL;
+
+cleanup:
+  if (c != NULL) {
+    // a half created cache would fail every later open: empty the metadata
+    // file while still holding its lock, so that the next open creates it
+    // again
+    if (create && ftruncate(c->fd_meta, 0)) {
+      LOG("cannot empty %s\n", c->path_meta);
+    }
+    _cache_release(c);
+    errno = res;
+  }
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+int mmap_cache_close(mmap_cache_t* cache)
+{
+  int res = 0;
+
+  if (cache == NULL) _CACHE_BAIL(EINVAL);
+
+  if (cache->promote_ring >= 0 && lock_acquire_meta(&cache->locks) == 0) {
+    _promote_release(cache);
+    lock_release_meta(&cache->locks);
+  }
+  res = _cache_release(cache);
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Within a read section of <hash>'s stripe, look up the key of <entry>
+// (with <fingerprint>) and fill in its value: a malloc()ed copy of the
+// payload, or if <pin> is set, the payload itself, pinned in the mapping.
+// Sets <index> to the entry's LRU index.
+// Returns 0 on success, ENOENT if there is no such entry.
+static
+int _cache_read_entry(mmap_cache_t* cache, cache_entry_t* entry, uint32_t hash, uint8_t fingerprint, uint32_t now, int pin, uint64_t* index)
+{
+  int           res    = 0;
+  uint32_t      bucket = 0;
+  uint8_t*      chunk  = NULL;
+  void*         copy   = NULL;
+  uint64_t      bytes  = 0;
+  uint64_t      chunks = 0;
+  hash_entry_t  found;
+  uint32_t      page   = 0;
+  uint32_t      first  = 0;
+
+  entry->value = NULL;
+
+  bucket = _hash_bucket_index(hash, __atomic_load_n(&cache->cache_info->hash_buckets, __ATOMIC_ACQUIRE));
+  res    = _hash_lookup(cache, bucket, hash, fingerprint, entry->key, entry->keysize, index);
+  if (res) goto cleanup;
+
+  // the entry may change under our feet: work from a validated copy
+  _entry_copy(cache, &found, _hash_entry_at(cache, *index));
+  if (
+    _entry_keysize(cache, &found) != (uint32_t)entry->keysize ||
+    !_hash_entry_valid(cache, &found, bucket) ||
+    _hash_entry_expired(cache, &found, now)
+  ) _CACHE_BAIL(ENOENT);
+
+  if (_entry_inline(cache, &found)) {
+    // (inline values are overwritten in place, they cannot be pinned)
+    if (pin) _CACHE_BAIL(EMSGSIZE);
+    bytes = _entry_bytes(cache, &found);
+    copy  = malloc(bytes ? bytes : 1);
+    if (copy == NULL) _CACHE_BAIL(ENOMEM);
+    memcpy(copy, _hash_inline_at(cache, *index) + entry->keysize, bytes);
+    entry->value = copy;
+    entry->bytes = (int)bytes;
+    goto cleanup;
+  }
+
+  if (_chain_walk(cache, &found, NULL, 0, &bytes, &chunks)) _CACHE_BAIL(ENOENT);
+
+  page  = _entry_page(cache, &found);
+  first = _entry_chunk(cache, &found);
+  chunk = _chunk_at(cache, page, first);
+  if (pin) {
+    // only values in a single chunk can be seen in place
+    if (_chunk_link(cache, page, first) != SEGMENT_NONE) _CACHE_BAIL(EMSGSIZE);
+    res = _chunk_pin(cache, page, first);
+    if (res) goto cleanup;
+    entry->value = chunk + entry->keysize;
+  }
+  else {
+    copy = malloc(bytes ? bytes : 1);
+    if (copy == NULL) _CACHE_BAIL(ENOMEM);
+    entry->value = copy;
+    if (_chain_walk(cache, &found, copy, bytes, &bytes, &chunks)) _CACHE_BAIL(ENOENT);
+  }
+  entry->bytes = (int)bytes;
+
+cleanup:
+  if (res && copy != NULL) {
+    free(copy);
+    entry->value = NULL;
+  }
+  return res;
+}
+
+
+// Drop what <_cache_read_entry> read into <entry>, if anything.
+static
+void _cache_read_undo(mmap_cache_t* cache, cache_entry_t* entry, int pin)
+{
+  if (entry->value == NULL) return;
+  if (pin) mmap_cache_unpin(cache, entry);
+  else     free(entry->value);
+  entry->value = NULL;
+}
+
+
+// Count a hit on the entries read at <indices> (HASH_ENTRY_NONE if missed),
+// unless they moved meanwhile: with CACHE_EVICTION_LRU, record it in the
+// ring of this process (or without one, move them to the newest end of
+// their LRU list), or else bump their access count (without locking, see
+// "Eviction" in common.h).
+static
+int _cache_promote(mmap_cache_t* cache, uint64_t* indices, uint32_t* hashes, int count)
+{
+  int           res   = 0;
+  uint8_t       max   = _policy_freq_max(cache);
+  hash_entry_t* entry = NULL;
+
+  if (cache->cache_info->eviction != CACHE_EVICTION_LRU) {
+    for (int k = 0; k < count; ++k) {
+      entry = _hash_entry_at(cache, indices[k]);
+      if (entry != NULL && _entry_hash(cache, entry) == hashes[k]) _refs_hit(cache, indices[k], max);
+    }
+    goto cleanup;
+  }
+  if (cache->promote_ring >= 0) {
+    for (int k = 0; k < count; ++k) {
+      if (indices[k] != HASH_ENTRY_NONE) _promote_record(cache, indices[k], hashes[k]);
+    }
+    goto cleanup;
+  }
+
+  res = lock_acquire_meta(&cache->locks);
+  if (res) goto cleanup;
+
+  for (int k = 0; k < count; ++k) {
+    entry = _hash_entry_at(cache, indices[k]);
+    if (entry != NULL && _entry_hash(cache, entry) == hashes[k]) _lru_touch(cache, indices[k]);
+  }
+  res = lock_release_meta(&cache->locks);
+
+cleanup:
+  return res;
+}
+
+
+// Read <count> entries whose keys hash to <hashes> (with <fingerprints>) and
+// belong to the same stripe, in a single read section (see
+// <_cache_read_entry>). Sets <indices> to HASH_ENTRY_NONE for missing keys.
+static
+int _cache_read_stripe(mmap_cache_t* cache, cache_entry_t** entries, uint32_t* hashes, uint8_t* fingerprints, uint64_t* indices, int count, int pin)
+{
+  int      res    = 0;
+  uint32_t stripe = hashes[0];
+  uint32_t seq    = 0;
+  uint32_t now    = _cache_now(cache);
+  int      locked = 0;
+
+  for (int attempt = 0; ; ++attempt) {
+    locked = (attempt >= LOCK_READ_RETRIES);
+    if (locked) {
+      res = lock_acquire_read(&cache->locks, stripe);
+      if (res) goto cleanup;
+    }
+    else seq = lock_read_begin(&cache->locks, stripe);
+
+    for (int k = 0; k < count; ++k) {
+      res = _cache_read_entry(cache, entries[k], hashes[k], fingerprints[k], now, pin, &indices[k]);
+      if (res == ENOENT) indices[k] = HASH_ENTRY_NONE;
+      else if (res) break;
+      res = 0;
+    }
+
+    if (locked) {
+      lock_release(&cache->locks, stripe);
+      break;
+    }
+    if (!lock_read_retry(&cache->locks, stripe, seq)) break;
+
+    // torn read, start over
+    for (int k = 0; k < count; ++k) _cache_read_undo(cache, entries[k], pin);
+  }
+
+  if (res) {
+    for (int k = 0; k < count; ++k) _cache_read_undo(cache, entries[k], pin);
+    _CACHE_BAIL(res);
+  }
+
+cleanup:
+  return res;
+}
+
+
+// Look up the key of <entry> (see <_cache_read_entry>).
+static
+int _cache_read(mmap_cache_t* cache, cache_entry_t* entry, int pin)
+{
+  int      res   = 0;
+  uint32_t hash  = 0;
+  uint8_t  print = 0;
+  uint64_t index = 0;
+
+  if (entry->keysize < 0 || entry->keysize > MMAP_CACHE_KEY_MAX) _CACHE_BAIL(EINVAL);
+
+  hash = mmap_hash_fingerprint(cache->hasher, entry->key, entry->keysize, &print);
+  res  = _cache_read_stripe(cache, &entry, &hash, &print, &index, 1, pin);
+  if (res) goto cleanup;
+  if (index == HASH_ENTRY_NONE) _CACHE_BAIL(ENOENT);
+
+  res = _cache_promote(cache, &index, &hash, 1);
+
+cleanup:
+  return res;
+}
+
+
+int mmap_cache_get(mmap_cache_t* cache, cache_entry_t* entry)
+{
+  return _cache_read(cache, entry, 0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+int mmap_cache_get_pinned(mmap_cache_t* cache, cache_entry_t* entry)
+{
+  return _cache_read(cache, entry, 1);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+int mmap_cache_unpin(mmap_cache_t* cache, cache_entry_t* entry)
+{
+  int      res    = 0;
+  size_t   offset = 0;
+  uint32_t page   = 0;
+  uint8_t  type   = 0;
+
+  if (entry->value == NULL || (uint8_t*)entry->value < (uint8_t*)cache->map_data + entry->keysize) _CACHE_BAIL(EINVAL);
+
+  // the payload follows the key in its chunk
+  offset = (uint8_t*)entry->value - entry->keysize - (uint8_t*)cache->map_data;
+  page   = offset / DATA_PAGE_SIZE;
+  if (page >= cache->cache_info->page_count) _CACHE_BAIL(EINVAL);
+
+  type = cache->page_infos[page].type;
+  if (type >= cache->page_types) _CACHE_BAIL(EINVAL);
+  res  = _chunk_unpin(cache, page, (uint32_t)((offset % DATA_PAGE_SIZE) / cache->classes[type].size));
+  if (res) goto cleanup;
+  entry->value = NULL;
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Check <entry> can be written.
+static
+int _cache_write_check(cache_entry_t* entry)
+{
+  int res = 0;
+
+  if (entry->keysize < 0 || entry->keysize > MMAP_CACHE_KEY_MAX)   _CACHE_BAIL(EINVAL);
+  if (entry->bytes < 0)                                             _CACHE_BAIL(EINVAL);
+  if (entry->ttl < 0)                                               _CACHE_BAIL(EINVAL);
+  if (entry->keysize + entry->bytes > MMAP_CACHE_BYTES_MAX)         _CACHE_BAIL(EOVERFLOW);
+
+cleanup:
+  return res;
+}
+
+
+// <expiry> of an entry written at <now> to live <ttl> seconds
+static
+uint32_t _cache_expiry(uint32_t now, int ttl)
+{
+  if (ttl == 0) return HASH_EXPIRY_NONE;
+  if ((uint64_t)now + ttl >= HASH_EXPIRY_NONE) return HASH_EXPIRY_NONE - 1;
+  return now + ttl;
+}
+
+
+// Allocate the chunks of <entry>, whose key hashes to <hash>, evicting
+// entries as needed, and fill them. Sets <links> to the segments, and
+// <last> to the number of value bytes in the last one.
+// Call with the write lock of <hash>'s stripe held.
+static
+int _cache_write_chunks(mmap_cache_t* cache, cache_entry_t* entry, uint32_t hash, uint64_t* links, uint32_t* last)
+{
+  int           res    = 0;
+  int           skip   = 0;
+  int           count  = 0;
+  uint8_t       failed = 0;
+  uint8_t       types[SEGMENTS_MAX];
+
+  count = _segment_plan(cache, entry->keysize, entry->bytes, types);
+
+  for (int attempt = 0; ; ++attempt) {
+    res = lock_acquire_meta(&cache->locks);
+    if (res) goto cleanup;
+    res = _chain_alloc(cache, types, count, links, &failed);
+    lock_release_meta(&cache->locks);
+
+    if (res != ENOMEM || attempt == EVICT_ATTEMPTS_MAX) break;
+    cache->rebalance_type = failed;
+    res = _evict(cache, hash, failed, skip);
+    if (res == EBUSY) ++skip;
+    else if (res) break;
+  }
+  if (res == ENOMEM) cache->rebalance_starving = 1;
+  if (res) _CACHE_BAIL(res);
+
+  // nobody can see the chunks yet: fill them without the meta lock
+  *last = _chain_fill(cache, entry, links, count);
+
+cleanup:
+  return res;
+}
+
+
+// Store <entry>, whose key hashes to <hash> (with <fingerprint>), evicting
+// entries as needed.
+// Call with the write lock of <hash>'s stripe held.
+static
+int _cache_write(mmap_cache_t* cache, cache_entry_t* entry, uint32_t hash, uint8_t fingerprint)
+{
+  int           res    = 0;
+  int           meta   = 0;
+  uint64_t      links[SEGMENTS_MAX];
+  uint32_t      last   = 0;
+  uint32_t      bucket = 0;
+  uint64_t      index  = 0;
+  uint8_t*      tag    = NULL;
+  uint8_t*      print  = NULL;
+  uint8_t*      data   = NULL;
+  uint8_t       refs   = 0;
+  int           fresh  = 0;
+  uint32_t      expiry = 0;
+  hash_entry_t* slot   = NULL;
+  uint64_t      old    = SEGMENT_NONE;
+  // tiny entries take no chunk (see "Inline values" in common.h)
+  int           inlined = _hash_inline(cache) && entry->keysize + entry->bytes <= HASH_INLINE_BYTES;
+
+  if (!inlined) {
+    res = _cache_write_chunks(cache, entry, hash, links, &last);
+    if (res) goto cleanup;
+  }
+
+  res = lock_acquire_meta(&cache->locks);
+  if (res) goto cleanup;
+  meta = 1;
+  _promote_drain(cache, PROMOTE_DRAIN_MAX);
+
+  bucket = _hash_bucket_index(hash, cache->cache_info->hash_buckets);
+  if (_hash_lookup(cache, bucket, hash, fingerprint, entry->key, entry->keysize, &index) == 0) {
+    slot = _hash_entry_at(cache, index);
+    refs = _refs_get(cache, index);
+    // (its LRU list depends on the chunk it is about to leave)
+    _lru_unlink(cache, index);
+    _hash_entry_account(cache, slot, -1);
+    if (!_entry_inline(cache, slot)) old = _SEGMENT_LINK(_entry_page(cache, slot), _entry_chunk(cache, slot));
+    _hash_entry_clear(cache, index);
+  }
+  else {
+    res = _hash_slot_alloc(cache, bucket, &index);
+    if (res) {
+      // nothing refers to the new chain yet
+      if (!inlined && _chain_retire(cache, _SEGMENT_PAGE(links[0]), _SEGMENT_CHUNK(links[0]))) {
+        LOG("cannot retire the chain of a failed put\n");
+      }
+      _CACHE_BAIL(res);
+    }
+    slot = _hash_entry_at(cache, index);
+    fresh = 1;
+  }
+
+  expiry = _cache_expiry(_cache_now(cache), entry->ttl);
+  if (inlined) {
+    data = _hash_inline_at(cache, index);
+    memcpy(data, entry->key, entry->keysize);
+    memcpy(data + entry->keysize, entry->value, entry->bytes);
+    _entry_set_chunk(cache, slot, HASH_PAGE_INLINE, 0xFFFF);
+    last = entry->bytes;
+  }
+  else _entry_set_chunk(cache, slot, _SEGMENT_PAGE(links[0]), _SEGMENT_CHUNK(links[0]));
+  _entry_set_value(cache, slot, entry->keysize, last, expiry);
+  // (set last, so that a process dying meanwhile leaves the entry unused
+  // rather than half written)
+  _entry_set_hash(cache, slot, hash);
+  print = _hash_fingerprint_at(cache, index);
+  if (print != NULL) *print = fingerprint;
+  _hash_entry_account(cache, slot, 1);
+  if (expiry != HASH_EXPIRY_NONE) _wheel_mark(cache, bucket, expiry);
+
+  // new entries become visible to lookups once complete
+  tag = _hash_tag_at(cache, index);
+  if (tag != NULL) *tag = _hash_key_tag(cache, hash, fingerprint);
+  _policy_insert(cache, index, fresh, refs);
+
+  // the old chain goes once nothing refers to it, so that recovery never
+  // finds the entry pointing at retired chunks
+  if (old != SEGMENT_NONE) res = _chain_retire(cache, _SEGMENT_PAGE(old), _SEGMENT_CHUNK(old));
+
+cleanup:
+  if (meta) lock_release_meta(&cache->locks);
+  return res;
+}
+
+
+int mmap_cache_put(mmap_cache_t* cache, cache_entry_t* entry)
+{
+  int      res    = 0;
+  uint32_t hash   = 0;
+  uint8_t  print  = 0;
+  int      budget = REAP_BUCKETS;
+  int      reaped = 0;
+
+  res = _cache_write_check(entry);
+  if (res) goto cleanup;
+
+  hash = mmap_hash_fingerprint(cache->hasher, entry->key, entry->keysize, &print);
+  res  = lock_acquire_write(&cache->locks, hash);
+  if (res) goto cleanup;
+  res = _cache_write(cache, entry, hash, print);
+  lock_release(&cache->locks, hash);
+
+  // no chunk could be found: make room for the next puts
+  if (res == ENOMEM) {
+    if (_rebalance_step(cache) == 0) errno = ENOMEM;
+    goto cleanup;
+  }
+  if (res) goto cleanup;
+
+  res = _hash_grow_step(cache);
+  if (res) goto cleanup;
+  res = _rebalance_step(cache);
+  if (res) goto cleanup;
+  res = _reap_step(cache, _cache_now(cache), &budget, &reaped);
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+int mmap_cache_reap(mmap_cache_t* cache, int usecs)
+{
+  int             res    = 0;
+  int             budget = 0;
+  int             reaped = 0;
+  uint32_t        now    = _cache_now(cache);
+  struct timespec start;
+  struct timespec current;
+
+  if (usecs < 0) _CACHE_BAIL(EINVAL);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  do {
+    budget = REAP_BUCKETS;
+    res = _reap_step(cache, now, &budget, &reaped);
+    if (res || budget > 0) break;
+    clock_gettime(CLOCK_MONOTONIC, &current);
+  } while ((current.tv_sec - start.tv_sec) * 1000000 + (current.tv_nsec - start.tv_nsec) / 1000 < usecs);
+
+  LOG("reaped %d entries\n", reaped);
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+int mmap_cache_compact(mmap_cache_t* cache, int usecs)
+{
+  int             res     = 0;
+  int             picked  = 0;
+  uint32_t        idle    = 0;
+  uint32_t        moved   = 0;
+  cache_info_t*   info    = cache->cache_info;
+  struct timespec start;
+  struct timespec current;
+
+  if (usecs < 0) _CACHE_BAIL(EINVAL);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // done once every page was looked at since the last one picked, and all
+  // have drained
+  do {
+    res = lock_acquire_meta(&cache->locks);
+    if (res) goto cleanup;
+    picked = 0;
+    if (info->pages_draining < REBALANCE_DRAINING_MAX) idle += _compact_pick(cache, &picked);
+    lock_release_meta(&cache->locks);
+    if (picked) {
+      idle = 0;
+      ++moved;
+    }
+    if (idle >= info->page_count && info->pages_draining == 0) break;
+
+    res = _rebalance_buckets(cache, REBALANCE_BUCKETS_STARVING);
+    if (res) break;
+    clock_gettime(CLOCK_MONOTONIC, &current);
+  } while ((current.tv_sec - start.tv_sec) * 1000000 + (current.tv_nsec - start.tv_nsec) / 1000 < usecs);
+
+  LOG("compacting %u pages\n", moved);
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Resizing
+
+// Grow the cache to <pages>, at most <page_count_max>, or stop shrinking it
+// (see "Resizing").
+// Call with the meta lock held.
+// Returns 0 on success, non-0 on failure and sets errno.
+static
+int _resize_grow(mmap_cache_t* cache, uint32_t pages)
+{
+  int           res  = 0;
+  cache_info_t* info = cache->cache_info;
+
+  res = _cache_data_alloc(cache, info->page_count, pages);
+  if (res) goto cleanup;
+
+  memset(cache->page_infos + info->page_count, 0xFF, sizeof(page_info_t) * (pages - info->page_count));
+  info->page_count = pages;
+  info->page_limit = PAGE_NONE;
+  // (pages left unused by a shrink come back, those still draining will
+  // once empty)
+  res = _repair_pages(cache);
+
+cleanup:
+  return res;
+}
+
+
+// Stop allocating in the pages from <pages> on, and drain them (see
+// "Resizing").
+// Call with the meta lock held.
+static
+void _resize_shrink_begin(mmap_cache_t* cache, uint32_t pages)
+{
+  cache_info_t* info = cache->cache_info;
+  page_info_t*  page = NULL;
+
+  info->page_limit = pages;
+  for (uint32_t p = pages; p < info->page_count; ++p) {
+    page = &cache->page_infos[p];
+    if (page->type >= cache->page_types) continue;
+    if (page->free_chunks == _page_chunks_count(cache, page->type)) page->type = PAGE_TYPE_UNUSED;
+    else page->flags |= PAGE_FLAG_DRAINING;
+  }
+  // (pages past the limit leave the lists, and the others drain)
+  _repair_pages(cache);
+}
+
+
+// number of pages past the end of a shrinking cache still holding chunks
+static
+uint32_t _resize_shrink_pending(mmap_cache_t* cache)
+{
+  cache_info_t* info    = cache->cache_info;
+  uint32_t      pending = 0;
+
+  if (info->page_limit == PAGE_NONE) return 0;
+  for (uint32_t p = info->page_limit; p < info->page_count; ++p) {
+    if (cache->page_infos[p].type != PAGE_TYPE_UNUSED) ++pending;
+  }
+  return pending;
+}
+
+
+// Drop the pages past the end of a shrinking cache, if they are all unused,
+// and give their memory back.
+// Call with the meta lock held.
+// Returns 0 on success, EAGAIN if some page still holds chunks.
+static
+int _resize_shrink_end(mmap_cache_t* cache)
+{
+  int           res   = 0;
+  cache_info_t* info  = cache->cache_info;
+  uint32_t      count = info->page_count;
+
+  if (info->page_limit == PAGE_NONE) goto cleanup;
+  if (_resize_shrink_pending(cache) > 0) _CACHE_BAIL(EAGAIN);
+
+  info->page_count = info->page_limit;
+  info->page_limit = PAGE_NONE;
+  // (still under the meta lock, lest the pages be taken back meanwhile)
+  _cache_data_release(cache, info->page_count, count);
+
+cleanup:
+  return res;
+}
+
+
+int mmap_cache_resize(mmap_cache_t* cache, int pages)
+{
+  int           res   = 0;
+  cache_info_t* info  = cache->cache_info;
+  uint32_t      count = 0;
+
+  // (as when creating the cache)
+  if (pages <= 0 || (uint32_t)pages <= cache->page_types) _CACHE_BAIL(EINVAL);
+
+  res = lock_acquire_meta(&cache->locks);
+  if (res) goto cleanup;
+  // (caches from before resizing have room for the pages they have)
+  if (info->page_count_max == PAGE_NONE) info->page_count_max = info->page_count;
+  count = info->page_count;
+  if ((uint32_t)pages > info->page_count_max) res = EINVAL;
+  else if ((uint32_t)pages >= count)          res = _resize_grow(cache, pages);
+  else                                        _resize_shrink_begin(cache, pages);
+  lock_release_meta(&cache->locks);
+  if (res) _CACHE_BAIL(res);
+  if ((uint32_t)pages >= count) goto cleanup;
+
+  // move the entries out of the pages past the end, once more over the
+  // table for those put meanwhile
+  for (int k = 0; k < 2 && _resize_shrink_pending(cache) > 0; ++k) {
+    res = _rebalance_buckets(cache, info->hash_buckets);
+    if (res) goto cleanup;
+  }
+
+  res = lock_acquire_meta(&cache->locks);
+  if (res) goto cleanup;
+  res = _resize_shrink_end(cache);
+  lock_release_meta(&cache->locks);
+  LOG("resized to %d pages (%s)\n", pages, res ? "pending" : "done");
+  if (res) _CACHE_BAIL(res);
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+int mmap_cache_drain(mmap_cache_t* cache)
+{
+  int res  = 0;
+  int done = 0;
+
+  // a batch per meta lock acquisition, as long as hits keep coming (or
+  // until the rings went round once)
+  for (int k = 0; k < PROMOTE_RINGS * PROMOTE_RING_SLOTS / PROMOTE_DRAIN_MAX; ++k) {
+    res = lock_acquire_meta(&cache->locks);
+    if (res) goto cleanup;
+    done = _promote_drain(cache, PROMOTE_DRAIN_MAX);
+    res  = lock_release_meta(&cache->locks);
+    if (res || done < PROMOTE_DRAIN_MAX) break;
+  }
+
+cleanup:
+  return res;
+}
+
+
+int mmap_cache_stats(mmap_cache_t* cache, cache_stats_t* stats)
+{
+  cache_info_t* info = cache->cache_info;
+  int           res  = 0;
+
+  res = lock_acquire_meta(&cache->locks);
+  if (res) goto cleanup;
+  stats->pages              = info->page_count;
+  stats->entries            = info->entries_used;
+  stats->bytes_used         = info->bytes_used;
+  stats->bytes_wasted       = info->bytes_wasted;
+  stats->hash_buckets       = info->hash_buckets;
+  stats->hash_extents_used  = info->hash_extents_used;
+  stats->hash_extents_peak  = info->hash_extents_peak;
+  stats->hash_extents_count = info->hash_extents_count;
+  stats->hash_extents_max   = _hash_extents_max(info);
+  res = lock_release_meta(&cache->locks);
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Batches
+
+static
+int _compare_u64(const void* a, const void* b)
+{
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+
+  return (x > y) - (x < y);
+}
+
+
+// Hash the keys of <entries> (into <hashes> and <fingerprints>), prefetch
+// their buckets, and fill <order> with the positions of entries sorted by
+// stripe (stripe in the upper 32 bits).
+static
+void _cache_batch_prepare(mmap_cache_t* cache, cache_entry_t* entries, int count, uint32_t* hashes, uint8_t* fingerprints, uint64_t* order)
+{
+  uint32_t buckets = __atomic_load_n(&cache->cache_info->hash_buckets, __ATOMIC_ACQUIRE);
+  uint32_t mask    = (1U << cache->locks.order) - 1;
+
+  for (int k = 0; k < count; ++k) {
+    hashes[k] = mmap_hash_fingerprint(cache->hasher, entries[k].key, entries[k].keysize, &fingerprints[k]);
+    order[k]  = ((uint64_t)(hashes[k] & mask) << 32) | (uint32_t)k;
+    _hash_prefetch_bucket(cache, _hash_bucket_index(hashes[k], buckets));
+  }
+  qsort(order, count, sizeof(uint64_t), _compare_u64);
+}
+
+
+// number of entries from <first> in <order> in the same stripe
+static
+int _cache_batch_run(uint64_t* order, int first, int count)
+{
+  int last = first;
+
+  while (last < count && (order[last] >> 32) == (order[first] >> 32)) ++last;
+  return last - first;
+}
+
+
+static
+int _cache_get_batch(mmap_cache_t* cache, cache_entry_t* entries, int count)
+{
+  int            res     = 0;
+  int            run     = 0;
+  uint32_t       buckets = 0;
+  uint32_t       hashes[_CACHE_BATCH];
+  uint8_t        prints[_CACHE_BATCH];
+  uint64_t       order[_CACHE_BATCH];
+  cache_entry_t* sorted[_CACHE_BATCH];
+  uint32_t       sorted_hashes[_CACHE_BATCH];
+  uint8_t        sorted_prints[_CACHE_BATCH];
+  uint64_t       sorted_indices[_CACHE_BATCH];
+
+  for (int k = 0; k < count; ++k) {
+    if (entries[k].keysize < 0 || entries[k].keysize > MMAP_CACHE_KEY_MAX) _CACHE_BAIL(EINVAL);
+  }
+  _cache_batch_prepare(cache, entries, count, hashes, prints, order);
+
+  // buckets should have arrived by now: look for the chunks
+  buckets = __atomic_load_n(&cache->cache_info->hash_buckets, __ATOMIC_ACQUIRE);
+  for (int k = 0; k < count; ++k) {
+    _hash_prefetch_chunks(cache, _hash_bucket_index(hashes[k], buckets), hashes[k], prints[k]);
+  }
+
+  for (int k = 0; k < count; ++k) {
+    sorted[k]        = &entries[(uint32_t)order[k]];
+    sorted_hashes[k] = hashes[(uint32_t)order[k]];
+    sorted_prints[k] = prints[(uint32_t)order[k]];
+  }
+
+  // one read section per stripe
+  for (int first = 0; first < count; first += run) {
+    run = _cache_batch_run(order, first, count);
+    res = _cache_read_stripe(cache, &sorted[first], &sorted_hashes[first], &sorted_prints[first], &sorted_indices[first], run, 0);
+    if (res) goto cleanup;
+  }
+
+  res = _cache_promote(cache, sorted_indices, sorted_hashes, count);
+
+cleanup:
+  return res;
+}
+
+
+int mmap_cache_get_multi(mmap_cache_t* cache, cache_entry_t* entries, int count)
+{
+  int res = 0;
+
+  for (int k = 0; k < count; ++k) entries[k].value = NULL;
+
+  for (int first = 0; first < count; first += _CACHE_BATCH) {
+    res = _cache_get_batch(cache, entries + first, (count - first < _CACHE_BATCH) ? count - first : _CACHE_BATCH);
+    if (res) goto cleanup;
+  }
+
+cleanup:
+  if (res) {
+    for (int k = 0; k < count; ++k) {
+      free(entries[k].value);
+      entries[k].value = NULL;
+    }
+  }
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+static
+int _cache_put_batch(mmap_cache_t* cache, cache_entry_t* entries, int count)
+{
+  int           res    = 0;
+  int           run    = 0;
+  uint32_t      hash   = 0;
+  int           budget = 0;
+  int           reaped = 0;
+  uint32_t      hashes[_CACHE_BATCH];
+  uint8_t       prints[_CACHE_BATCH];
+  uint64_t      order[_CACHE_BATCH];
+
+  _cache_batch_prepare(cache, entries, count, hashes, prints, order);
+
+  // one write lock per stripe (entries of a stripe stay in order)
+  for (int first = 0; first < count; first += run) {
+    run  = _cache_batch_run(order, first, count);
+    hash = hashes[(uint32_t)order[first]];
+
+    res = lock_acquire_write(&cache->locks, hash);
+    if (res) goto cleanup;
+    for (int k = first; k < first + run && res == 0; ++k) {
+      res = _cache_write(cache, &entries[(uint32_t)order[k]], hashes[(uint32_t)order[k]], prints[(uint32_t)order[k]]);
+    }
+    lock_release(&cache->locks, hash);
+
+    // no chunk could be found: make room for the next puts
+    if (res == ENOMEM && _rebalance_step(cache) == 0) errno = ENOMEM;
+    if (res) goto cleanup;
+  }
+
+  // as many growth, rebalancing and reaping steps as single puts would have
+  // taken
+  for (int k = 0; k < count && res == 0; ++k) {
+    res = _hash_grow_step(cache);
+    if (res == 0) res = _rebalance_step(cache);
+  }
+  budget = REAP_BUCKETS * count;
+  if (res == 0) res = _reap_step(cache, _cache_now(cache), &budget, &reaped);
+
+cleanup:
+  return res;
+}
+
+
+int mmap_cache_put_multi(mmap_cache_t* cache, cache_entry_t* entries, int count)
+{
+  int res = 0;
+
+  for (int k = 0; k < count; ++k) {
+    res = _cache_write_check(&entries[k]);
+    if (res) goto cleanup;
+  }
 
+  for (int first = 0; first < count; first += _CACHE_BATCH) {
+    res = _cache_put_batch(cache, entries + first, (count - first < _CACHE_BATCH) ? count - first : _CACHE_BATCH);
+    if (res) goto cleanup;
+  }
 
 cleanup:
   return res;
@@ -1,19 +1,61 @@
-#include <sys/syslimits.h> // provides PATH_MAX
+#include <limits.h> // provides PATH_MAX
+#include <stdint.h>
 
-#define MMAP_CACHE_BYTES_MAX (1024*1024 - 5)
-#define MMAP_CACHE_KEY_MAX   1024
+// values larger than a 1MB page are chained over several chunks
+#define MMAP_CACHE_BYTES_MAX (64*1024*1024)
+// keys sizes are stored in 10 bits (see hash_entry_t)
+#define MMAP_CACHE_KEY_MAX   1023
 
 typedef struct mmap_cache_ mmap_cache_t;
 
 struct cache_entry_
 {
-  char*   key;
-  void*   value;
-  int     bytes;
+  // arbitrary bytes (not NUL-terminated), <keysize> long
+  const void* key;
+  int         keysize;
+  void*       value;
+  int         bytes;
+  // seconds the entry lives for when put, 0 for ever (up to about 2 years
+  // from the creation of the cache); ignored by gets
+  int         ttl;
 };
 
 typedef struct cache_entry_ cache_entry_t;
 
+// Flags for <mmap_cache_open>.
+// Back both mappings with transparent huge pages (madvise(MADV_HUGEPAGE)),
+// which the kernel honours for files on tmpfs mounted with huge=advise (or
+// huge=within_size). Files on hugetlbfs always get huge pages, with or
+// without this flag. Falls back to normal pages, with a warning on stderr,
+// when huge pages are not available.
+#define MMAP_CACHE_HUGE_PAGES    0x01
+// When creating the cache: use the packed hash table layout (buckets of 1
+// entry and extents of 4) rather than the tagged one.
+#define MMAP_CACHE_PACKED        0x02
+// When creating the cache: allocate 4kB to 32kB chunks through bitmaps in
+// the metadata rather than free lists.
+#define MMAP_CACHE_WIDE_BITMAPS  0x04
+// When creating the cache: evict with CLOCK, S3-FIFO or W-TinyLFU (at most
+// one of them) rather than strict LRU. Gets then leave the LRU lists alone,
+// and do not write at all for entries already read a few times.
+#define MMAP_CACHE_EVICT_CLOCK   0x08
+#define MMAP_CACHE_EVICT_S3FIFO  0x10
+#define MMAP_CACHE_EVICT_TINYLFU 0x20
+// When creating the cache: use the aligned hash table layout (entries
+// without bitfields, 2 per cache line bucket) rather than the tagged one.
+// Not with MMAP_CACHE_PACKED.
+#define MMAP_CACHE_ALIGNED       0x40
+// When creating the cache: use the aligned layout, keeping entries whose key
+// and value add up to 32 bytes or less in the hash table rather than in a
+// chunk of the data file. Not with MMAP_CACHE_PACKED.
+#define MMAP_CACHE_INLINE        0x80
+// When creating the cache: size chunks in classes growing by <_PERCENT>
+// percent (101 to 255, eg. 125 for a factor of 1.25) rather than in powers
+// of two, so that values waste less of their chunk. Factors below about
+// 1.15 make too many classes.
+#define MMAP_CACHE_GROWTH_SHIFT  8
+#define MMAP_CACHE_GROWTH(_PERCENT) ((_PERCENT) << MMAP_CACHE_GROWTH_SHIFT)
+
 // Open (and possibly create) a shared memory cache.
 // 
 // <path> - the cache basename, without any extension (.meta and .data
@@ -21,25 +63,159 @@ typedef struct cache_entry_ cache_entry_t;
 // 
 // <pages> - the number of 1MB pages in the cache. If the cache already exists,
 // the value 0 may be specified; it will result in and error if the cache does 
-// not exist yet.
+// not exist yet. New caches have room to grow to 4 times as many pages (see
+// <mmap_cache_resize>).
+//
+// <flags> - MMAP_CACHE_* above, or 0. Creation flags are ignored if the cache
+// already exists.
+//
+// A failed creation leaves the metadata file empty, so that the next open
+// creates the cache again.
 // 
 // Return 0 on success, non-zero and sets errno on error.
-// EINVAL:  <pages> too large (max. 2**24).
+// EINVAL:  <pages> too large (max. 2**24), or differs from that of the
+//          existing cache, or several eviction policies in <flags>, or
+//          both MMAP_CACHE_PACKED and MMAP_CACHE_ALIGNED or MMAP_CACHE_INLINE,
+//          or a growth factor of 100 percent or less, or making too many
+//          classes, or when creating the cache, <pages> no more than its
+//          chunk types (17 in powers of two, or as many as the classes).
+// ENOENT:  <pages> is 0 and the cache does not exist.
 // EPROTO:  the cache is in an inconsistent state
-// ENOTSUP: the cache was created with a different version
-int mmap_cache_open(mmap_cache_t** cache, char* path, int pages);
+// ENOTSUP: the cache was created with a different version, or uses a hash
+//          function this version does not know
+// ENOMEM:  the files are on hugetlbfs, and there are not enough huge pages.
+int mmap_cache_open(mmap_cache_t** cache, char* path, int pages, int flags);
 
 // Close a previously opened cache.
 int mmap_cache_close(mmap_cache_t* cache);
 
 // Read an entry from the cache.
+// <key> and <keysize> should be set; on success, <value> points to a copy of
+// the payload (to be free()d by the caller) and <bytes> is its size.
 // Return 0 on success, non-zero and sets errno on error.
 // EINVAL: key too large.
+// ENOENT: no such key.
 int mmap_cache_get(mmap_cache_t* cache, cache_entry_t* entry);
 
-// Write an entry to the cache.
+// Read an entry from the cache without copying it.
+// As <mmap_cache_get>, but <value> points to the payload in the shared
+// mapping, which stays valid (and unchanged, even if the entry gets
+// overwritten or evicted) until <mmap_cache_unpin> is called. The payload
+// must not be written to.
+// Pins are per process and not inherited by fork()ed children.
+// Return 0 on success, non-zero and sets errno on error.
+// EINVAL: key too large.
+// ENOENT: no such key.
+// ENOSPC: too many pinned entries.
+// EMSGSIZE: the value is stored in several chunks, or inline (see
+//           MMAP_CACHE_INLINE; use <mmap_cache_get>).
+int mmap_cache_get_pinned(mmap_cache_t* cache, cache_entry_t* entry);
+
+// Release an entry read with <mmap_cache_get_pinned> (with <keysize> and
+// <value> as set then); <value> is reset to NULL.
+// Return 0 on success, non-zero and sets errno on error.
+// EINVAL: <value> does not point into the cache.
+// ENOENT: the entry is not pinned.
+int mmap_cache_unpin(mmap_cache_t* cache, cache_entry_t* entry);
+
+// Write an entry to the cache, evicting others to make room.
 // Return 0 on success, non-zero and sets errno on error.
-// EINVAL: key too large
+// EINVAL: key too large, or negative <ttl>
 // EOVERFLOW: key+bytes too large.
+// ENOMEM: no room could be made: evicting up to EVICT_ATTEMPTS_MAX (16)
+//         entries freed no chunk of the size needed (typically when the
+//         pages are held by chunks of other sizes, which puts then start
+//         moving to free some), or the key's bucket has no free slot and no
+//         extent is left. Nothing is written, and an entry already stored
+//         under the key is kept. Later puts may succeed.
 int mmap_cache_put(mmap_cache_t* cache, cache_entry_t* entry);
 
+// Free the memory of expired entries for about <usecs> microseconds, or
+// until none is left to free. Puts already free a few, this can be run
+// from idle time to get the memory back sooner.
+// Return 0 on success, non-zero and sets errno on error.
+int mmap_cache_reap(mmap_cache_t* cache, int usecs);
+
+// Change the number of 1MB pages of the cache to <pages> while it is in use.
+// Growing takes effect at once. Shrinking first moves the entries out of the
+// pages past the new end (evicting those that do not fit elsewhere), then
+// gives the memory of those pages back. Processes attached to the cache
+// need not do anything, nor reopen it.
+// Return 0 on success, non-zero and sets errno on error.
+// EINVAL: <pages> is 0, or no more than the chunk types of the cache (see
+//         <mmap_cache_open>), or more than the cache has room for (4 times the
+//         pages it was created with, or as many for caches created before
+//         resizing was supported).
+// EAGAIN: pinned entries (see <mmap_cache_get_pinned>), or entries put
+//         meanwhile, are still in the pages to drop. Nothing gets put in
+//         them anymore; call again later to finish shrinking (resizing to
+//         the current number of pages gives up on it).
+// ENOMEM: the files are on hugetlbfs, and there are not enough huge pages.
+int mmap_cache_resize(mmap_cache_t* cache, int pages);
+
+// Move the live chunks of sparse pages to denser pages of the same chunk
+// size for about <usecs> microseconds, or until no page is sparse enough,
+// giving the emptied pages back for any size. Puts finish moving the chunks
+// of pages left half way. This can be run from idle time after much churn,
+// to get the memory held by a few entries per page back.
+// Return 0 on success, non-zero and sets errno on error.
+int mmap_cache_compact(mmap_cache_t* cache, int usecs);
+
+// Apply the hits recorded by gets to the LRU order (with the default LRU
+// eviction, nothing to do otherwise). Puts apply a few, this can be run
+// from idle time when gets far outnumber puts, so that entries read lately
+// are not evicted as if they were not.
+// Return 0 on success, non-zero and sets errno on error.
+int mmap_cache_drain(mmap_cache_t* cache);
+
+// Counters of a cache, see <mmap_cache_stats>.
+struct cache_stats_
+{
+  // 1MB pages of the data file
+  uint32_t pages;
+  // entries stored
+  uint64_t entries;
+  // bytes of the chunks in use, and how much of them values leave unused
+  uint64_t bytes_used;
+  uint64_t bytes_wasted;
+  // buckets (or groups of 16 entries) of the hash table
+  uint32_t hash_buckets;
+  // extents (or overflow groups) in use, the most ever in use, in the pool,
+  // and the pool may grow to
+  uint32_t hash_extents_used;
+  uint32_t hash_extents_peak;
+  uint32_t hash_extents_count;
+  uint32_t hash_extents_max;
+};
+
+typedef struct cache_stats_ cache_stats_t;
+
+// Read the counters of the cache into <stats>.
+// The extent counters tell how skewed the hash table gets: a peak close to
+// the pool's maximum means puts may soon fail with ENOMEM for lack of
+// extents.
+// Return 0 on success, non-zero and sets errno on error.
+int mmap_cache_stats(mmap_cache_t* cache, cache_stats_t* stats);
+
+// Read <count> entries at once.
+// Keys are hashed and their buckets and payloads prefetched up front, and
+// each lock stripe is only visited once per batch, which is faster than
+// as many calls to <mmap_cache_get> from a few keys on.
+// Entries are set as by <mmap_cache_get>, except that missing keys get a
+// NULL <value> rather than an error.
+// Return 0 on success, non-zero and sets errno on error (no <value> is set
+// then).
+// EINVAL: a key is too large.
+int mmap_cache_get_multi(mmap_cache_t* cache, cache_entry_t* entries, int count);
+
+// Write <count> entries at once, taking each lock stripe once per batch.
+// If a key appears several times, the last one wins.
+// Return 0 on success, non-zero and sets errno on error.
+// EINVAL, EOVERFLOW: as <mmap_cache_put>, checked before anything is written.
+// ENOMEM: as <mmap_cache_put>, for one of the entries. The batch stops there:
+//         the entries written before it stay written, the others are not
+//         (and keep their earlier values). Entries are written by lock
+//         stripe rather than in the order given, so which ones were is not
+//         reported: read them back (<mmap_cache_get_multi>) to find out, or
+//         simply put the batch again later.
+int mmap_cache_put_multi(mmap_cache_t* cache, cache_entry_t* entries, int count);
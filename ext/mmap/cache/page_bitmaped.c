@@ -0,0 +1,144 @@
+//
+// page_bitmaped.c --
+//
+#include <errno.h>
+#include <stddef.h>
+#include "page_bitmaped.h"
+
+#if defined(__AVX2__)
+  #include <immintrin.h>
+#endif
+
+
+#define _PB_BAIL(_ERR) \
+    do { errno = _ERR ; res = _ERR ; goto cleanup ; } while(0)
+
+// check if a payload address is valid
+#define _PB_VALID_PAYLOAD(_PB,_ADDR) \
+    ((uint8_t*)(_ADDR) >= (_PB)->payload_ptr && \
+     ((uint8_t*)(_ADDR) - (_PB)->payload_ptr) % (_PB)->slots_stride == 0 && \
+     ((uint8_t*)(_ADDR) - (_PB)->payload_ptr) / (_PB)->slots_stride < (_PB)->slots_count)
+
+
+inline static
+int _page_bitmap_valid(page_bitmap_t* pb)
+{
+  if (
+    pb->slots_count == 0                     ||
+    pb->slots_count > PAGE_BITMAP_SLOTS_MAX  ||
+    pb->slots_stride == 0                    ||
+    pb->slots_stride > (1<<20)               ||
+    pb->bitmap_ptr == NULL                   ||
+    pb->payload_ptr == NULL
+  ) return 0;
+
+  return 1;
+}
+
+
+// Index of the first non-zero word of the bitmap, or <words> if none.
+#if defined(__AVX2__)
+
+// one compare and one movemask for a full 4-word bitmap
+inline static
+uint32_t _page_bitmap_first_word(const uint64_t* bitmap, uint32_t words)
+{
+  __m256i  row   = _mm256_setzero_si256();
+  uint32_t zeros = 0;
+  uint32_t w     = 0;
+
+  if (words < 4) {
+    while (w < words && bitmap[w] == 0) ++w;
+    return w;
+  }
+  row   = _mm256_loadu_si256((const __m256i*)bitmap);
+  zeros = (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(row, _mm256_setzero_si256())));
+  // (bit 4 set: 4 if all words are zero)
+  return (uint32_t)__builtin_ctz(~zeros & 0x1FU);
+}
+
+#else
+
+inline static
+uint32_t _page_bitmap_first_word(const uint64_t* bitmap, uint32_t words)
+{
+  uint32_t w = 0;
+
+  while (w < words && bitmap[w] == 0) ++w;
+  return w;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+
+int page_bitmap_init(page_bitmap_t* pb)
+{
+  int      res   = 0;
+  uint32_t words = 0;
+
+  if (!_page_bitmap_valid(pb)) _PB_BAIL(EINVAL);
+
+  words = PAGE_BITMAP_WORDS(pb->slots_count);
+  for (uint32_t w = 0; w < words; ++w) pb->bitmap_ptr[w] = ~0ULL;
+  if (pb->slots_count % 64) {
+    pb->bitmap_ptr[words - 1] = (1ULL << (pb->slots_count % 64)) - 1;
+  }
+  pb->slots_free = pb->slots_count;
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+
+int page_bitmap_alloc(page_bitmap_t* pb, void** payload)
+{
+  int      res   = 0;
+  uint32_t words = 0;
+  uint32_t word  = 0;
+  uint32_t slot  = 0;
+
+  if (!_page_bitmap_valid(pb)) _PB_BAIL(EINVAL);
+  if (payload == NULL)         _PB_BAIL(EFAULT);
+
+  words = PAGE_BITMAP_WORDS(pb->slots_count);
+  word  = _page_bitmap_first_word(pb->bitmap_ptr, words);
+  if (word == words) _PB_BAIL(ENOMEM); // no free slot
+
+  slot = word * 64 + (uint32_t)__builtin_ctzll(pb->bitmap_ptr[word]);
+  // clear the lowest set bit
+  pb->bitmap_ptr[word] &= pb->bitmap_ptr[word] - 1;
+  --pb->slots_free;
+
+  *payload = (void*)(pb->payload_ptr + (size_t)slot * pb->slots_stride);
+
+cleanup:
+  return res;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+
+int page_bitmap_free(page_bitmap_t* pb, void* payload)
+{
+  int      res  = 0;
+  uint32_t slot = 0;
+  uint64_t bit  = 0;
+
+  if (!_page_bitmap_valid(pb))            _PB_BAIL(EINVAL);
+  if (!(_PB_VALID_PAYLOAD(pb,payload)))   _PB_BAIL(EFAULT);
+
+  slot = (uint32_t)(((uint8_t*)payload - pb->payload_ptr) / pb->slots_stride);
+  bit  = 1ULL << (slot % 64);
+  if (pb->bitmap_ptr[slot / 64] & bit) _PB_BAIL(EINVAL); // already free
+
+  pb->bitmap_ptr[slot / 64] |= bit;
+  ++pb->slots_free;
+
+cleanup:
+  return res;
+}
@@ -2,12 +2,57 @@
 // page_bitmaped.h --
 //
 // Manipulate a memory page where allocation uses a page bitmap.
+// None of the functions here perform memory allocation.
+// The payload memory is never touched.
 //
 #include <stdint.h>
 #include "helpers.h"
 
-struct page_t
+/*
+  How a "page bitmap" works:
+
+  One bit per slot, set while the slot is free (least significant bit of
+  the first word for the first slot). Allocation takes the first free slot,
+  found with a count-trailing-zeros of the first non-zero word: there is no
+  per-slot branching, and the payload is never read.
+*/
+
+// most slots in a bitmap (4 words)
+#define PAGE_BITMAP_SLOTS_MAX 256
+
+// words needed for <_SLOTS> slots
+#define PAGE_BITMAP_WORDS(_SLOTS) (((_SLOTS) + 63) / 64)
+
+// You need to allocate space yourself for
+// - the bitmap (PAGE_BITMAP_WORDS(<slots_count>) words)
+// - the slots (<slots_stride> * <slots_count>)
+struct page_bitmap_
 {
-  page_header_t* header_ptr;
-  uint8_t*       payload_ptr;
-}; 
\ No newline at end of file
+  // number of slots, up to PAGE_BITMAP_SLOTS_MAX
+  uint32_t  slots_count;
+  // number of free slots.
+  uint32_t  slots_free;
+  // bytes between consecutive slots (max 1MB)
+  uint32_t  slots_stride;
+  // address of the bitmap; bits past <slots_count> are 0
+  uint64_t* bitmap_ptr;
+  // address of the first slot payload
+  uint8_t*  payload_ptr;
+};
+
+typedef struct page_bitmap_ page_bitmap_t;
+
+// Marks all slots as free.
+// Returns 0 on success, non-0 on failure and sets errno.
+int page_bitmap_init(page_bitmap_t* bitmap);
+
+// Return in <payload> the address of a free slot, and mark it as used.
+// Will return ENOMEM if all slots are used.
+// Returns 0 on success, non-0 on failure and sets errno.
+int page_bitmap_alloc(page_bitmap_t* bitmap, void** payload);
+
+// Marks slot at <payload> as unused.
+// Will return EFAULT if the address is not that of a slot, EINVAL if the
+// slot is already free.
+// Returns 0 on success, non-0 on failure and sets errno.
+int page_bitmap_free(page_bitmap_t* bitmap, void* payload);
@@ -0,0 +1,397 @@
+# encoding: utf-8
+
+require 'spec_helper'
+
+describe Mmap::RawCache do
+  let(:path) { cache_path('raw') }
+
+  before { delete_cache(path) }
+  after  { delete_cache(path) }
+
+  LAYOUTS.each_pair do |layout, flags|
+    context "with the #{layout} layout" do
+      subject { described_class.new(path.to_s, 64, flags) }
+
+      after { subject.close }
+
+      it 'returns nil for missing keys' do
+        subject.get('missing').should be_nil
+      end
+
+      it 'returns what was put' do
+        subject.put 'foo', 'bar'
+        subject.get('foo').should == 'bar'
+      end
+
+      it 'returns the last value put' do
+        subject.put 'foo', 'bar'
+        subject.put 'foo', 'a longer value than before' * 10
+        subject.put 'foo', 'baz'
+        subject.get('foo').should == 'baz'
+      end
+
+      it 'accepts empty values' do
+        subject.put 'foo', ''
+        subject.get('foo').should == ''
+      end
+
+      it 'accepts binary keys and values' do
+        key   = "k\0ey\xff".b
+        value = (0..255).map(&:chr).join.b
+        subject.put key, value
+        subject.get(key).should == value
+        subject.get("k\0ey\xfe".b).should be_nil
+      end
+
+      it 'stores values of every chunk size' do
+        sizes = [1, 15, 100, 1_000, 5_000, 40_000, 300_000, 1_000_000]
+        sizes.each { |bytes| subject.put "key#{bytes}", 'x' * bytes }
+        sizes.each { |bytes| subject.get("key#{bytes}").should == 'x' * bytes }
+      end
+
+      it 'stores values over a page' do
+        sizes = [1 << 20, (1 << 20) + 1, 3_500_000, 20_000_000]
+        sizes.each { |bytes| subject.put "key#{bytes}", bytes.to_s * (bytes / bytes.to_s.size) }
+        sizes.each { |bytes| subject.get("key#{bytes}").should == bytes.to_s * (bytes / bytes.to_s.size) }
+      end
+
+      it 'overwrites values over a page with smaller ones, and back' do
+        large = (0..255).map(&:chr).join.b * 10_000
+        subject.put 'foo', large
+        subject.put 'foo', 'bar'
+        subject.get('foo').should == 'bar'
+        subject.put 'foo', large
+        subject.get('foo').should == large
+      end
+
+      it 'rejects values over 64MB' do
+        lambda { subject.put 'foo', 'x' * (64 << 20) }.should raise_error(Errno::EOVERFLOW)
+      end
+
+      # (values that do not fill most of a chunk are split over smaller
+      # ones, which cannot be pinned; these fit in one)
+      it 'keeps a pinned value unchanged across an overwrite' do
+        subject.put 'foo', 'old' * 20
+        value = subject.get_pinned('foo')
+        subject.put 'foo', 'new' * 20
+        value.should == 'old' * 20
+        subject.get('foo').should == 'new' * 20
+        subject.unpin 'foo', value
+      end
+
+      it 'keeps a pinned value unchanged while the cache churns' do
+        subject.put 'foo', 'old' * 20
+        value = subject.get_pinned('foo')
+        2_000.times { |n| subject.put "key#{n}", 'x' * 100_000 }
+        value.should == 'old' * 20
+        subject.unpin 'foo', value
+      end
+
+      it 'returns nil when pinning missing keys' do
+        subject.get_pinned('missing').should be_nil
+      end
+
+      it 'does not pin values over a page' do
+        subject.put 'foo', 'x' * 2_000_000
+        lambda { subject.get_pinned 'foo' }.should raise_error(Errno::EMSGSIZE)
+      end
+
+      it 'unpins once' do
+        subject.put 'foo', 'old' * 20
+        value = subject.get_pinned('foo')
+        subject.unpin 'foo', value
+        lambda { subject.unpin 'foo', value }.should raise_error(Errno::ENOENT)
+      end
+
+      it 'keeps many keys apart' do
+        1_000.times { |n| subject.put "key#{n}", "value#{n}" * (n % 7) }
+        1_000.times { |n| subject.get("key#{n}").should == "value#{n}" * (n % 7) }
+      end
+
+      it 'rejects keys over 1023 bytes' do
+        lambda { subject.put 'x' * 1024, 'bar' }.should raise_error(Errno::EINVAL)
+        lambda { subject.get 'x' * 1024 }.should raise_error(Errno::EINVAL)
+      end
+
+      it 'evicts entries to make room' do
+        value = 'x' * 10_000
+        10_000.times { |n| subject.put "key#{n}", value }
+        found = (0...10_000).count { |n| subject.get("key#{n}") == value }
+        (found > 1_000 && found < 10_000).should == true
+      end
+    end
+  end
+
+  describe '.new' do
+    let(:flags) { 0 }
+    subject { described_class.new(path.to_s, 64, flags) }
+
+    after { subject.close }
+
+    it 'creates the metadata and data files' do
+      subject
+      Pathname.new("#{path}.meta").should be_exist
+      Pathname.new("#{path}.data").size.should == 64 << 20
+    end
+
+    it 'keeps entries across close and reopen' do
+      cache = described_class.new(path.to_s, 64)
+      cache.put 'foo', 'bar'
+      cache.close
+      subject.get('foo').should == 'bar'
+    end
+
+    it 'shares entries with other processes' do
+      subject.put 'foo', 'bar'
+      pid = fork do
+        cache = described_class.new(path.to_s, 64)
+        exit!(cache.get('foo') == 'bar' && cache.put('baz', 'qux') ? 0 : 1)
+      end
+      Process.wait(pid)
+      $?.exitstatus.should == 0
+      subject.get('baz').should == 'qux'
+    end
+
+    it 'ignores the creation flags of an existing cache' do
+      subject.put 'foo', 'bar'
+      cache = described_class.new(path.to_s, 64, LAYOUTS['packed'])
+      cache.get('foo').should == 'bar'
+      cache.close
+    end
+
+    context 'with huge pages' do
+      let(:flags) { described_class::HUGE_PAGES }
+
+      it 'works, with or without them' do
+        subject.put 'foo', 'bar'
+        subject.get('foo').should == 'bar'
+      end
+    end
+
+    it 'rejects the packed layout with the aligned or inline ones' do
+      [LAYOUTS['aligned'], LAYOUTS['inline']].each do |layout|
+        lambda {
+          described_class.new(path.to_s, 64, LAYOUTS['packed'] | layout)
+        }.should raise_error(Errno::EINVAL)
+      end
+      subject.put 'foo', 'bar'
+    end
+
+    it 'rejects caches with no more pages than chunk types' do
+      lambda { described_class.new(path.to_s, 17) }.should raise_error(Errno::EINVAL)
+      subject.put 'foo', 'bar'
+    end
+  end
+
+  describe '#put' do
+    subject { described_class.new(path.to_s, 64) }
+
+    after { subject.close }
+
+    context 'when the pages are held by chunks of another size' do
+      before { 500_000.times { |n| subject.put "small#{n}", 'x' * 100 } }
+
+      it 'raises FullError and keeps the previous value' do
+        failed = (0...100).find do |n|
+          subject.put "key#{n}", 'old'
+          begin
+            subject.put "key#{n}", 'x' * 300_000
+            false
+          rescue described_class::FullError
+            true
+          end
+        end
+        failed.should_not be_nil
+        subject.get("key#{failed}").should == 'old'
+      end
+
+      it 'makes room for later puts' do
+        stored = (0...2_000).count do |n|
+          begin
+            subject.put "key#{n}", 'x' * 300_000
+          rescue described_class::FullError
+            nil
+          end
+        end
+        stored.should > 100
+      end
+    end
+  end
+
+  describe '#put_multi' do
+    subject { described_class.new(path.to_s, 64) }
+
+    after { subject.close }
+
+    it 'puts every entry' do
+      subject.put 'foo', 'old'
+      subject.put_multi('foo' => 'bar', 'baz' => 'qux')
+      subject.get('foo').should == 'bar'
+      subject.get('baz').should == 'qux'
+    end
+
+    it 'rejects keys over 1023 bytes before writing anything' do
+      lambda { subject.put_multi('foo' => 'bar', 'x' * 1024 => 'bar') }.should raise_error(Errno::EINVAL)
+      subject.get('foo').should be_nil
+    end
+
+    context 'when the pages are held by chunks of another size' do
+      let(:big) { 'x' * 300_000 }
+
+      before { 500_000.times { |n| subject.put "small#{n}", 'x' * 100 } }
+
+      it 'raises FullError, leaving the entries after the failing one unwritten' do
+        batch = (0...100).map { |n| ["key#{n}", big] }.to_h
+        batch.each_key { |key| subject.put key, 'old' }
+        lambda { subject.put_multi batch }.should raise_error(described_class::FullError)
+        values = batch.keys.map { |key| subject.get key }
+        values.all? { |value| value == 'old' || value == big }.should == true
+        values.count('old').should > 0
+      end
+    end
+  end
+
+  describe 'expiry' do
+    subject { described_class.new(path.to_s, 64) }
+
+    after { subject.close }
+
+    it 'returns entries until their ttl is over' do
+      subject.put 'short', 'bar', 1
+      subject.put 'long', 'bar', 60
+      subject.put 'never', 'bar'
+      subject.get('short').should == 'bar'
+      sleep 2.1
+      subject.get('short').should be_nil
+      subject.get('long').should == 'bar'
+      subject.get('never').should == 'bar'
+    end
+
+    it 'rejects negative ttls' do
+      lambda { subject.put 'foo', 'bar', -1 }.should raise_error(Errno::EINVAL)
+    end
+
+    describe '#reap' do
+      it 'keeps live entries' do
+        subject.put 'short', 'bar', 1
+        subject.put 'never', 'bar'
+        sleep 2.1
+        subject.reap 100_000
+        subject.get('short').should be_nil
+        subject.get('never').should == 'bar'
+      end
+
+      it 'frees expired entries before live ones get evicted' do
+        value = 'x' * 100_000
+        subject.put 'oldest', 'bar'
+        400.times { |n| subject.put "short#{n}", value, 1 }
+        sleep 2.1
+        subject.reap 1_000_000
+        400.times { |n| subject.put "never#{n}", value }
+        subject.get('oldest').should == 'bar'
+        subject.get('never0').should == value
+      end
+    end
+  end
+
+  describe '#resize' do
+    let(:value) { 'x' * 100_000 }
+    let(:data)  { Pathname.new("#{path}.data") }
+    subject { described_class.new(path.to_s, 64) }
+
+    after { subject.close }
+
+    it 'grows the cache' do
+      subject.put 'foo', 'bar'
+      subject.resize 128
+      data.size.should == 128 << 20
+      subject.get('foo').should == 'bar'
+      1_000.times { |n| subject.put "key#{n}", value }
+      (0...1_000).count { |n| subject.get("key#{n}") == value }.should > 900
+    end
+
+    it 'grows the cache for processes attached before' do
+      cache = described_class.new(path.to_s, 64)
+      subject.resize 128
+      1_000.times { |n| cache.put "key#{n}", value }
+      (0...1_000).count { |n| subject.get("key#{n}") == value }.should > 900
+      cache.close
+    end
+
+    it 'shrinks the cache, moving entries out of the pages dropped' do
+      200.times { |n| subject.put "key#{n}", value }
+      subject.resize 32
+      (0...200).count { |n| subject.get("key#{n}") == value }.should == 200
+      data.stat.blocks.should < 48 << 11
+      1_000.times { |n| subject.put "more#{n}", value }
+      (0...1_000).count { |n| subject.get("more#{n}") == value }.should < 330
+    end
+
+    it 'grows a shrunk cache back' do
+      subject.resize 32
+      subject.resize 256
+      1_000.times { |n| subject.put "key#{n}", value }
+      (0...1_000).count { |n| subject.get("key#{n}") == value }.should == 1_000
+    end
+
+    it 'rejects sizes out of range' do
+      [0, 17, 257].each do |pages|
+        lambda { subject.resize pages }.should raise_error(Errno::EINVAL)
+      end
+    end
+  end
+
+  describe '#stats' do
+    subject { described_class.new(path.to_s, 64, LAYOUTS['packed']) }
+
+    after { subject.close }
+
+    it 'counts pages and entries' do
+      subject.put 'foo', 'bar'
+      subject.put 'foo', 'baz'
+      subject.put 'qux', 'bar'
+      subject.stats[:pages].should == 64
+      subject.stats[:entries].should == 2
+      subject.stats[:bytes_used].should > 0
+    end
+
+    it 'tracks the extents in use and their high-water mark' do
+      subject.stats[:hash_extents_peak].should == 0
+      20_000.times { |n| subject.put "key#{n}", 'x' * 10 }
+      stats = subject.stats
+      stats[:hash_extents_used].should > 0
+      stats[:hash_extents_peak].should == stats[:hash_extents_used]
+      (stats[:hash_extents_count] <= stats[:hash_extents_max]).should == true
+    end
+
+    it 'never lowers the high-water mark' do
+      20_000.times { |n| subject.put "key#{n}", 'x' * 10 }
+      peak = subject.stats[:hash_extents_peak]
+      200.times { |n| subject.put "big#{n}", 'x' * 1_000_000 }
+      stats = subject.stats
+      (stats[:hash_extents_peak] >= peak).should == true
+      (stats[:hash_extents_peak] >= stats[:hash_extents_used]).should == true
+    end
+  end
+
+  describe '#get_pinned' do
+    subject { described_class.new(path.to_s, 64, LAYOUTS['inline']) }
+
+    after { subject.close }
+
+    it 'does not pin inline values' do
+      subject.put 'foo', 'bar'
+      lambda { subject.get_pinned 'foo' }.should raise_error(Errno::EMSGSIZE)
+    end
+  end
+
+  describe '#close' do
+    subject { described_class.new(path.to_s, 64) }
+
+    it 'prevents further use' do
+      subject.close
+      lambda { subject.get 'foo' }.should raise_error(Mmap::RawCache::ClosedError)
+      lambda { subject.put 'foo', 'bar' }.should raise_error(Mmap::RawCache::ClosedError)
+    end
+  end
+end
@@ -0,0 +1,81 @@
+# encoding: utf-8
+
+require 'spec_helper'
+
+describe Mmap::RawCache do
+  let(:path) { cache_path('robustness') }
+  let(:keys) { 200 }
+
+  before { delete_cache(path) }
+  after  { delete_cache(path) }
+
+  # Values say which key they belong to and how long they are, so that a
+  # torn or misplaced one shows.
+  def value_for(key, bytes)
+    "#{key}|#{bytes}|" + '.' * bytes
+  end
+
+  def valid?(key, value)
+    return true if value.nil?
+    name, bytes, rest = value.split('|', 3)
+    name == key && rest == '.' * bytes.to_i
+  end
+
+  # Run the block in a child process; its exit status, or nil if it did
+  # not exit within <seconds>.
+  def in_child(seconds)
+    pid = fork do
+      ok = begin
+        yield
+      rescue Exception
+        false
+      end
+      exit!(ok ? 0 : 1)
+    end
+    deadline = Time.now + seconds
+    while Time.now < deadline
+      return $?.exitstatus if Process.wait(pid, Process::WNOHANG)
+      sleep 0.01
+    end
+    Process.kill(:KILL, pid)
+    Process.wait(pid)
+    nil
+  end
+
+  LAYOUTS.each_pair do |layout, flags|
+    context "with the #{layout} layout" do
+      it 'survives writers killed at any point' do
+        described_class.new(path.to_s, 64, flags).close
+
+        20.times do |round|
+          writer = fork do
+            cache = described_class.new(path.to_s, 64)
+            random = Random.new(round)
+            loop do
+              key = "key#{random.rand(keys)}"
+              case random.rand(10)
+              when 0    then cache.put key, value_for(key, 1_500_000)
+              when 1..3 then cache.put key, value_for(key, random.rand(20_000)), random.rand(3)
+              when 4    then cache.reap 100
+              else           cache.get key
+              end
+            end
+          end
+          sleep 0.005 + rand * 0.05
+          Process.kill(:KILL, writer)
+          Process.wait(writer)
+        end
+
+        # (in a child, so that a lock left behind fails the example rather
+        # than hangs it)
+        status = in_child(30) do
+          cache = described_class.new(path.to_s, 64)
+          keys.times.all? { |n| valid?("key#{n}", cache.get("key#{n}")) } &&
+            keys.times.all? { |n| cache.put("key#{n}", value_for("key#{n}", n * 100)) } &&
+            keys.times.all? { |n| cache.get("key#{n}") == value_for("key#{n}", n * 100) }
+        end
+        status.should == 0
+      end
+    end
+  end
+end
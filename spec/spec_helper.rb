@@ -1,84 +1,35 @@
-require 'blurrily'
-require 'socket'
-require 'timeout'
+require 'mmap/cache'
+require 'pathname'
 require 'coveralls'
 
 Coveralls.wear!
- 
-#
-# Example:
-#   mock_tcp_next_request("<xml>junk</xml>")
-#
-class FakeTCPSocket
-  def initialize(canned_response)
-    @canned_response = canned_response
-  end
-
-  def puts(ignored = nil)
-  end
-  
-  def gets
-    "#{@canned_response}\n"
-  end
-end
- 
-def mock_tcp_next_request(string, client_expectation=nil) 
-  TCPSocket.stub!(:new).and_return do
-    FakeTCPSocket.new(string).tap do |fake_socket|
-      if client_expectation
-        fake_socket.should_receive(:puts).with(client_expectation)
-      end
-
-      TCPSocket.unstub!(:new)
-    end
-  end
-end
-
-
-def is_port_open?(host, port)
-  Timeout::timeout(1.0) do
-    TCPSocket.new(host, port).close
-    return true
-  end
-rescue Timeout::Error, Errno::ECONNREFUSED, Errno::EHOSTUNREACH
-  return false
-end
 
-def find_free_port()
-  while true
-    port = 1024 + rand(32768 - 1024)
-    is_port_open?('localhost', port) and next
-    break port
-  end
-end
-
-def wait_for_socket(host, port, timeout=10.0)
-  Timeout::timeout(timeout) do
-    sleep 50e-3 while !is_port_open?(host, port)
-  end
-end
+# Creation flags of every layout and option, by name.
+LAYOUTS = {
+  'tagged'       => 0,
+  'packed'       => Mmap::RawCache::PACKED,
+  'aligned'      => Mmap::RawCache::ALIGNED,
+  'inline'       => Mmap::RawCache::ALIGNED | Mmap::RawCache::INLINE,
+  'wide bitmaps' => Mmap::RawCache::WIDE_BITMAPS,
+  'size classes' => 125 << Mmap::RawCache::GROWTH_SHIFT,
+  'clock'        => Mmap::RawCache::EVICT_CLOCK,
+  's3fifo'       => Mmap::RawCache::EVICT_S3FIFO,
+  'tinylfu'      => Mmap::RawCache::EVICT_TINYLFU,
+}
 
-def wait_for_file(path, timeout=10.0)
-  Timeout::timeout(timeout) do
-    sleep 50e-3 until path.exist?
-  end
+# Base path of a scratch cache, on a tmpfs when there is one.
+def cache_path(name)
+  dir = Pathname.new('/dev/shm')
+  dir = Pathname.new('tmp').tap(&:mkpath) unless dir.directory? && dir.writable?
+  dir.join("mmap-cache-spec-#{name}-#{Process.pid}")
 end
 
-
-RSpec.configure do |config|
-  config.before(:each) do
-  end
-
-  config.after(:each) do
-  end
+def delete_cache(path)
+  %w(meta data).each { |ext| Pathname.new("#{path}.#{ext}").delete_if_exists }
 end
 
 
 Pathname.class_eval do
-  def md5sum
-    Digest::MD5.file(self.to_s)
-  end
-
   def delete_if_exists
     delete if exist?
   end